@@ -0,0 +1,60 @@
+// Runs commands read from stdin (one per line) on the device through the pipelining client.
+// Build: g++ -std=c++11 -O2 lfseclient.cpp lfsecli.cpp -o lfsecli
+//
+//   lfsecli [-w window] [-b baud] <tty> < commands.txt
+//
+// Output of the commands goes to stdout, errors to stderr, exit code is 1 if any command failed.
+// -w 1 sends a command only after the previous one is answered, which shows what pipelining saves
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "lfseclient.h"
+
+int main(int argc, char** argv) {
+	LFSEClient client;
+	unsigned int baud = 115200;
+	const char* ttyPath = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-w") && i + 1 < argc)
+			client.window = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+			baud = strtoul(argv[++i], nullptr, 10);
+		else
+			ttyPath = argv[i];
+	}
+	if (!ttyPath || !client.window) {
+		fprintf(stderr, "usage: %s [-w window] [-b baud] <tty> < commands.txt\n", argv[0]);
+		return 2;
+	}
+	if (!client.open(ttyPath, baud)) {
+		perror(ttyPath);
+		return 1;
+	}
+	std::vector<LFSEClient::Request> requests;
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (!line.empty())
+			requests.push_back({ line, "" });
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<LFSEClient::Response> responses = client.run(requests);
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	int exitCode = responses.size() < requests.size();
+	for (size_t i = 0; i < responses.size(); ++i) {
+		const LFSEClient::Response& res = responses[i];
+		fwrite(res.out.data(), 1, res.out.size(), stdout);
+		if (!res.err.empty())
+			fprintf(stderr, "%s: %s", requests[i].line.c_str(), res.err.c_str());
+		exitCode |= res.status != 0;
+	}
+	if (responses.size() < requests.size())
+		fprintf(stderr, "%s: no response\n", requests[responses.size()].line.c_str());
+	fprintf(stderr, "%zu commands in %.3f s\n", responses.size(), elapsed);
+	return exitCode;
+}
@@ -0,0 +1,151 @@
+#include "lfseclient.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t toSpeed(unsigned int baud) {
+	switch (baud) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		default: return B115200;
+	}
+}
+
+bool LFSEClient::open(const char* ttyPath, unsigned int baud) {
+	close();
+	_fd = ::open(ttyPath, O_RDWR | O_NOCTTY);
+	if (_fd < 0)
+		return false;
+	termios tty;
+	if (tcgetattr(_fd, &tty)) {
+		close();
+		return false;
+	}
+	cfmakeraw(&tty);
+	cfsetispeed(&tty, toSpeed(baud));
+	cfsetospeed(&tty, toSpeed(baud));
+	tty.c_cflag |= CLOCAL | CREAD;
+	if (tcsetattr(_fd, TCSANOW, &tty)) {
+		close();
+		return false;
+	}
+	tcflush(_fd, TCIOFLUSH);
+	return true;
+}
+void LFSEClient::close() {
+	if (_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+	_rx.clear();
+	_inFlight.clear();
+	_inFlightBytes = 0;
+}
+
+std::vector<LFSEClient::Response> LFSEClient::run(const std::vector<Request>& requests) {
+	std::vector<Response> res;
+	size_t nSent = 0;
+	while (res.size() < requests.size()) {
+		// keep the pipe full, but a single request is always let through
+		while (nSent < requests.size() && (_inFlight.empty() || (_inFlight.size() < window
+			&& _inFlightBytes + requests[nSent].line.size() + requests[nSent].payload.size() <= maxInFlightBytes))) {
+			if (!send(requests[nSent]))
+				return res;
+			++nSent;
+		}
+		res.emplace_back();
+		if (!receive(res.back())) {
+			// responses can't be matched reliably anymore
+			res.pop_back();
+			_rx.clear();
+			_inFlight.clear();
+			_inFlightBytes = 0;
+			return res;
+		}
+	}
+	return res;
+}
+
+bool LFSEClient::send(const Request& request) {
+	uint32_t id = _nextId++;
+	std::string data = "@" + std::to_string(id) + " " + request.line + "\n" + request.payload;
+	for (size_t pos = 0; pos < data.size();) {
+		ssize_t nBytes = ::write(_fd, data.data() + pos, data.size() - pos);
+		if (nBytes < 0 && errno != EINTR)
+			return false;
+		if (nBytes > 0)
+			pos += nBytes;
+	}
+	_inFlight.push_back({ id, data.size() });
+	_inFlightBytes += data.size();
+	return true;
+}
+// Collects frames of the oldest request in flight up to its status frame
+bool LFSEClient::receive(Response& res) {
+	const InFlight& expected = _inFlight.front();
+	res.id = expected.id;
+	while (true) {
+		uint32_t id, value;
+		char type;
+		if (!readFrameHeader(id, type, value))
+			return false;
+		if (type == 'O' || type == 'E') {
+			if (!fill(value))
+				return false;
+			if (id == expected.id)
+				(type == 'O' ? res.out : res.err).append(_rx, 0, value);
+			_rx.erase(0, value);
+		} else if (type == 'S' && id == expected.id) {
+			res.status = value;
+			_inFlightBytes -= expected.size;
+			_inFlight.pop_front();
+			return true;
+		}
+	}
+}
+// Skips anything that isn't a frame header, e.g. boot messages
+bool LFSEClient::readFrameHeader(uint32_t& id, char& type, uint32_t& value) {
+	while (true) {
+		size_t lineEnd = _rx.find('\n');
+		if (lineEnd == std::string::npos) {
+			if (!fill(_rx.size() + 1))
+				return false;
+			continue;
+		}
+		std::string line = _rx.substr(0, lineEnd);
+		_rx.erase(0, lineEnd + 1);
+		unsigned int parsedId, parsedValue;
+		if (sscanf(line.c_str(), "@%u %c %u", &parsedId, &type, &parsedValue) == 3) {
+			id = parsedId;
+			value = parsedValue;
+			return true;
+		}
+	}
+}
+// Reads until at least size bytes are buffered
+bool LFSEClient::fill(size_t size) {
+	char buffer[4096];
+	while (_rx.size() < size) {
+		pollfd pfd = { _fd, POLLIN, 0 };
+		int nReady = poll(&pfd, 1, timeoutMs);
+		if (nReady < 0 && errno == EINTR)
+			continue;
+		if (nReady <= 0)
+			return false;
+		ssize_t nBytes = ::read(_fd, buffer, sizeof(buffer));
+		if (nBytes < 0 && errno == EINTR)
+			continue;
+		if (nBytes <= 0)
+			return false;
+		_rx.append(buffer, nBytes);
+	}
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef LFSECLIENT_H__
+#define LFSECLIENT_H__
+
+// Host-side client of the explorer's machine mode (see LFSEFrameWriter in src/lfsexplorer.h), POSIX only.
+// Commands are pipelined: several requests are sent ahead of their responses, so that a batch
+// of small commands isn't dominated by the round trip of each one.
+//
+//   LFSEClient client;
+//   client.open("/dev/ttyUSB0", 115200);
+//   std::vector<LFSEClient::Response> res = client.run({ { "ls /" }, { "cat /cfg.json" } });
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+class LFSEClient {
+public:
+	struct Request {
+		std::string line; // command line without id and line end
+		std::string payload; // sent right after the line, e.g. for tar -x or patch
+	};
+	struct Response {
+		uint32_t id = 0;
+		int status = -1; // see LFSEFrameWriter::Status, -1 if the device didn't answer in time
+		std::string out;
+		std::string err;
+	};
+
+	size_t window = 8; // requests in flight at most
+	size_t maxInFlightBytes = 256; // keep within the device's receive buffer
+	int timeoutMs = 5000; // per response
+
+	~LFSEClient() { close(); }
+	bool open(const char* ttyPath, unsigned int baud);
+	void openFd(int fd) { close(); _fd = fd; } // already configured descriptor, e.g. a pty
+	void close();
+	// Responses come in the order of requests; stops at the first one the device didn't answer
+	std::vector<Response> run(const std::vector<Request>& requests);
+	Response call(const std::string& line, const std::string& payload = "") { return run({ { line, payload } }).front(); }
+
+private:
+	struct InFlight {
+		uint32_t id;
+		size_t size;
+	};
+	int _fd = -1;
+	uint32_t _nextId = 1;
+	std::string _rx; // received but not yet parsed
+	std::deque<InFlight> _inFlight;
+	size_t _inFlightBytes = 0;
+
+	bool send(const Request& request);
+	bool receive(Response& res);
+	bool readFrameHeader(uint32_t& id, char& type, uint32_t& value);
+	bool fill(size_t size);
+};
+
+#endif // LFSECLIENT_H__
@@ -0,0 +1,126 @@
+// Host-side counterpart of the explorer's sig/patch commands.
+// Build: g++ -std=c++11 -O2 -I../../src lfsedelta.cpp -o lfsedelta
+//
+//   lfsedelta sig <file> <blocksize>           print signature the same way sig does
+//   lfsedelta delta <sigfile> <newfile> <out>  write delta turning the signed file into newfile
+//   lfsedelta patch <oldfile> <delta> <out>    apply delta locally, the same way patch does
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "lfsedelta.h"
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return false;
+	uint8_t buffer[4096];
+	size_t nBytes;
+	while ((nBytes = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		data.insert(data.end(), buffer, buffer + nBytes);
+	fclose(f);
+	return true;
+}
+
+static int cmdSig(const char* path, uint32_t blockSize) {
+	std::vector<uint8_t> data;
+	if (!readFile(path, data) || !blockSize)
+		return 1;
+	printf("sig %u %u\r\n", blockSize, (unsigned int)data.size());
+	for (size_t offset = 0; offset < data.size(); offset += blockSize) {
+		size_t length = std::min((size_t)blockSize, data.size() - offset);
+		LFSERollingChecksum weak;
+		weak.update(&data[offset], length);
+		uint64_t strong = lfseFnv64(&data[offset], length);
+		printf("%08x %08x%08x\r\n", weak.value(), (unsigned int)(strong >> 32), (unsigned int)strong);
+	}
+	return 0;
+}
+
+static int cmdDelta(const char* sigPath, const char* newPath, const char* outPath) {
+	std::vector<uint8_t> data;
+	FILE* fSig = fopen(sigPath, "r");
+	if (!fSig || !readFile(newPath, data)) {
+		if (fSig)
+			fclose(fSig);
+		return 1;
+	}
+	std::string out;
+	size_t nCopied;
+	bool isSig = makeDelta(fSig, data, out, nCopied);
+	fclose(fSig);
+	if (!isSig) {
+		fprintf(stderr, "%s is not a signature\n", sigPath);
+		return 1;
+	}
+
+	FILE* fOut = fopen(outPath, "wb");
+	if (!fOut)
+		return 1;
+	fwrite(out.data(), 1, out.size(), fOut);
+	fclose(fOut);
+	fprintf(stderr, "%zu blocks copied, delta is %zu bytes for %zu bytes file\n", nCopied, out.size(), data.size());
+	return 0;
+}
+
+static uint64_t getLE(const std::vector<uint8_t>& data, size_t& pos, int nBytes) {
+	uint64_t value = 0;
+	for (int i = 0; i < nBytes && pos < data.size(); ++i)
+		value |= (uint64_t)data[pos++] << (8 * i);
+	return value;
+}
+
+static int cmdPatch(const char* oldPath, const char* deltaPath, const char* outPath) {
+	std::vector<uint8_t> old, delta, res;
+	readFile(oldPath, old);
+	if (!readFile(deltaPath, delta) || delta.size() < 6 || memcmp(delta.data(), LFSE_DELTA_MAGIC, 4)) {
+		fprintf(stderr, "%s is not a delta\n", deltaPath);
+		return 1;
+	}
+	size_t pos = 4;
+	size_t blockSize = getLE(delta, pos, 2);
+	while (pos < delta.size()) {
+		char op = delta[pos++];
+		if (op == LFSE_DELTA_OP_COPY) {
+			size_t from = getLE(delta, pos, 4) * blockSize;
+			if (from >= old.size())
+				return 1;
+			res.insert(res.end(), old.begin() + from, old.begin() + std::min(from + blockSize, old.size()));
+		} else if (op == LFSE_DELTA_OP_LITERAL) {
+			size_t length = getLE(delta, pos, 2);
+			if (pos + length > delta.size())
+				return 1;
+			res.insert(res.end(), delta.begin() + pos, delta.begin() + pos + length);
+			pos += length;
+		} else if (op == LFSE_DELTA_OP_END) {
+			if (getLE(delta, pos, 8) != lfseFnv64(res.data(), res.size())) {
+				fprintf(stderr, "checksum mismatch\n");
+				return 1;
+			}
+			FILE* fOut = fopen(outPath, "wb");
+			if (!fOut)
+				return 1;
+			fwrite(res.data(), 1, res.size(), fOut);
+			fclose(fOut);
+			return 0;
+		} else {
+			break;
+		}
+	}
+	fprintf(stderr, "malformed delta\n");
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 4 && !strcmp(argv[1], "sig"))
+		return cmdSig(argv[2], strtoul(argv[3], nullptr, 10));
+	if (argc == 5 && !strcmp(argv[1], "delta"))
+		return cmdDelta(argv[2], argv[3], argv[4]);
+	if (argc == 5 && !strcmp(argv[1], "patch"))
+		return cmdPatch(argv[2], argv[3], argv[4]);
+	fprintf(stderr, "usage: %s sig <file> <blocksize> | delta <sigfile> <newfile> <out> | patch <oldfile> <delta> <out>\n", argv[0]);
+	return 2;
+}
@@ -0,0 +1,86 @@
+// Delta encoding of lfsedelta, shared with the host tests (extras/lfsehost).
+// The stream format is described in lfsehash.h
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "lfsehash.h"
+
+struct BlockSig {
+	uint32_t idx;
+	uint64_t strong;
+};
+
+inline void putLE(std::string& out, uint64_t value, int nBytes) {
+	for (int i = 0; i < nBytes; ++i)
+		out += (char)(value >> (8 * i));
+}
+
+inline void flushLiteral(std::string& out, const std::vector<uint8_t>& data, size_t from, size_t to) {
+	while (from < to) {
+		size_t length = std::min(to - from, (size_t)0xffff);
+		out += LFSE_DELTA_OP_LITERAL;
+		putLE(out, length, 2);
+		out.append(reinterpret_cast<const char*>(&data[from]), length);
+		from += length;
+	}
+}
+
+// Writes into out the delta that turns the file signed in fSig (output of sig) into data.
+// Returns false if fSig isn't a signature
+inline bool makeDelta(FILE* fSig, const std::vector<uint8_t>& data, std::string& out, size_t& nCopied) {
+	unsigned int blockSize, oldSize;
+	if (fscanf(fSig, "sig %u %u", &blockSize, &oldSize) != 2 || !blockSize)
+		return false;
+	// only full blocks can be matched, the short last one is sent as literal
+	std::unordered_map<uint32_t, std::vector<BlockSig>> blocks;
+	unsigned int weak, strongHigh, strongLow;
+	for (uint32_t idx = 0; fscanf(fSig, "%x %8x%8x", &weak, &strongHigh, &strongLow) == 3; ++idx) {
+		if ((uint64_t)(idx + 1) * blockSize <= oldSize)
+			blocks[weak].push_back({ idx, (uint64_t)strongHigh << 32 | strongLow });
+	}
+
+	out = LFSE_DELTA_MAGIC;
+	putLE(out, blockSize, 2);
+	size_t literalFrom = 0, offset = 0;
+	nCopied = 0;
+	LFSERollingChecksum rolling;
+	bool windowValid = false;
+	while (offset + blockSize <= data.size()) {
+		if (!windowValid) {
+			rolling.reset();
+			rolling.update(&data[offset], blockSize);
+			windowValid = true;
+		}
+		auto it = blocks.find(rolling.value());
+		if (it != blocks.end()) {
+			uint64_t strong = lfseFnv64(&data[offset], blockSize);
+			const BlockSig* match = nullptr;
+			for (const BlockSig& sig : it->second) {
+				if (sig.strong == strong) {
+					match = &sig;
+					break;
+				}
+			}
+			if (match) {
+				flushLiteral(out, data, literalFrom, offset);
+				out += LFSE_DELTA_OP_COPY;
+				putLE(out, match->idx, 4);
+				offset += blockSize;
+				literalFrom = offset;
+				windowValid = false;
+				++nCopied;
+				continue;
+			}
+		}
+		if (offset + blockSize < data.size())
+			rolling.roll(data[offset], data[offset + blockSize]);
+		++offset;
+	}
+	flushLiteral(out, data, literalFrom, data.size());
+	out += LFSE_DELTA_OP_END;
+	putLE(out, lfseFnv64(data.data(), data.size()), 8);
+	return true;
+}
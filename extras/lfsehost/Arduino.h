@@ -0,0 +1,67 @@
+// Host stand-in for the ESP8266 Arduino core, just enough of it to run the explorer on a PC.
+// Serial is an in-memory stream: tests put what the device would receive into input
+// and find what it sent in output, or connect it to a descriptor (e.g. a pty) with fd
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "WString.h"
+#include "Stream.h"
+
+unsigned long millis();
+unsigned long micros();
+inline void yield() { }
+inline void delay(unsigned long) { }
+inline bool isAlphaNumeric(int c) { return isalnum(c); }
+inline bool isAlpha(int c) { return isalpha(c); }
+inline bool isDigit(int c) { return isdigit(c); }
+inline bool isSpace(int c) { return isspace(c); }
+inline bool isHexadecimalDigit(int c) { return isxdigit(c); }
+inline bool isPrintable(int c) { return isprint(c); }
+template <typename A, typename B>
+auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+template <typename A, typename B>
+auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+#define _min(a, b) ((a) < (b) ? (a) : (b))
+#define _max(a, b) ((a) > (b) ? (a) : (b))
+
+class HardwareSerial : public Stream {
+public:
+	std::string input;
+	size_t inputPos = 0;
+	std::string output;
+	int fd = -1; // if set, input is read from it as it comes and output goes straight to it
+
+	void feed(const std::string& data) { input.erase(0, inputPos); inputPos = 0; input += data; }
+	int available() override { pull(); return input.size() - inputPos; }
+	int read() override { pull(); return inputPos < input.size() ? (uint8_t)input[inputPos++] : -1; }
+	int peek() override { pull(); return inputPos < input.size() ? (uint8_t)input[inputPos] : -1; }
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+	int availableForWrite() override { return 128; }
+private:
+	void pull(); // takes what came to fd without waiting
+};
+extern HardwareSerial Serial;
+
+// new and delete use a heap of the size and kind of the ESP8266 one (see host.cpp),
+// so that what it reports has the same meaning as on the device
+#define HOST_HEAP_LENGTH (40 * 1024)
+struct HeapCounters {
+	uint32_t allocations = 0;
+	uint32_t shimAllocations = 0; // of them, made by the FS stand-in itself (file objects, host paths), littlefs allocates differently
+	uint32_t overflows = 0; // allocations that did not fit and were served by the host's malloc instead
+	uint32_t lowestFree = HOST_HEAP_LENGTH; // bytes, lowest free heap seen so far like umm_free_heap_size_lw()
+};
+extern HeapCounters hostHeap;
+struct EspClass {
+	uint32_t getFreeHeap();
+	uint32_t getMaxFreeBlockSize();
+	uint8_t getHeapFragmentation();
+};
+extern EspClass ESP;
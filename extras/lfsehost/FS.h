@@ -0,0 +1,211 @@
+// Host stand-in for the ESP8266 FS API, keeping files in a directory of the host filesystem.
+// Timing and failure behaviour of littlefs are not emulated, only what the explorer sees through the API.
+// What reaches the API is also laid out on a RAM flash the way littlefs lays it out (HostFlash),
+// so that the explorer's own wear estimate can be checked against the calls that flash gets
+#pragma once
+#include <ctime>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "Arduino.h"
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FSInfo {
+	size_t totalBytes;
+	size_t usedBytes;
+	size_t blockSize;
+	size_t pageSize;
+	size_t maxOpenFiles;
+	size_t maxPathLength;
+};
+
+// Calls the flash got so far, counted by the callbacks of HostFlash
+struct FlashCounters {
+	uint32_t progCalls = 0;
+	uint64_t programBytes = 0; // to blocks of file data, skip-list pointers and padding included
+	uint64_t metaProgramBytes = 0; // to metadata pairs, commits and compactions
+	uint64_t inlineBytes = 0; // of metaProgramBytes, file content inlined into commits
+	uint32_t eraseOps = 0;
+	uint32_t compactions = 0; // of eraseOps, metadata blocks erased because the other one of their pair filled up
+	uint32_t metaCommits = 0; // syncs, littlefs syncs at the end of every metadata commit
+	uint32_t faults = 0; // calls that broke the rules of flash, blocks that ran out, content read back different
+
+	uint64_t programmed() const { return programBytes + metaProgramBytes; }
+};
+#define HOST_INLINE_FILE_MAX_SIZE 64 // littlefs cache size on ESP8266
+
+// The bookkeeping of the flash lives in the host's malloc, the device doesn't have it
+template<typename T> struct HostAllocator {
+	typedef T value_type;
+	HostAllocator() { }
+	template<typename U> HostAllocator(const HostAllocator<U>&) { }
+	T* allocate(size_t n) { return static_cast<T*>(malloc(n * sizeof(T))); }
+	void deallocate(T* ptr, size_t) { free(ptr); }
+	bool operator==(const HostAllocator&) const { return true; }
+	bool operator!=(const HostAllocator&) const { return false; }
+};
+typedef std::basic_string<char, std::char_traits<char>, HostAllocator<char>> HostString;
+
+// littlefs takes its flash through these (lfs.h), the stand-in lays files out on HostFlash through them too
+typedef uint32_t lfs_block_t;
+typedef uint32_t lfs_off_t;
+typedef uint32_t lfs_size_t;
+struct lfs_config {
+	void* context;
+	int (*read)(const lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
+	int (*prog)(const lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size);
+	int (*erase)(const lfs_config* c, lfs_block_t block);
+	int (*sync)(const lfs_config* c);
+	lfs_size_t read_size;
+	lfs_size_t prog_size;
+	lfs_size_t block_size;
+	lfs_size_t block_count;
+	int32_t block_cycles;
+	lfs_size_t cache_size;
+	lfs_size_t lookahead_size;
+};
+
+// RAM flash configured like LittleFS of the ESP8266 core. Its callbacks count the calls into FlashCounters
+// and hold them to the rules of NOR flash: reads and progs are aligned, a prog_size unit is programmed
+// once between erases of its block. Breaking a rule counts as a fault, so that tests see it
+struct HostFlash {
+	lfs_config cfg;
+	std::vector<uint8_t, HostAllocator<uint8_t>> data;
+	std::vector<bool, HostAllocator<bool>> programmed; // per prog_size unit, since the last erase
+	std::vector<bool, HostAllocator<bool>> meta; // blocks of metadata pairs, for the counters only
+	FlashCounters* counters = nullptr;
+
+	void begin(FlashCounters* counters, lfs_size_t blockSize, lfs_size_t blockCount);
+};
+
+// Where a file is on flash as of its last commit
+struct HostLayout {
+	std::vector<lfs_block_t, HostAllocator<lfs_block_t>> blocks; // CTZ skip-list, none for an inline file
+	uint32_t size = 0;
+	lfs_block_t inlineBlock = 0; // where the content of an inline file was programmed last
+	lfs_off_t inlineOff = 0;
+};
+// Metadata pair of a directory, commits are appended to blocks[0] and compacted into blocks[1] when it fills up
+struct HostDirPair {
+	lfs_block_t blocks[2];
+	lfs_off_t off = 0;
+	uint32_t rev = 0;
+};
+typedef std::map<HostString, HostLayout, std::less<HostString>, HostAllocator<std::pair<const HostString, HostLayout>>> HostLayouts;
+typedef std::map<HostString, HostDirPair, std::less<HostString>, HostAllocator<std::pair<const HostString, HostDirPair>>> HostDirPairs;
+
+struct FileImpl {
+	FILE* fp = nullptr; // null for directories
+	std::string path;
+	bool append = false;
+	bool dirty = false;
+	uint32_t firstWrite = UINT32_MAX;
+	~FileImpl();
+	void commit();
+};
+
+class File : public Stream {
+public:
+	File() { }
+	explicit File(std::shared_ptr<FileImpl> impl) : _impl(impl) { }
+
+	size_t write(uint8_t c) override { return write(&c, 1); }
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+	int available() override { return isFile() ? (int)(size() - position()) : 0; }
+	int read() override { return isFile() ? fgetc(_impl->fp) : -1; }
+	int peek() override;
+	int read(uint8_t* buffer, size_t size) override { return isFile() ? fread(buffer, 1, size, _impl->fp) : 0; }
+	size_t readBytes(char* buffer, size_t size) override { return read(reinterpret_cast<uint8_t*>(buffer), size); }
+	void flush() override; // commits like lfs_file_sync
+	bool seek(uint32_t pos, SeekMode mode);
+	bool seek(uint32_t pos) { return seek(pos, SeekSet); }
+	size_t position() const { return isFile() ? ftell(_impl->fp) : 0; }
+	size_t size() const;
+	bool truncate(uint32_t size);
+	void close() { _impl.reset(); }
+	explicit operator bool() const { return (bool)_impl; }
+	const char* name() const;
+	const char* fullName() const { return _impl ? _impl->path.c_str() : ""; }
+	bool isFile() const { return _impl && _impl->fp; }
+	bool isDirectory() const { return _impl && !_impl->fp; }
+	time_t getLastWrite();
+	time_t getCreationTime() { return getLastWrite(); }
+private:
+	std::shared_ptr<FileImpl> _impl;
+};
+
+class Dir {
+public:
+	Dir() { }
+	Dir(const std::string& path, std::vector<std::string>&& names) : _path(path), _names(names) { }
+
+	bool next() { return ++_idx < (int)_names.size(); }
+	bool rewind() { _idx = -1; return true; }
+	String fileName() const { return String(_names[_idx].c_str()); }
+	size_t fileSize() const;
+	time_t fileTime() const;
+	time_t fileCreationTime() const { return fileTime(); }
+	bool isFile() const;
+	bool isDirectory() const;
+	File openFile(const char* mode) const;
+private:
+	std::string _path;
+	std::vector<std::string> _names; // sorted like littlefs keeps them
+	int _idx = -1;
+
+	bool stat(struct stat& st) const;
+	std::string entryPath() const;
+};
+
+class FS {
+public:
+	void setRoot(const std::string& hostPath) { _root = hostPath; } // host directory the filesystem lives in
+	std::string hostPath(const char* path) const; // where path of the filesystem is on the host
+	FlashCounters flash;
+	HostFlash bd;
+	uint32_t opens = 0; // files successfully opened, for benchmarks
+	uint32_t blockSize() const { return 8192; }
+	~FS() { _mounted = false; } // files closed by static destructors after this one aren't committed
+
+	bool begin();
+	bool format();
+	bool info(FSInfo& info);
+	File open(const char* path, const char* mode);
+	File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+	bool exists(const char* path);
+	bool exists(const String& path) { return exists(path.c_str()); }
+	Dir openDir(const char* path);
+	Dir openDir(const String& path) { return openDir(path.c_str()); }
+	bool remove(const char* path);
+	bool remove(const String& path) { return remove(path.c_str()); }
+	bool rename(const char* pathFrom, const char* pathTo);
+	bool rename(const String& pathFrom, const String& pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+	bool mkdir(const char* path);
+	bool mkdir(const String& path) { return mkdir(path.c_str()); }
+	bool rmdir(const char* path);
+	bool rmdir(const String& path) { return rmdir(path.c_str()); }
+private:
+	std::string _root = "lfsroot";
+	bool _mounted = false;
+	HostLayouts _files;
+	HostDirPairs _dirs;
+	std::vector<bool, HostAllocator<bool>> _usedBlocks;
+	lfs_block_t _nextBlock = 0; // where the allocator looks for a free block next, littlefs goes round the flash too
+
+	friend struct FileImpl;
+	void formatFlash();
+	bool allocBlock(lfs_block_t& block, bool meta);
+	void freeBlock(lfs_block_t block) { _usedBlocks[block] = false; }
+	void progBlock(lfs_block_t block, lfs_off_t off, const HostString& data);
+	HostString readBlock(lfs_block_t block, lfs_off_t off, lfs_size_t size);
+	void createFile(const std::string& path);
+	void commitFile(const std::string& path, const HostString& content, uint32_t firstWrite);
+	void commitDir(const HostString& path, HostString attrs, const HostString& inlinePath = HostString(), lfs_off_t inlineOff = 0);
+	void compactDir(const HostString& path, HostDirPair& pair, const HostString& inlinePath, const HostString& inlineContent);
+	bool checkContent(const HostString& path, const HostString& content);
+};
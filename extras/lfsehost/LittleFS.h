@@ -0,0 +1,5 @@
+// Host stand-in for the ESP8266 LittleFS, see FS.h
+#pragma once
+#include "FS.h"
+
+extern FS LittleFS;
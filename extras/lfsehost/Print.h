@@ -0,0 +1,58 @@
+// Host stand-in for the Arduino Print
+#pragma once
+#include <cstdarg>
+#include <cstdint>
+#include "WString.h"
+
+class Print;
+class Printable {
+public:
+	virtual ~Printable() { }
+	virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+	virtual ~Print() { }
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size) {
+		size_t n = 0;
+		while (size--)
+			n += write(*buffer++);
+		return n;
+	}
+	size_t write(const char* s) { return s ? write(reinterpret_cast<const uint8_t*>(s), strlen(s)) : 0; }
+	size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+	virtual int availableForWrite() { return 0; }
+	virtual void flush() { }
+
+	size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char buffer[512];
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		return n < 0 ? 0 : write(buffer, std::min<size_t>(n, sizeof(buffer) - 1));
+	}
+	size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+	size_t print(const String& s) { return write(s.c_str(), s.length()); }
+	size_t print(const char* s) { return write(s); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char v, int base = 10) { return print((unsigned long)v, base); }
+	size_t print(int v, int base = 10) { return print((long)v, base); }
+	size_t print(unsigned int v, int base = 10) { return print((unsigned long)v, base); }
+	size_t print(long v, int base = 10) { return printNumber(base == 16 ? "%lx" : "%ld", v); }
+	size_t print(unsigned long v, int base = 10) { return printNumber(base == 16 ? "%lx" : "%lu", v); }
+	size_t print(long long v, int base = 10) { return printNumber(base == 16 ? "%llx" : "%lld", v); }
+	size_t print(unsigned long long v, int base = 10) { return printNumber(base == 16 ? "%llx" : "%llu", v); }
+	size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+	size_t print(const Printable& x) { return x.printTo(*this); }
+	size_t println() { return write("\r\n"); }
+	template <typename T>
+	size_t println(const T& v) { return print(v) + println(); }
+	template <typename T>
+	size_t println(const T& v, int base) { return print(v, base) + println(); }
+private:
+	template <typename T>
+	size_t printNumber(const char* format, T v) { char b[24]; snprintf(b, sizeof(b), format, v); return write(b); }
+};
@@ -0,0 +1,52 @@
+// Host stand-in for the Arduino Stream, reads time out after getTimeout() ms the same way
+#pragma once
+#include "Print.h"
+
+unsigned long millis();
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual int read(uint8_t* buffer, size_t size) {
+		size_t i = 0;
+		for (int c; i < size && (c = read()) >= 0; ++i)
+			buffer[i] = c;
+		return i;
+	}
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+	unsigned long getTimeout() const { return _timeout; }
+	virtual size_t readBytes(char* buffer, size_t size) {
+		size_t i = 0;
+		for (int c; i < size && (c = timedRead()) >= 0; ++i)
+			buffer[i] = c;
+		return i;
+	}
+	size_t readBytes(uint8_t* buffer, size_t size) { return readBytes(reinterpret_cast<char*>(buffer), size); }
+	size_t readBytesUntil(char terminator, char* buffer, size_t size) {
+		size_t i = 0;
+		for (int c; i < size && (c = timedRead()) >= 0 && c != terminator; ++i)
+			buffer[i] = c;
+		return i;
+	}
+	String readStringUntil(char terminator) {
+		String res;
+		for (int c; (c = timedRead()) >= 0 && c != terminator; )
+			res += (char)c;
+		return res;
+	}
+	String readString() { return readStringUntil('\0'); }
+protected:
+	unsigned long _timeout = 1000;
+
+	int timedRead() {
+		unsigned long start = millis();
+		do {
+			int c = read();
+			if (c >= 0)
+				return c;
+		} while (millis() - start < _timeout);
+		return -1;
+	}
+};
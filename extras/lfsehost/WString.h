@@ -0,0 +1,101 @@
+// Host stand-in for the Arduino String, just enough of it for the explorer
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+
+class __FlashStringHelper;
+#define F(x) (reinterpret_cast<const __FlashStringHelper*>(x))
+#define PSTR(x) (x)
+
+class String {
+public:
+	std::string s;
+
+	String() { }
+	String(const char* c) : s(c ? c : "") { }
+	String(const char* c, size_t n) : s(c, n) { }
+	String(const __FlashStringHelper* c) : s(reinterpret_cast<const char*>(c)) { }
+	String(const std::string& x) : s(x) { }
+	explicit String(char c) : s(1, c) { }
+	explicit String(int v, unsigned char base = 10) { format(base == 16 ? "%x" : "%d", v); }
+	explicit String(unsigned int v, unsigned char base = 10) { format(base == 16 ? "%x" : "%u", v); }
+	explicit String(long v) : s(std::to_string(v)) { }
+	explicit String(unsigned long v) : s(std::to_string(v)) { }
+	explicit String(long long v) : s(std::to_string(v)) { }
+	explicit String(unsigned long long v) : s(std::to_string(v)) { }
+	explicit String(double v, unsigned char decimals = 2) { format("%.*f", decimals, v); }
+
+	size_t length() const { return s.size(); }
+	bool isEmpty() const { return s.empty(); }
+	void clear() { s.clear(); }
+	bool reserve(size_t n) { s.reserve(n); return true; }
+	const char* c_str() const { return s.c_str(); }
+	char* begin() { return &s[0]; }
+	char* end() { return &s[0] + s.size(); }
+	const char* begin() const { return s.c_str(); }
+	const char* end() const { return s.c_str() + s.size(); }
+	char operator[](size_t i) const { return i < s.size() ? s[i] : 0; }
+	char& operator[](size_t i) { return s[i]; }
+	char charAt(size_t i) const { return (*this)[i]; }
+	void setCharAt(size_t i, char c) { if (i < s.size()) s[i] = c; }
+
+	String& operator+=(const String& o) { s += o.s; return *this; }
+	String& operator+=(const char* o) { s += o; return *this; }
+	String& operator+=(const __FlashStringHelper* o) { s += reinterpret_cast<const char*>(o); return *this; }
+	String& operator+=(char c) { s += c; return *this; }
+	String& operator+=(int v) { s += std::to_string(v); return *this; }
+	String& operator+=(unsigned int v) { s += std::to_string(v); return *this; }
+	String& operator+=(long v) { s += std::to_string(v); return *this; }
+	String& operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+	bool concat(const char* c, size_t n) { s.append(c, n); return true; }
+	bool concat(const String& o) { s += o.s; return true; }
+	bool concat(char c) { s += c; return true; }
+
+	String substring(size_t from) const { return from >= s.size() ? String() : String(s.substr(from)); }
+	String substring(size_t from, size_t to) const {
+		if (from > to)
+			std::swap(from, to);
+		return from >= s.size() ? String() : String(s.substr(from, to - from));
+	}
+	int indexOf(char c, size_t from = 0) const { return position(s.find(c, from)); }
+	int indexOf(const String& o, size_t from = 0) const { return position(s.find(o.s, from)); }
+	int lastIndexOf(char c) const { return position(s.rfind(c)); }
+	long toInt() const { return atol(s.c_str()); }
+	float toFloat() const { return atof(s.c_str()); }
+	bool equals(const String& o) const { return s == o.s; }
+	bool equals(const char* o) const { return s == o; }
+	bool equalsIgnoreCase(const String& o) const { return !strcasecmp(s.c_str(), o.c_str()); }
+	bool startsWith(const String& o) const { return !s.compare(0, o.s.size(), o.s); }
+	bool endsWith(const String& o) const { return s.size() >= o.s.size() && !s.compare(s.size() - o.s.size(), o.s.size(), o.s); }
+	void toLowerCase() { for (char& c : s) c = tolower(c); }
+	void toUpperCase() { for (char& c : s) c = toupper(c); }
+	void trim() {
+		while (!s.empty() && isspace(s.back()))
+			s.pop_back();
+		size_t i = 0;
+		while (i < s.size() && isspace(s[i]))
+			++i;
+		s.erase(0, i);
+	}
+	void remove(size_t i, size_t n = (size_t)-1) { if (i < s.size()) s.erase(i, n); }
+
+	bool operator==(const String& o) const { return s == o.s; }
+	bool operator==(const char* o) const { return s == o; }
+	bool operator!=(const String& o) const { return s != o.s; }
+	bool operator<(const String& o) const { return s < o.s; }
+	explicit operator bool() const { return true; }
+private:
+	template <typename T>
+	void format(const char* fmt, T v) { char b[40]; snprintf(b, sizeof(b), fmt, v); s = b; }
+	void format(const char* fmt, int decimals, double v) { char b[64]; snprintf(b, sizeof(b), fmt, decimals, v); s = b; }
+	static int position(size_t p) { return p == std::string::npos ? -1 : (int)p; }
+};
+inline String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+inline String operator+(const String& a, const char* b) { return String(a.s + b); }
+inline String operator+(const char* a, const String& b) { return String(a + b.s); }
+inline String operator+(const String& a, char b) { return String(a.s + b); }
@@ -0,0 +1,825 @@
+// Host implementation of the stand-ins for the ESP8266 core and LittleFS
+
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "LittleFS.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+void HardwareSerial::pull() {
+	if (fd < 0 || inputPos < input.size())
+		return;
+	char buffer[256];
+	pollfd pfd = { fd, POLLIN, 0 };
+	if (poll(&pfd, 1, 0) > 0) {
+		ssize_t nBytes = ::read(fd, buffer, sizeof(buffer));
+		if (nBytes > 0)
+			feed(std::string(buffer, nBytes));
+	}
+}
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+	if (fd < 0) {
+		output.append(reinterpret_cast<const char*>(buffer), size);
+		return size;
+	}
+	for (size_t pos = 0; pos < size;) {
+		ssize_t nBytes = ::write(fd, buffer + pos, size - pos);
+		if (nBytes <= 0)
+			return pos;
+		pos += nBytes;
+	}
+	return size;
+}
+FS LittleFS;
+HeapCounters hostHeap;
+
+// The heap is best fit over 16-byte units like umm_malloc of the ESP8266 core (which uses 8-byte ones).
+// A block is a run of units starting with a header; free blocks are merged with free neighbours
+// and kept in a list linked through their first bytes
+struct HeapHeader {
+	uint16_t units; // of the block, header included
+	uint16_t prevUnits; // of the block before, 0 for the first one
+	uint16_t used;
+	uint16_t reserved;
+};
+struct HeapFreeLinks {
+	uint16_t prev;
+	uint16_t next;
+};
+#define HOST_HEAP_UNIT 16
+#define HOST_HEAP_NONE 0xFFFF
+static const uint32_t _heapUnits = HOST_HEAP_LENGTH / HOST_HEAP_UNIT;
+// headers are 8 bytes before a unit boundary so that the memory handed out is 16-byte aligned like malloc's
+alignas(HOST_HEAP_UNIT) static uint8_t _heap[HOST_HEAP_LENGTH + HOST_HEAP_UNIT];
+static uint16_t _heapFreeHead;
+static uint32_t _heapFreeUnits;
+
+static HeapHeader* _heapBlock(uint32_t idx) {
+	return reinterpret_cast<HeapHeader*>(_heap + (idx + 1) * HOST_HEAP_UNIT - sizeof(HeapHeader));
+}
+static HeapFreeLinks* _heapLinks(uint32_t idx) {
+	return reinterpret_cast<HeapFreeLinks*>(_heapBlock(idx) + 1);
+}
+static void _heapPushFree(uint16_t idx) {
+	_heapBlock(idx)->used = 0;
+	*_heapLinks(idx) = { HOST_HEAP_NONE, _heapFreeHead };
+	if (_heapFreeHead != HOST_HEAP_NONE)
+		_heapLinks(_heapFreeHead)->prev = idx;
+	_heapFreeHead = idx;
+}
+static void _heapUnlinkFree(uint16_t idx) {
+	HeapFreeLinks links = *_heapLinks(idx);
+	if (links.prev != HOST_HEAP_NONE)
+		_heapLinks(links.prev)->next = links.next;
+	else
+		_heapFreeHead = links.next;
+	if (links.next != HOST_HEAP_NONE)
+		_heapLinks(links.next)->prev = links.prev;
+	_heapBlock(idx)->used = 1;
+}
+// new runs before main (static initializers), so the heap is set up on first use
+static void _heapInit() {
+	if (_heapBlock(0)->units)
+		return;
+	_heapBlock(0)->units = _heapUnits;
+	_heapFreeUnits = _heapUnits;
+	_heapFreeHead = HOST_HEAP_NONE;
+	_heapPushFree(0);
+}
+static void* _heapAlloc(size_t size) {
+	_heapInit();
+	size_t units = (size + sizeof(HeapHeader) + HOST_HEAP_UNIT - 1) / HOST_HEAP_UNIT;
+	uint16_t best = HOST_HEAP_NONE;
+	for (uint16_t idx = _heapFreeHead; idx != HOST_HEAP_NONE; idx = _heapLinks(idx)->next) {
+		uint16_t blockUnits = _heapBlock(idx)->units;
+		if (blockUnits >= units && (best == HOST_HEAP_NONE || blockUnits < _heapBlock(best)->units))
+			best = idx;
+	}
+	if (best == HOST_HEAP_NONE)
+		return nullptr;
+	_heapUnlinkFree(best);
+	HeapHeader* block = _heapBlock(best);
+	if (block->units > units) {
+		uint16_t restIdx = best + units;
+		HeapHeader* rest = _heapBlock(restIdx);
+		rest->units = block->units - units;
+		rest->prevUnits = units;
+		if (restIdx + rest->units < _heapUnits)
+			_heapBlock(restIdx + rest->units)->prevUnits = rest->units;
+		block->units = units;
+		_heapPushFree(restIdx);
+	}
+	_heapFreeUnits -= block->units;
+	hostHeap.lowestFree = std::min(hostHeap.lowestFree, _heapFreeUnits * HOST_HEAP_UNIT);
+	return block + 1;
+}
+static bool _heapOwns(const void* ptr) {
+	return ptr >= _heap && ptr < _heap + sizeof(_heap);
+}
+static void _heapFree(void* ptr) {
+	uint16_t idx = (static_cast<uint8_t*>(ptr) - _heap) / HOST_HEAP_UNIT - 1;
+	HeapHeader* block = _heapBlock(idx);
+	_heapFreeUnits += block->units;
+	uint16_t next = idx + block->units;
+	if (next < _heapUnits && !_heapBlock(next)->used) {
+		_heapUnlinkFree(next);
+		block->units += _heapBlock(next)->units;
+	}
+	if (block->prevUnits && !_heapBlock(idx - block->prevUnits)->used) {
+		idx -= block->prevUnits;
+		_heapUnlinkFree(idx);
+		_heapBlock(idx)->units += block->units;
+		block = _heapBlock(idx);
+	}
+	if (idx + block->units < _heapUnits)
+		_heapBlock(idx + block->units)->prevUnits = block->units;
+	_heapPushFree(idx);
+}
+// Allocations made while the FS stand-in runs are its own, see HeapCounters::shimAllocations
+static uint32_t _shimDepth;
+struct ShimScope {
+	ShimScope() { ++_shimDepth; }
+	~ShimScope() { --_shimDepth; }
+};
+void* operator new(size_t size) {
+	++hostHeap.allocations;
+	hostHeap.shimAllocations += _shimDepth > 0;
+	if (void* ptr = _heapAlloc(size))
+		return ptr;
+	++hostHeap.overflows;
+	if (void* ptr = malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept {
+	if (_heapOwns(ptr))
+		_heapFree(ptr);
+	else
+		free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+// free units, the largest free block and the sum of squares of free block sizes, which fragmentation is computed from
+struct HeapInfo {
+	uint32_t freeUnits = 0;
+	uint32_t maxFreeUnits = 0;
+	uint64_t freeUnitsSquared = 0;
+};
+static HeapInfo _heapInfo() {
+	HeapInfo info;
+	_heapInit();
+	for (uint16_t idx = _heapFreeHead; idx != HOST_HEAP_NONE; idx = _heapLinks(idx)->next) {
+		uint32_t units = _heapBlock(idx)->units;
+		info.freeUnits += units;
+		info.maxFreeUnits = std::max(info.maxFreeUnits, units);
+		info.freeUnitsSquared += (uint64_t)units * units;
+	}
+	return info;
+}
+uint32_t EspClass::getFreeHeap() {
+	return _heapInfo().freeUnits * HOST_HEAP_UNIT;
+}
+uint32_t EspClass::getMaxFreeBlockSize() {
+	uint32_t units = _heapInfo().maxFreeUnits;
+	return units ? units * HOST_HEAP_UNIT - sizeof(HeapHeader) : 0;
+}
+// as the ESP8266 core computes it: 0 when all free memory is one block, towards 100 when it is many small ones
+uint8_t EspClass::getHeapFragmentation() {
+	HeapInfo info = _heapInfo();
+	return info.freeUnits ? 100 - (uint32_t)sqrt((double)info.freeUnitsSquared) * 100 / info.freeUnits : 0;
+}
+
+static const std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+unsigned long millis() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+unsigned long micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+// "/a/b" without trailing or repeated separators
+static std::string _normalize(const char* path) {
+	std::string res = "/";
+	for (const char* c = path; *c; ++c) {
+		if (*c != '/' || res.back() != '/')
+			res += *c;
+	}
+	if (res.size() > 1 && res.back() == '/')
+		res.pop_back();
+	return res;
+}
+
+// Block i > 0 of a CTZ skip-list starts with ctz(i) + 1 pointers to the previous blocks
+static uint32_t _ctzCapacity(uint32_t blockIdx) {
+	return LittleFS.blockSize() - (blockIdx ? 4 * (__builtin_ctz(blockIdx) + 1) : 0);
+}
+FileImpl::~FileImpl() {
+	if (!fp)
+		return;
+	commit();
+	fclose(fp);
+}
+void FileImpl::commit() {
+	if (!dirty || !LittleFS._mounted)
+		return;
+	ShimScope scope;
+	fflush(fp);
+	struct stat st;
+	HostString content(fstat(fileno(fp), &st) ? 0 : st.st_size, '\0');
+	int fd = ::open(LittleFS.hostPath(path.c_str()).c_str(), O_RDONLY); // fp may be write only
+	if (fd < 0 || pread(fd, &content[0], content.size(), 0) != (ssize_t)content.size())
+		++LittleFS.flash.faults;
+	if (fd >= 0)
+		::close(fd);
+	LittleFS.commitFile(path, content, firstWrite);
+	firstWrite = UINT32_MAX;
+	dirty = false;
+}
+
+static int _flashRead(const lfs_config* c, lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size) {
+	HostFlash& bd = *static_cast<HostFlash*>(c->context);
+	if (block >= c->block_count || off % c->read_size || size % c->read_size || off + size > c->block_size) {
+		++bd.counters->faults;
+		return -22; // LFS_ERR_INVAL
+	}
+	memcpy(buffer, &bd.data[block * c->block_size + off], size);
+	return 0;
+}
+static int _flashProg(const lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buffer, lfs_size_t size) {
+	HostFlash& bd = *static_cast<HostFlash*>(c->context);
+	bool ok = block < c->block_count && !(off % c->prog_size) && !(size % c->prog_size) && off + size <= c->block_size;
+	uint32_t firstUnit = (block * c->block_size + off) / c->prog_size;
+	for (uint32_t unit = firstUnit; ok && unit < firstUnit + size / c->prog_size; ++unit)
+		ok = !bd.programmed[unit];
+	if (!ok) {
+		++bd.counters->faults;
+		return -22;
+	}
+	for (uint32_t unit = firstUnit; unit < firstUnit + size / c->prog_size; ++unit)
+		bd.programmed[unit] = true;
+	memcpy(&bd.data[block * c->block_size + off], buffer, size);
+	++bd.counters->progCalls;
+	(bd.meta[block] ? bd.counters->metaProgramBytes : bd.counters->programBytes) += size;
+	return 0;
+}
+static int _flashErase(const lfs_config* c, lfs_block_t block) {
+	HostFlash& bd = *static_cast<HostFlash*>(c->context);
+	if (block >= c->block_count) {
+		++bd.counters->faults;
+		return -22;
+	}
+	memset(&bd.data[block * c->block_size], 0xFF, c->block_size);
+	uint32_t unitsPerBlock = c->block_size / c->prog_size;
+	std::fill(bd.programmed.begin() + block * unitsPerBlock, bd.programmed.begin() + (block + 1) * unitsPerBlock, false);
+	++bd.counters->eraseOps;
+	return 0;
+}
+static int _flashSync(const lfs_config* c) {
+	++static_cast<HostFlash*>(c->context)->counters->metaCommits;
+	return 0;
+}
+void HostFlash::begin(FlashCounters* counters, lfs_size_t blockSize, lfs_size_t blockCount) {
+	this->counters = counters;
+	cfg = lfs_config();
+	cfg.context = this;
+	cfg.read = _flashRead;
+	cfg.prog = _flashProg;
+	cfg.erase = _flashErase;
+	cfg.sync = _flashSync;
+	cfg.read_size = 64;
+	cfg.prog_size = 64;
+	cfg.block_size = blockSize;
+	cfg.block_count = blockCount;
+	cfg.block_cycles = 16;
+	cfg.cache_size = 64;
+	cfg.lookahead_size = 64;
+	data.assign((size_t)blockSize * blockCount, 0xFF);
+	programmed.assign((size_t)blockSize * blockCount / cfg.prog_size, false);
+	meta.assign(blockCount, false);
+}
+
+// Commits are made of tags like littlefs ones, 4 bytes of type and length followed by the data,
+// so that they take about as much flash. The types are those of littlefs
+enum HostTagType : uint16_t {
+	TAG_REG = 0x001,
+	TAG_DIR = 0x002,
+	TAG_SUPERBLOCK = 0x0ff,
+	TAG_DIRSTRUCT = 0x200,
+	TAG_INLINESTRUCT = 0x201,
+	TAG_CTZSTRUCT = 0x202,
+	TAG_CREATE = 0x401,
+	TAG_DELETE = 0x4ff,
+	TAG_CRC = 0x500,
+	TAG_HARDTAIL = 0x601,
+	TAG_MOVESTATE = 0x7ff,
+};
+static void _tag(HostString& attrs, HostTagType type, const void* data = nullptr, size_t size = 0) {
+	uint32_t tag = (uint32_t)type << 20 | (size & 0x3ff);
+	attrs.append(reinterpret_cast<const char*>(&tag), sizeof(tag));
+	attrs.append(static_cast<const char*>(data), size);
+}
+static void _tagName(HostString& attrs, HostTagType type, const HostString& path) {
+	size_t pos = path.rfind('/') + 1;
+	_tag(attrs, type, path.data() + pos, path.size() - pos);
+}
+static const uint8_t _noMove[12] = { }; // gstate delta of a move or an orphan
+// A commit ends with a CRC tag padded to prog_size, like lfs_dir_commitcrc does it
+static void _tagCrc(HostString& attrs, lfs_size_t progSize) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (char c : attrs) {
+		crc ^= (uint8_t)c;
+		for (uint8_t i = 0; i < 8; ++i)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	_tag(attrs, TAG_CRC, &crc, sizeof(crc));
+	attrs.resize((attrs.size() + progSize - 1) / progSize * progSize, '\xff');
+}
+static HostString _parent(const HostString& path) {
+	size_t pos = path.rfind('/');
+	return pos ? path.substr(0, pos) : HostString("/");
+}
+
+// lfs_format: the root pair holds the superblock and is compacted twice, so that an older filesystem can't be mounted.
+// Nothing else is erased, blocks are erased when they're allocated
+void FS::formatFlash() {
+	if (bd.data.empty())
+		bd.begin(&flash, blockSize(), 1024 * 1024 / blockSize());
+	_files.clear();
+	_dirs.clear();
+	_usedBlocks.assign(bd.cfg.block_count, false);
+	std::fill(bd.meta.begin(), bd.meta.end(), false);
+	HostDirPair& root = _dirs["/"];
+	for (lfs_block_t block = 0; block < 2; ++block) {
+		root.blocks[block] = block;
+		_usedBlocks[block] = bd.meta[block] = true;
+	}
+	_nextBlock = 2;
+	for (uint8_t i = 0; i < 2; ++i) {
+		compactDir("/", root, HostString(), HostString());
+		bd.cfg.sync(&bd.cfg);
+	}
+}
+bool FS::allocBlock(lfs_block_t& block, bool meta) {
+	for (lfs_size_t i = 0; i < bd.cfg.block_count; ++i) {
+		lfs_block_t candidate = (_nextBlock + i) % bd.cfg.block_count;
+		if (_usedBlocks[candidate])
+			continue;
+		_usedBlocks[candidate] = true;
+		bd.meta[candidate] = meta;
+		_nextBlock = candidate + 1;
+		block = candidate;
+		return true;
+	}
+	++flash.faults; // littlefs would fail with LFS_ERR_NOSPC
+	return false;
+}
+// Through a cache_size cache like littlefs writes: a prog per cache, the last one padded to prog_size
+void FS::progBlock(lfs_block_t block, lfs_off_t off, const HostString& data) {
+	HostString cache;
+	for (size_t pos = 0; pos < data.size(); pos += bd.cfg.cache_size) {
+		cache.assign(data, pos, bd.cfg.cache_size);
+		cache.resize((cache.size() + bd.cfg.prog_size - 1) / bd.cfg.prog_size * bd.cfg.prog_size, '\xff');
+		bd.cfg.prog(&bd.cfg, block, off + pos, cache.data(), cache.size());
+	}
+}
+HostString FS::readBlock(lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+	lfs_off_t start = off / bd.cfg.read_size * bd.cfg.read_size;
+	lfs_off_t end = (off + size + bd.cfg.read_size - 1) / bd.cfg.read_size * bd.cfg.read_size;
+	HostString buffer(end - start, '\0');
+	if (bd.cfg.read(&bd.cfg, block, start, &buffer[0], buffer.size()))
+		return HostString();
+	return buffer.substr(off - start, size);
+}
+// lfs_file_open commits the entry of a new file right away
+void FS::createFile(const std::string& path) {
+	HostString key(path.c_str());
+	_files[key] = HostLayout();
+	HostString attrs;
+	_tag(attrs, TAG_CREATE);
+	_tagName(attrs, TAG_REG, key);
+	_tag(attrs, TAG_INLINESTRUCT);
+	commitDir(_parent(key), attrs);
+}
+// lfs_file_sync: content up to the cache size goes into the commit. Otherwise the blocks before the one holding
+// the first modified byte are kept, that one is copied into a new block and everything after it is programmed anew
+void FS::commitFile(const std::string& path, const HostString& content, uint32_t firstWrite) {
+	HostString key(path.c_str());
+	HostLayout& layout = _files[key];
+	std::vector<lfs_block_t, HostAllocator<lfs_block_t>> oldBlocks;
+	oldBlocks.swap(layout.blocks);
+	uint32_t size = content.size();
+	HostString attrs;
+	if (size <= HOST_INLINE_FILE_MAX_SIZE) {
+		layout.size = size;
+		_tag(attrs, TAG_INLINESTRUCT, content.data(), size);
+		flash.inlineBytes += size;
+		commitDir(_parent(key), attrs, key, attrs.size() - size);
+	} else {
+		uint32_t first = oldBlocks.empty() ? 0 : std::min(firstWrite, layout.size);
+		uint32_t blockStart = 0;
+		for (uint32_t blockIdx = 0; blockStart < size; blockStart += _ctzCapacity(blockIdx++)) {
+			uint32_t blockEnd = blockStart + _ctzCapacity(blockIdx);
+			if (blockIdx < oldBlocks.size() && (blockEnd <= first || first >= size)) {
+				layout.blocks.push_back(oldBlocks[blockIdx]);
+				continue;
+			}
+			lfs_block_t block;
+			if (!allocBlock(block, false))
+				return;
+			bd.cfg.erase(&bd.cfg, block);
+			HostString data;
+			for (uint32_t k = 0; blockIdx && k <= (uint32_t)__builtin_ctz(blockIdx); ++k)
+				data.append(reinterpret_cast<const char*>(&layout.blocks[blockIdx - (1 << k)]), sizeof(lfs_block_t));
+			data.append(content, blockStart, std::min(blockEnd, size) - blockStart);
+			progBlock(block, 0, data);
+			layout.blocks.push_back(block);
+		}
+		layout.size = size;
+		uint32_t ctz[2] = { layout.blocks.back(), size };
+		_tag(attrs, TAG_CTZSTRUCT, ctz, sizeof(ctz));
+		commitDir(_parent(key), attrs);
+	}
+	for (lfs_block_t block : oldBlocks) {
+		if (std::find(layout.blocks.begin(), layout.blocks.end(), block) == layout.blocks.end())
+			freeBlock(block);
+	}
+	if (!checkContent(key, content))
+		++flash.faults;
+}
+// Appends a commit to the pair of the directory, or compacts the pair if the commit doesn't fit.
+// The entries are already what the commit makes them, inlinePath is a file whose content is in the commit at inlineOff
+void FS::commitDir(const HostString& path, HostString attrs, const HostString& inlinePath, lfs_off_t inlineOff) {
+	auto dir = _dirs.find(path);
+	if (dir == _dirs.end()) {
+		++flash.faults;
+		return;
+	}
+	HostDirPair& pair = dir->second;
+	_tagCrc(attrs, bd.cfg.prog_size);
+	if (pair.off + attrs.size() > bd.cfg.block_size) {
+		++flash.compactions;
+		compactDir(path, pair, inlinePath, inlinePath.empty() ? HostString() : attrs.substr(inlineOff, _files[inlinePath].size));
+	} else {
+		progBlock(pair.blocks[0], pair.off, attrs);
+		if (!inlinePath.empty()) {
+			_files[inlinePath].inlineBlock = pair.blocks[0];
+			_files[inlinePath].inlineOff = pair.off + inlineOff;
+		}
+		pair.off += attrs.size();
+	}
+	bd.cfg.sync(&bd.cfg);
+}
+// lfs_dir_compact: the other block of the pair is erased and gets the revision count and the live entries,
+// the content of inline files is copied from where it was. Pairs aren't relocated after block_cycles compactions
+void FS::compactDir(const HostString& path, HostDirPair& pair, const HostString& inlinePath, const HostString& inlineContent) {
+	HostString state(reinterpret_cast<const char*>(&++pair.rev), sizeof(pair.rev));
+	if (path == "/") {
+		uint32_t superblock[6] = { 0x00020000, bd.cfg.block_size, bd.cfg.block_count, 255, 0x7FFFFFFF, 1022 };
+		_tag(state, TAG_SUPERBLOCK, "littlefs", 8);
+		_tag(state, TAG_INLINESTRUCT, superblock, sizeof(superblock));
+	}
+	for (auto& dir : _dirs) {
+		if (dir.first != path && _parent(dir.first) == path) {
+			_tagName(state, TAG_DIR, dir.first);
+			_tag(state, TAG_DIRSTRUCT, dir.second.blocks, sizeof(dir.second.blocks));
+		}
+	}
+	std::vector<std::pair<HostLayout*, lfs_off_t>, HostAllocator<std::pair<HostLayout*, lfs_off_t>>> inlined;
+	for (auto& file : _files) {
+		if (_parent(file.first) != path)
+			continue;
+		HostLayout& layout = file.second;
+		_tagName(state, TAG_REG, file.first);
+		if (layout.blocks.empty()) {
+			HostString content = file.first == inlinePath ? inlineContent : readBlock(layout.inlineBlock, layout.inlineOff, layout.size);
+			_tag(state, TAG_INLINESTRUCT, content.data(), content.size());
+			inlined.push_back({ &layout, state.size() - content.size() });
+		} else {
+			uint32_t ctz[2] = { layout.blocks.back(), layout.size };
+			_tag(state, TAG_CTZSTRUCT, ctz, sizeof(ctz));
+		}
+	}
+	_tagCrc(state, bd.cfg.prog_size);
+	if (state.size() > bd.cfg.block_size) { // littlefs would split the directory into more pairs
+		++flash.faults;
+		return;
+	}
+	bd.cfg.erase(&bd.cfg, pair.blocks[1]);
+	progBlock(pair.blocks[1], 0, state);
+	std::swap(pair.blocks[0], pair.blocks[1]);
+	pair.off = state.size();
+	for (auto& entry : inlined) {
+		entry.first->inlineBlock = pair.blocks[0];
+		entry.first->inlineOff = entry.second;
+	}
+}
+// Reads the file back like lfs_ctz_find walks the skip-list: from the head, following the first pointer of every block
+bool FS::checkContent(const HostString& path, const HostString& content) {
+	const HostLayout& layout = _files[path];
+	if (layout.blocks.empty())
+		return readBlock(layout.inlineBlock, layout.inlineOff, layout.size) == content;
+	std::vector<uint32_t, HostAllocator<uint32_t>> blockStarts;
+	for (uint32_t blockIdx = 0, blockStart = 0; blockStart < layout.size; blockStart += _ctzCapacity(blockIdx++))
+		blockStarts.push_back(blockStart);
+	HostString read(layout.size, '\0');
+	lfs_block_t block = layout.blocks.back();
+	for (uint32_t blockIdx = blockStarts.size(); blockIdx--;) {
+		uint32_t blockStart = blockStarts[blockIdx];
+		uint32_t nBytes = std::min(blockStart + _ctzCapacity(blockIdx), layout.size) - blockStart;
+		read.replace(blockStart, nBytes, readBlock(block, blockSize() - _ctzCapacity(blockIdx), nBytes));
+		HostString pointer = blockIdx ? readBlock(block, 0, sizeof(block)) : HostString();
+		if (blockIdx && pointer.size() != sizeof(block))
+			return false;
+		memcpy(&block, pointer.data(), pointer.size());
+	}
+	return read == content;
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+	if (!isFile())
+		return 0;
+	uint32_t offset = _impl->append ? this->size() : position();
+	_impl->firstWrite = std::min(_impl->firstWrite, offset);
+	_impl->dirty = true;
+	return fwrite(buffer, 1, size, _impl->fp);
+}
+void File::flush() {
+	if (isFile())
+		_impl->commit();
+}
+int File::peek() {
+	int c = read();
+	if (c >= 0)
+		ungetc(c, _impl->fp);
+	return c;
+}
+bool File::seek(uint32_t pos, SeekMode mode) {
+	return isFile() && !fseek(_impl->fp, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END);
+}
+size_t File::size() const {
+	if (!isFile())
+		return 0;
+	fflush(_impl->fp);
+	struct stat st;
+	return fstat(fileno(_impl->fp), &st) ? 0 : st.st_size;
+}
+bool File::truncate(uint32_t size) {
+	if (!isFile())
+		return false;
+	// growing writes zeros from the current end, shrinking changes nothing but the file's metadata
+	_impl->firstWrite = std::min(_impl->firstWrite, std::min(size, (uint32_t)this->size()));
+	_impl->dirty = true;
+	fflush(_impl->fp);
+	return !ftruncate(fileno(_impl->fp), size);
+}
+const char* File::name() const {
+	return _impl ? _impl->path.c_str() + _impl->path.rfind('/') + 1 : "";
+}
+time_t File::getLastWrite() {
+	ShimScope scope;
+	if (_impl && _impl->fp)
+		fflush(_impl->fp);
+	struct stat st;
+	return _impl && !::stat(LittleFS.hostPath(_impl->path.c_str()).c_str(), &st) ? st.st_mtime : 0;
+}
+
+std::string Dir::entryPath() const {
+	return _path == "/" ? "/" + _names[_idx] : _path + "/" + _names[_idx];
+}
+bool Dir::stat(struct stat& st) const {
+	ShimScope scope;
+	return !::stat(LittleFS.hostPath(entryPath().c_str()).c_str(), &st);
+}
+size_t Dir::fileSize() const {
+	struct stat st;
+	return stat(st) && S_ISREG(st.st_mode) ? st.st_size : 0;
+}
+time_t Dir::fileTime() const {
+	struct stat st;
+	return stat(st) ? st.st_mtime : 0;
+}
+bool Dir::isFile() const {
+	struct stat st;
+	return stat(st) && S_ISREG(st.st_mode);
+}
+bool Dir::isDirectory() const {
+	struct stat st;
+	return stat(st) && S_ISDIR(st.st_mode);
+}
+File Dir::openFile(const char* mode) const {
+	ShimScope scope;
+	return LittleFS.open(entryPath().c_str(), mode);
+}
+
+std::string FS::hostPath(const char* path) const {
+	ShimScope scope;
+	std::string normalized = _normalize(path);
+	return normalized == "/" ? _root : _root + normalized;
+}
+bool FS::begin() {
+	ShimScope scope;
+	_mounted = true;
+	if (bd.data.empty())
+		formatFlash();
+	::mkdir(_root.c_str(), 0755);
+	struct stat st;
+	return !::stat(_root.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+static bool _removeTree(const std::string& hostPath, bool removeRoot) {
+	DIR* dir = opendir(hostPath.c_str());
+	if (!dir)
+		return !::unlink(hostPath.c_str());
+	bool ok = true;
+	while (dirent* entry = readdir(dir)) {
+		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+			ok &= _removeTree(hostPath + "/" + entry->d_name, true);
+	}
+	closedir(dir);
+	return ok && (!removeRoot || !::rmdir(hostPath.c_str()));
+}
+bool FS::format() {
+	ShimScope scope;
+	formatFlash();
+	return _removeTree(_root, false);
+}
+bool FS::info(FSInfo& info) {
+	ShimScope scope;
+	info.totalBytes = 1024 * 1024;
+	info.blockSize = blockSize();
+	info.pageSize = 256;
+	info.maxOpenFiles = 5;
+	info.maxPathLength = 32;
+	info.usedBytes = std::count(_usedBlocks.begin(), _usedBlocks.end(), true) * info.blockSize; // like lfs_fs_size
+	return true;
+}
+File FS::open(const char* path, const char* mode) {
+	ShimScope scope;
+	auto impl = std::make_shared<FileImpl>();
+	impl->path = _normalize(path);
+	std::string hostName = hostPath(path);
+	struct stat st;
+	bool exists = !::stat(hostName.c_str(), &st);
+	if (exists && S_ISDIR(st.st_mode))
+		return File(impl);
+	if (!exists && mode[0] == 'r')
+		return File();
+	std::string hostMode = mode;
+	hostMode += 'b';
+	impl->fp = fopen(hostName.c_str(), hostMode.c_str());
+	if (!impl->fp)
+		return File();
+	if (!exists)
+		createFile(impl->path);
+	impl->append = mode[0] == 'a';
+	impl->dirty = exists && mode[0] == 'w'; // truncated, a new file has been committed already
+	++opens;
+	return File(impl);
+}
+bool FS::exists(const char* path) {
+	ShimScope scope;
+	struct stat st;
+	return !::stat(hostPath(path).c_str(), &st);
+}
+Dir FS::openDir(const char* path) {
+	ShimScope scope;
+	std::vector<std::string> names;
+	if (DIR* dir = opendir(hostPath(path).c_str())) {
+		while (dirent* entry = readdir(dir)) {
+			if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+				names.push_back(entry->d_name);
+		}
+		closedir(dir);
+	}
+	std::sort(names.begin(), names.end());
+	return Dir(_normalize(path), std::move(names));
+}
+bool FS::remove(const char* path) {
+	ShimScope scope;
+	if (::unlink(hostPath(path).c_str()))
+		return false;
+	HostString key(_normalize(path).c_str());
+	HostLayout layout = _files[key];
+	_files.erase(key);
+	HostString attrs;
+	_tag(attrs, TAG_DELETE);
+	commitDir(_parent(key), attrs);
+	for (lfs_block_t block : layout.blocks)
+		freeBlock(block);
+	return true;
+}
+// Moves the entry and everything under it
+template<typename Map> static void _rekey(Map& map, const HostString& from, const HostString& to) {
+	std::vector<HostString, HostAllocator<HostString>> keys;
+	for (auto& entry : map) {
+		if (entry.first == from || (entry.first.size() > from.size() && !entry.first.compare(0, from.size(), from) && entry.first[from.size()] == '/'))
+			keys.push_back(entry.first);
+	}
+	for (const HostString& key : keys) {
+		auto node = map.extract(key);
+		node.key() = to + key.substr(from.size());
+		map.insert(std::move(node));
+	}
+}
+// lfs_rename: the entry is committed to the new parent with everything it had, inline content included,
+// and deleted from the old parent by a second commit if that's another directory.
+// An entry the new one replaces is deleted by the first commit
+bool FS::rename(const char* pathFrom, const char* pathTo) {
+	ShimScope scope;
+	if (::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()))
+		return false;
+	HostString from(_normalize(pathFrom).c_str()), to(_normalize(pathTo).c_str());
+	HostString attrs;
+	HostLayout replaced;
+	if (_files.count(to)) {
+		replaced = _files[to];
+		_files.erase(to);
+		_tag(attrs, TAG_DELETE);
+	}
+	bool isDir = _dirs.count(from);
+	_rekey(_files, from, to);
+	_rekey(_dirs, from, to);
+	_tag(attrs, TAG_CREATE);
+	_tagName(attrs, isDir ? TAG_DIR : TAG_REG, to);
+	HostString inlinePath;
+	if (isDir) {
+		_tag(attrs, TAG_DIRSTRUCT, _dirs[to].blocks, sizeof(_dirs[to].blocks));
+	} else if (_files[to].blocks.empty()) {
+		HostLayout& layout = _files[to];
+		HostString content = readBlock(layout.inlineBlock, layout.inlineOff, layout.size);
+		_tag(attrs, TAG_INLINESTRUCT, content.data(), content.size());
+		inlinePath = to;
+	} else {
+		uint32_t ctz[2] = { _files[to].blocks.back(), _files[to].size };
+		_tag(attrs, TAG_CTZSTRUCT, ctz, sizeof(ctz));
+	}
+	lfs_off_t inlineOff = attrs.size() - (inlinePath.empty() ? 0 : _files[to].size);
+	if (_parent(from) == _parent(to)) {
+		_tag(attrs, TAG_DELETE);
+		commitDir(_parent(to), attrs, inlinePath, inlineOff);
+	} else {
+		_tag(attrs, TAG_MOVESTATE, _noMove, sizeof(_noMove));
+		commitDir(_parent(to), attrs, inlinePath, inlineOff);
+		HostString deleted;
+		_tag(deleted, TAG_DELETE);
+		_tag(deleted, TAG_MOVESTATE, _noMove, sizeof(_noMove));
+		commitDir(_parent(from), deleted);
+	}
+	for (lfs_block_t block : replaced.blocks)
+		freeBlock(block);
+	return true;
+}
+// lfs_mkdir: a new pair gets its first commit, which compacts it and so erases a block of it,
+// then the entry is committed to the parent
+bool FS::mkdir(const char* path) {
+	ShimScope scope;
+	if (::mkdir(hostPath(path).c_str(), 0755))
+		return false;
+	HostString key(_normalize(path).c_str());
+	HostDirPair pair;
+	if (!allocBlock(pair.blocks[0], true) || !allocBlock(pair.blocks[1], true))
+		return true;
+	HostDirPair& dir = _dirs[key] = pair;
+	compactDir(key, dir, HostString(), HostString());
+	bd.cfg.sync(&bd.cfg);
+	HostString attrs;
+	_tag(attrs, TAG_CREATE);
+	_tagName(attrs, TAG_DIR, key);
+	_tag(attrs, TAG_DIRSTRUCT, dir.blocks, sizeof(dir.blocks));
+	commitDir(_parent(key), attrs);
+	return true;
+}
+// lfs_remove of a directory: the entry is deleted from the parent, then the pair is dropped
+// from the list of pairs by a commit to the one before it, the parent stands in for that one
+bool FS::rmdir(const char* path) {
+	ShimScope scope;
+	if (::rmdir(hostPath(path).c_str()))
+		return false;
+	HostString key(_normalize(path).c_str());
+	auto dir = _dirs.find(key);
+	if (dir == _dirs.end()) {
+		++flash.faults;
+		return true;
+	}
+	HostDirPair pair = dir->second;
+	_dirs.erase(dir);
+	HostString attrs;
+	_tag(attrs, TAG_DELETE);
+	_tag(attrs, TAG_MOVESTATE, _noMove, sizeof(_noMove));
+	commitDir(_parent(key), attrs);
+	HostString dropped;
+	_tag(dropped, TAG_HARDTAIL, pair.blocks, sizeof(pair.blocks));
+	_tag(dropped, TAG_MOVESTATE, _noMove, sizeof(_noMove));
+	commitDir(_parent(key), dropped);
+	for (lfs_block_t block : pair.blocks)
+		freeBlock(block);
+	return true;
+}
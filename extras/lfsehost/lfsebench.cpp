@@ -0,0 +1,233 @@
+// Host-side benchmarks of the explorer, on the same stand-ins as lfsetest.
+// Build: g++ -std=gnu++17 -O2 -I. -I../../src lfsebench.cpp host.cpp ../../src/lfsexplorer.cpp ../../src/lfsecodec.cpp -o lfsebench
+//
+//   lfsebench [bench...]      runs the given benchmarks, all of them if none
+//
+// Times are of the host and only compare implementations with each other,
+// allocation counts of the explorer are what the device would do too
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include "lfsexplorer.h"
+
+// Allocations of the explorer, those of the FS stand-in are counted apart (see HeapCounters::shimAllocations)
+struct Measure {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t nAllocationsAtStart = hostHeap.allocations;
+	uint32_t nShimAllocationsAtStart = hostHeap.shimAllocations;
+	uint32_t nCallerAllocations = 0; // made by the benchmark itself, the command lines it builds
+
+	void print(const char* name, uint32_t nOps) const {
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		uint32_t nShim = hostHeap.shimAllocations - nShimAllocationsAtStart;
+		printf("  %-24s %8.1f ns/op %6.2f allocations/op (+%.2f by the host FS)\n", name, ns / nOps,
+			(double)(hostHeap.allocations - nAllocationsAtStart - nShim - nCallerAllocations) / nOps, (double)nShim / nOps);
+	}
+	// the command line comes from the serial buffer on the device, here it's a String the explorer is called with
+	void run(const char* cmd) {
+		uint32_t nAllocations = hostHeap.allocations;
+		String line(cmd);
+		nCallerAllocations += hostHeap.allocations - nAllocations;
+		DEBUG::LittleFSExplorer(line);
+	}
+};
+// what the commands print is dropped, it would grow the heap of the benchmark otherwise
+struct NullPrint : public Print {
+	size_t write(uint8_t) override { return 1; }
+	size_t write(const uint8_t*, size_t size) override { return size; }
+	using Print::write;
+};
+static NullPrint _null;
+static volatile uint32_t _sink; // keeps the measured work from being optimized out
+
+// Resolving user paths against the working directory, as every command does, and turning them back to strings
+static void benchPath() {
+	const char* userPaths[] = { "log.txt", "../cfg/wifi.json", "/data/logs/2024/01/day.log", "./a/./b/../c", "sub/dir/file.bin" };
+	const uint8_t nPaths = sizeof(userPaths) / sizeof(userPaths[0]);
+	const uint32_t nOps = 200000;
+	LFSEPath cwd("/data/logs");
+	{
+		Measure measure;
+		for (uint32_t i = 0; i < nOps; ++i) {
+			LFSEPath path = cwd;
+			path.adjust(userPaths[i % nPaths]);
+			_sink += path.tokensCount();
+		}
+		measure.print("adjust (tokenize)", nOps);
+	}
+	LFSEPath path = cwd;
+	path.adjust("2024/01/day.log");
+	{
+		Measure measure;
+		for (uint32_t i = 0; i < nOps; ++i)
+			_sink += path.toString().length();
+		measure.print("toString", nOps);
+	}
+	{
+		Measure measure;
+		for (uint32_t i = 0; i < nOps; ++i)
+			_sink += strlen(path.c_str());
+		measure.print("c_str", nOps);
+	}
+}
+
+struct HeapState {
+	uint32_t free = ESP.getFreeHeap();
+	uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+	uint8_t fragmentation = ESP.getHeapFragmentation();
+
+	void print(const char* name) const {
+		printf("  %-24s free %6u, largest block %6u, fragmentation %3u%%\n", name, free, maxBlock, fragmentation);
+	}
+};
+
+// Everyday commands over and over: what they leave allocated or how they split the free heap adds up
+static void benchSoak() {
+	const uint32_t nCmds = 10000;
+	const uint8_t nKinds = 10;
+	DEBUG::LittleFSExplorer("mkdir /soak");
+	char cmd[64];
+	auto soakCmd = [&cmd](uint32_t i) {
+		unsigned int k = i / nKinds % 8;
+		switch (i % nKinds) {
+		case 0: snprintf(cmd, sizeof(cmd), "tee /soak/f%u.txt \"line %u of the soak\"", k, (unsigned int)i); break;
+		case 1: snprintf(cmd, sizeof(cmd), "cat /soak/f%u.txt", k); break;
+		case 2: snprintf(cmd, sizeof(cmd), "ls /soak"); break;
+		case 3: snprintf(cmd, sizeof(cmd), "cd /soak"); break;
+		case 4: snprintf(cmd, sizeof(cmd), "cp f%u.txt g%u.txt", k, k); break;
+		case 5: snprintf(cmd, sizeof(cmd), "mv g%u.txt ../h%u.txt", k, k); break;
+		case 6: snprintf(cmd, sizeof(cmd), "pwd"); break;
+		case 7: snprintf(cmd, sizeof(cmd), "cd .."); break;
+		case 8: snprintf(cmd, sizeof(cmd), "rm h%u.txt", k); break;
+		default: snprintf(cmd, sizeof(cmd), "touch /soak/t%u", k); break;
+		}
+		return cmd;
+	};
+	// one round first, for what is allocated once and kept afterwards
+	for (uint32_t i = 0; i < nKinds; ++i)
+		DEBUG::LittleFSExplorer(soakCmd(i));
+	HeapState before;
+	hostHeap.lowestFree = before.free;
+	uint32_t nOverflowsAtStart = hostHeap.overflows;
+	uint32_t nFallbacksAtStart = DEBUG::lfseArena._nFallbacks;
+	Measure measure;
+	for (uint32_t i = nKinds; i < nKinds + nCmds; ++i)
+		measure.run(soakCmd(i));
+	measure.print("command", nCmds);
+	HeapState after;
+	before.print("heap before");
+	after.print("heap after");
+	printf("  %-24s %6u, %u allocations did not fit the heap, %u arena fallbacks\n", "lowest free heap", hostHeap.lowestFree,
+		hostHeap.overflows - nOverflowsAtStart, DEBUG::lfseArena._nFallbacks - nFallbacksAtStart);
+}
+
+// tee -a of a log line, to one file and round robin to more files than the handle cache keeps open
+static void benchAppend() {
+	const uint32_t nAppends = 2000;
+	const uint8_t nFilesList[] = { 1, 4, 8 };
+	for (uint8_t nFiles : nFilesList) {
+		DEBUG::LittleFSExplorer("wipe -f");
+		LittleFS.flash = FlashCounters();
+		LittleFS.opens = 0;
+		Measure measure;
+		for (uint32_t i = 0; i < nAppends; ++i) {
+			char cmd[64];
+			snprintf(cmd, sizeof(cmd), "tee -a /log%u \"line %u of the log\"", i % nFiles, (unsigned int)i);
+			measure.run(cmd);
+		}
+		measure.run("sync");
+		char name[32];
+		snprintf(name, sizeof(name), "append to %u file%s", nFiles, nFiles > 1 ? "s" : "");
+		measure.print(name, nAppends);
+		const FlashCounters& flash = LittleFS.flash;
+		printf("  %-24s %8.2f opens/op %8.1f bytes programmed/op %6.3f erases/op %6.3f commits/op\n", "", (double)LittleFS.opens / nAppends,
+			(double)flash.programmed() / nAppends, (double)flash.eraseOps / nAppends, (double)flash.metaCommits / nAppends);
+	}
+}
+
+// zappend of a log line against tee -a of the same line synced right away, as zappend commits it:
+// what an append costs as the file grows
+static void benchZappend() {
+	const uint32_t nAppends = 4000;
+	const uint32_t nWindow = 1000;
+	const char* names[] = { "zappend", "tee -a" };
+	const char* cmdFormats[] = { "zappend /log.lfz \"line %u of the log\"", "tee -a /log.txt \"line %u of the log\"" };
+	for (uint8_t k = 0; k < 2; ++k) {
+		const char* cmdFormat = cmdFormats[k];
+		DEBUG::LittleFSExplorer("wipe -f");
+		for (uint32_t i = 0; i < nAppends;) {
+			uint32_t first = i;
+			LittleFS.flash = FlashCounters();
+			Measure measure;
+			for (; i < first + nWindow; ++i) {
+				char cmd[64];
+				snprintf(cmd, sizeof(cmd), cmdFormat, (unsigned int)i);
+				measure.run(cmd);
+				measure.run("sync");
+			}
+			char name[32];
+			snprintf(name, sizeof(name), "%s %u-%u", names[k], (unsigned int)first + 1, (unsigned int)i);
+			measure.print(name, nWindow);
+			const FlashCounters& flash = LittleFS.flash;
+			printf("  %-24s %8.1f bytes programmed/op %6.3f erases/op\n", "", (double)flash.programmed() / nWindow, (double)flash.eraseOps / nWindow);
+		}
+	}
+}
+
+// kv bench of the explorer itself, with values that fit a littlefs inline file and ones that don't
+static void benchKv() {
+	struct StdoutPrint : public Print {
+		size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+		size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+		using Print::write;
+	} out;
+	const char* cmds[] = { "kv bench 32 16", "kv bench 32 128" };
+	for (const char* cmd : cmds) {
+		printf("  %s\n", cmd);
+		DEBUG::lfseOut = &out;
+		DEBUG::LittleFSExplorer(cmd);
+		DEBUG::lfseOut = &_null;
+	}
+}
+
+struct Bench {
+	const char* name;
+	std::function<void()> run;
+};
+static const Bench _benches[] = {
+	{ "path", benchPath },
+	{ "soak", benchSoak },
+	{ "append", benchAppend },
+	{ "zappend", benchZappend },
+	{ "kv", benchKv },
+};
+
+int main(int argc, char** argv) {
+	char root[] = "/tmp/lfsebench.XXXXXX";
+	if (!mkdtemp(root)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	LittleFS.setRoot(root);
+	LittleFS.begin();
+	DEBUG::lfseOut = &_null;
+	DEBUG::lfseErr = &_null;
+	for (const Bench& bench : _benches) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc; ++i)
+			selected |= !strcmp(argv[i], bench.name);
+		if (!selected)
+			continue;
+		DEBUG::LittleFSExplorer("wipe -f");
+		printf("%s\n", bench.name);
+		bench.run();
+	}
+	LittleFS.format();
+	rmdir(root);
+	return 0;
+}
@@ -0,0 +1,535 @@
+// Host-side tests of the explorer: commands run against LittleFS kept in a temporary host directory,
+// with Serial replaced by in-memory buffers (see Arduino.h).
+// Build: g++ -std=gnu++17 -O2 -pthread -I. -I../../src lfsetest.cpp host.cpp ../../src/lfsexplorer.cpp ../../src/lfsecodec.cpp ../lfseclient/lfseclient.cpp -o lfsetest
+//
+//   lfsetest [test...]        runs the given tests, all of them if none; exit code is the number of failed ones
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "lfsexplorer.h"
+#include "../lfsedelta/lfsedelta.h"
+#include "../lfseclient/lfseclient.h"
+
+struct StringPrint : public Print {
+	std::string data;
+	size_t write(uint8_t c) override { data += (char)c; return 1; }
+	size_t write(const uint8_t* buffer, size_t size) override { data.append(reinterpret_cast<const char*>(buffer), size); return size; }
+	using Print::write;
+};
+
+static StringPrint _out, _err;
+static bool _failed;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			fprintf(stderr, "  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			_failed = true; \
+		} \
+	} while (0)
+
+// Runs a command with input as what comes in over Serial after it, returns what it printed.
+// Errors are kept in _err
+static std::string run(const char* cmd, const std::string& input = std::string()) {
+	_out.data.clear();
+	_err.data.clear();
+	Serial.feed(input);
+	DEBUG::lfseOut = &_out;
+	DEBUG::lfseErr = &_err;
+	DEBUG::LittleFSExplorer(cmd);
+	return _out.data;
+}
+// Runs what's still in Serial as commands, the way the device would when its loop calls the explorer again
+static void runLeftInput() {
+	for (int i = 0; i < 100 && Serial.available(); ++i)
+		run("");
+}
+static bool hasError() {
+	// the executed command itself is logged too, one line
+	size_t firstLineEnd = _err.data.find('\n');
+	return firstLineEnd != std::string::npos && firstLineEnd + 1 < _err.data.size();
+}
+
+static bool writeFile(const char* path, const std::string& data) {
+	File f = LittleFS.open(path, "w");
+	return f && f.write(reinterpret_cast<const uint8_t*>(data.data()), data.size()) == data.size();
+}
+static bool readFile(const char* path, std::string& data) {
+	File f = LittleFS.open(path, "r");
+	if (!f || f.isDirectory())
+		return false;
+	data.clear();
+	uint8_t buffer[256];
+	while (int nBytes = f.read(buffer, sizeof(buffer)))
+		data.append(reinterpret_cast<const char*>(buffer), nBytes);
+	return true;
+}
+static std::string pseudoRandom(size_t size, uint32_t seed) {
+	std::string res(size, '\0');
+	for (char& c : res) {
+		seed = seed * 1103515245 + 12345;
+		c = seed >> 16;
+	}
+	return res;
+}
+// true if both trees have the same names, types and file contents
+static bool sameTree(const std::string& a, const std::string& b) {
+	Dir dirA = LittleFS.openDir(a.c_str());
+	Dir dirB = LittleFS.openDir(b.c_str());
+	while (dirA.next()) {
+		if (!dirB.next() || dirA.fileName() != dirB.fileName() || dirA.isDirectory() != dirB.isDirectory())
+			return false;
+		std::string pathA = a + "/" + dirA.fileName().c_str();
+		std::string pathB = b + "/" + dirB.fileName().c_str();
+		std::string dataA, dataB;
+		if (dirA.isDirectory() ? !sameTree(pathA, pathB) : !readFile(pathA.c_str(), dataA) || !readFile(pathB.c_str(), dataB) || dataA != dataB)
+			return false;
+	}
+	return !dirB.next();
+}
+
+// ustar header of a regular file, as another tar would write it
+static std::string tarHeader(const char* name, size_t size, const char* magic = "ustar") {
+	std::string block(512, '\0');
+	memcpy(&block[0], name, strlen(name));
+	memcpy(&block[100], "0000644", 7);
+	snprintf(&block[124], 12, "%011o", (unsigned int)size);
+	memcpy(&block[136], "00000000000", 11);
+	block[156] = '0';
+	memcpy(&block[257], magic, strlen(magic));
+	unsigned int checksum = 8 * ' ';
+	for (size_t i = 0; i < block.size(); ++i)
+		checksum += i < 148 || i >= 156 ? (uint8_t)block[i] : 0;
+	snprintf(&block[148], 8, "%06o", checksum);
+	block[155] = ' ';
+	return block;
+}
+static std::string tarBody(const std::string& data) {
+	return data + std::string((512 - data.size() % 512) % 512, '\0');
+}
+
+static void testTarRoundTrip() {
+	run("mkdir /src");
+	run("mkdir /src/sub");
+	run("mkdir /src/sub/deep");
+	run("mkdir /src/empty");
+	const size_t sizes[] = { 0, 1, 511, 512, 513, 3000 };
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		char path[32];
+		snprintf(path, sizeof(path), i % 2 ? "/src/sub/f%u" : "/src/sub/deep/f%u", (unsigned int)i);
+		CHECK(writeFile(path, pseudoRandom(sizes[i], i)));
+	}
+	CHECK(writeFile("/src/top.txt", "top\n"));
+
+	std::string archive = run("tar -c /src");
+	CHECK(!hasError());
+	CHECK(archive.size() % 512 == 0);
+	CHECK(archive.size() >= 1024 && archive.compare(archive.size() - 1024, 1024, std::string(1024, '\0')) == 0);
+	run("mkdir /dst");
+	std::string listing = run("tar -x /dst", archive);
+	CHECK(!hasError());
+	CHECK(listing.find("tar: 7 files (4541 bytes), 3 directories, 0 skipped") != std::string::npos);
+	CHECK(sameTree("/src", "/dst"));
+
+	// compressed both ways
+	archive = run("tar -c -z /src");
+	CHECK(!hasError());
+	run("mkdir /dstz");
+	run("tar -x -z /dstz", archive);
+	CHECK(!hasError());
+	CHECK(sameTree("/src", "/dstz"));
+}
+static void testTarMissingParents() {
+	std::string archive = tarHeader("a/b/c.txt", 5) + tarBody("hello") + std::string(1024, '\0');
+	run("mkdir /dst");
+	run("tar -x /dst", archive);
+	CHECK(!hasError());
+	std::string data;
+	CHECK(readFile("/dst/a/b/c.txt", data) && data == "hello");
+}
+static void testTarBadMagic() {
+	std::string archive = tarHeader("x.txt", 5, "notar") + tarBody("hello") + std::string(1024, '\0');
+	run("mkdir /dst");
+	run("tar -x /dst", archive);
+	CHECK(_err.data.find("not a ustar archive") != std::string::npos);
+	CHECK(!LittleFS.exists("/dst/x.txt"));
+}
+// tar pads archives to records of 10240 bytes: the zero blocks after the end marker are skipped,
+// and what comes after them is the next command
+static void testTarRecordPadding() {
+	std::string archive = tarHeader("a.txt", 5) + tarBody("hello");
+	archive += std::string(10240 - archive.size(), '\0');
+	run("mkdir /dst");
+	run("tar -x /dst", archive + "mkdir /after\n");
+	CHECK(!hasError());
+	CHECK(Serial.input.substr(Serial.inputPos) == "mkdir /after\n");
+	runLeftInput();
+	CHECK(!hasError());
+	CHECK(LittleFS.exists("/dst/a.txt"));
+	CHECK(LittleFS.exists("/after"));
+}
+// An archive that can't be extracted is still read to its end, so that none of it runs as commands
+static void testTarDrainOnFailure() {
+	std::string archive = tarHeader("cmds.txt", 16) + tarBody("mkdir /injected\n") + std::string(1024, '\0');
+	run("tar -x /nonexistent", archive);
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+	CHECK(writeFile("/file", "not a directory"));
+	run("tar -x -z /file", "\nmkdir /injected\n");
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+}
+
+// A zappend cut short by a power loss leaves the file readable up to its last complete block,
+// and the next zappend writes over what's left of the torn one
+static std::string readLfz(const char* path) {
+	std::string data;
+	File f = LittleFS.open(path, "r");
+	LFSELzFileReader reader;
+	if (reader.open(f)) {
+		for (int c = reader.read(); c >= 0; c = reader.read())
+			data += (char)c;
+	}
+	reader.close();
+	return data;
+}
+static void testZappendTorn() {
+	std::string plain;
+	for (int i = 0; i < 53; ++i) {
+		std::string line = "line " + std::to_string(i) + " of the log";
+		if (i >= 50) { // barely compressible, the last block takes most of the file
+			line = pseudoRandom(100, i);
+			for (char& c : line)
+				c = 'a' + (uint8_t)c % 26;
+		}
+		run(("zappend /z.lfz \"" + line + "\"").c_str());
+		CHECK(!hasError());
+		plain += line + "\r\n";
+	}
+	CHECK(readLfz("/z.lfz") == plain);
+	std::string whole;
+	CHECK(readFile("/z.lfz", whole));
+	const size_t cuts[] = { 1, 10, 100, 200 };
+	for (size_t cut : cuts) {
+		CHECK(writeFile("/torn.lfz", whole.substr(0, whole.size() - cut)));
+		std::string read = readLfz("/torn.lfz");
+		CHECK(read == plain.substr(0, plain.size() / LFSE_LFZ_BLOCK_LENGTH * LFSE_LFZ_BLOCK_LENGTH));
+		run("zappend /torn.lfz \"after\"");
+		CHECK(!hasError());
+		CHECK(readLfz("/torn.lfz") == read + "after\r\n");
+	}
+}
+
+// sig on the device, the delta made from it on the host as lfsedelta does, and patch back on the device
+static void testPatchRoundTrip() {
+	std::string oldData = pseudoRandom(5000, 1);
+	CHECK(writeFile("/f", oldData));
+	std::string newData = oldData.substr(0, 1000) + "inserted in the middle" + oldData.substr(1100, 3000) + pseudoRandom(300, 2);
+	std::string sig = run("sig /f 128");
+	CHECK(!hasError());
+	FILE* fSig = fmemopen(&sig[0], sig.size(), "r");
+	CHECK(fSig);
+	std::string delta;
+	size_t nCopied = 0;
+	CHECK(fSig && makeDelta(fSig, std::vector<uint8_t>(newData.begin(), newData.end()), delta, nCopied));
+	if (fSig)
+		fclose(fSig);
+	CHECK(nCopied * 128 > 3000 && delta.size() < newData.size() / 2);
+	run("patch /f", delta);
+	CHECK(!hasError());
+	std::string patched;
+	CHECK(readFile("/f", patched) && patched == newData);
+}
+// A patch that can't start still reads its delta, so that none of it runs as commands
+static void testPatchDrainOnFailure() {
+	run("mkdir /d");
+	run("patch /d", "\nmkdir /injected\n");
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+	std::string longPath = "/" + std::string(LFSE_PATH_MAX_LENGTH + 1, 'p');
+	run(("patch " + longPath).c_str(), "\nmkdir /injected\n");
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+}
+
+// Compressed content that can't be written is still read, so that none of it runs as commands
+static void testTeeCompressedDrainOnFailure() {
+	run("mkdir /d");
+	run("tee -z /d", "\nmkdir /injected\n");
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+	run("tee -z /missing/f", "\nmkdir /injected\n");
+	CHECK(hasError());
+	runLeftInput();
+	CHECK(!LittleFS.exists("/injected"));
+}
+
+// Appending a line at a time has to give the same file as compressing all of it at once:
+// the short last block is taken back and filled up instead of a new block being started each time
+static void testZappendRefill() {
+	std::string plain;
+	for (int i = 0; i < 100; ++i) {
+		char cmd[64];
+		snprintf(cmd, sizeof(cmd), "zappend /log.lfz \"line %d of the log\"", i);
+		run(cmd);
+		CHECK(!hasError());
+		snprintf(cmd, sizeof(cmd), "line %d of the log\r\n", i);
+		plain += cmd;
+	}
+	CHECK(writeFile("/plain.txt", plain));
+	run("zwrite --from /plain.txt /ref.lfz");
+	CHECK(!hasError());
+	std::string appended, reference;
+	CHECK(readFile("/log.lfz", appended) && readFile("/ref.lfz", reference));
+	CHECK(appended == reference);
+	CHECK(appended.size() < plain.size());
+	CHECK(run("cat /log.lfz") == plain);
+	std::string lastLines = run("cat -f98 /plain.txt");
+	CHECK(run("cat -f98 /log.lfz") == lastLines);
+}
+
+// Sets stay in the open log until it's synced, kv reads them back through the same handle and others see them after the sync.
+// Setting the same value again changes nothing, not even the logical bytes of wear
+static void testKvOpenLog() {
+	run("wear -r");
+	run("kv set a \"first\"");
+	run("kv set b \"second\"");
+	CHECK(!hasError());
+	CHECK(run("kv get a") == "first\r\n");
+	run("kv set a \"third\"");
+	CHECK(run("kv get a") == "third\r\n" && run("kv get b") == "second\r\n");
+	run("sync");
+	std::string log;
+	CHECK(readFile("/kv.log", log) && log.find("third") != std::string::npos);
+	uint64_t programmed = LittleFS.flash.programmed();
+	run("kv set a \"third\"");
+	run("sync");
+	CHECK(LittleFS.flash.programmed() == programmed);
+	std::string wear = run("wear");
+	unsigned int nCalls = 0, nLogical = 0;
+	CHECK(sscanf(wear.c_str() + wear.find("\nkv "), "\nkv %u %u", &nCalls, &nLogical) == 2);
+	CHECK(nCalls == 7 && nLogical == 3 * 1 + strlen("first") + strlen("second") + strlen("third"));
+}
+
+// The flash under the host FS holds its callers to the rules of NOR flash, breaking them counts as a fault
+static void testFlashRules() {
+	lfs_config& c = LittleFS.bd.cfg;
+	lfs_block_t block = c.block_count - 1; // the last one to be allocated after a format
+	uint8_t data[64], read[64];
+	memset(data, 0x5A, sizeof(data));
+	uint32_t nFaults = LittleFS.flash.faults;
+	CHECK(!c.erase(&c, block) && !c.prog(&c, block, 0, data, 64));
+	CHECK(c.prog(&c, block, 0, data, 64)); // programmed already
+	CHECK(c.prog(&c, block, 96, data, 64) && c.prog(&c, block, 128, data, 32) && c.read(&c, block, 8, read, 64)); // unaligned
+	CHECK(LittleFS.flash.faults == nFaults + 4);
+	CHECK(!c.erase(&c, block) && !c.prog(&c, block, 0, data, 64) && !c.read(&c, block, 0, read, 64) && !memcmp(read, data, 64));
+	CHECK(LittleFS.flash.faults == nFaults + 4);
+	c.erase(&c, block);
+}
+
+// The explorer's wear estimate (wear) against the calls the flash under the host FS got for the same commands.
+// The estimate ignores skip-list pointers and padding to prog_size, so it may be lower by those of every block written,
+// and it can't foresee compactions of metadata pairs, so their erases don't count
+static void testWearEstimate() {
+	CHECK(writeFile("/src.bin", pseudoRandom(20000, 1)));
+	CHECK(writeFile("/patch.bin", pseudoRandom(300, 2)));
+	struct Scenario {
+		const char* name;
+		std::vector<const char*> cmds;
+	};
+	const Scenario scenarios[] = {
+		{ "tee", { "tee /small \"inline\"", "tee /small \"rewritten\"" } },
+		{ "cp", { "cp /src.bin /copy.bin" } },
+		{ "dd", { "dd if=/patch.bin of=/copy.bin seek=30", "dd if=/patch.bin of=/copy.bin seek=2" } },
+		{ "tee -a", { "tee -a /log \"a line of the log\"", "tee -a /log \"another line\"", "sync", "tee -a /log \"one more\"", "sync" } },
+		{ "kv", { "kv set a \"1\"", "kv set b \"2\"", "kv set a \"3\"", "kv del b" } },
+		{ "zappend", { "zappend /z.lfz \"first\"", "zappend /z.lfz \"second\"" } },
+		{ "mv/rm", { "mkdir /d", "mv /copy.bin /d/moved.bin", "rm /d/moved.bin", "rm -r /d" } },
+		{ "mv dir", { "mkdir /e", "tee /e/f \"in e\"", "mv /e /g", "mv /g/f /g/h", "rm /g/h", "rm -r /g" } },
+		{ "wipe", { "wipe -f" } },
+	};
+	for (const Scenario& scenario : scenarios) {
+		run("wear -r");
+		LittleFS.flash = FlashCounters();
+		for (const char* cmd : scenario.cmds) {
+			run(cmd);
+			CHECK(!hasError());
+		}
+		run("sync");
+		unsigned int program = 0, erases = 0, commits = 0;
+		std::string table = run("wear");
+		size_t total = table.find("total");
+		CHECK(total != std::string::npos && sscanf(table.c_str() + total, "total %*u %*u %u %u %u", &program, &erases, &commits) == 3);
+		const FlashCounters& flash = LittleFS.flash;
+		unsigned int programCounted = flash.programBytes + flash.inlineBytes, erasesCounted = flash.eraseOps - flash.compactions;
+		printf("  %-8s program %6u / %6u, erases %2u / %2u, commits %2u / %2u (estimated / counted), %u bytes per commit\n", scenario.name,
+			program, programCounted, erases, erasesCounted, commits, flash.metaCommits,
+			(unsigned int)((flash.metaProgramBytes - flash.inlineBytes) / std::max(flash.metaCommits, 1u)));
+		CHECK(!flash.faults);
+		CHECK(commits == flash.metaCommits);
+		CHECK(erases <= erasesCounted && erases + 1 >= erasesCounted);
+		CHECK(program <= programCounted && programCounted - program <= erasesCounted * (LittleFS.bd.cfg.prog_size + 32));
+	}
+}
+
+// LFSEClient against the explorer in machine mode over a pty, as it talks to a device: requests pipelined
+// right after ones with a payload are answered as commands of their own
+static void testClientPty() {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	CHECK(master >= 0 && !grantpt(master) && !unlockpt(master));
+	int slave = master >= 0 ? open(ptsname(master), O_RDWR | O_NOCTTY) : -1;
+	CHECK(slave >= 0);
+	termios tty;
+	if (slave < 0 || tcgetattr(slave, &tty)) {
+		close(master);
+		return;
+	}
+	cfmakeraw(&tty);
+	tcsetattr(slave, TCSANOW, &tty);
+
+	run("mkdir /pty");
+	std::string archive = tarHeader("a.txt", 5) + tarBody("hello");
+	archive += std::string(10240 - archive.size(), '\0');
+	std::string oldData = pseudoRandom(3000, 4);
+	std::string newData = oldData.substr(0, 2000) + "changed" + oldData.substr(2100);
+	CHECK(writeFile("/pty/f", oldData));
+	std::string sig = run("sig /pty/f 128");
+	FILE* fSig = fmemopen(&sig[0], sig.size(), "r");
+	std::string delta;
+	size_t nCopied = 0;
+	CHECK(fSig && makeDelta(fSig, std::vector<uint8_t>(newData.begin(), newData.end()), delta, nCopied));
+	if (fSig)
+		fclose(fSig);
+
+	std::vector<LFSEClient::Response> responses;
+	std::atomic<bool> done(false);
+	std::thread client([&] {
+		LFSEClient lfse;
+		lfse.openFd(master);
+		lfse.maxInFlightBytes = 64 * 1024; // everything is sent ahead of the responses
+		responses = lfse.run({ { "tar -x /pty", archive }, { "ls /pty" }, { "patch /pty/f", delta }, { "pwd" }, { "nosuchcmd" } });
+		done = true;
+	});
+	Serial.fd = slave;
+	while (!done) {
+		if (Serial.available())
+			DEBUG::LittleFSExplorer("");
+		else
+			usleep(1000);
+	}
+	client.join();
+	Serial.fd = -1;
+	close(slave);
+
+	CHECK(responses.size() == 5);
+	if (responses.size() != 5)
+		return;
+	CHECK(responses[0].status == LFSEFrameWriter::STATUS_OK);
+	CHECK(responses[1].status == LFSEFrameWriter::STATUS_OK && responses[1].out.find("a.txt") != std::string::npos);
+	CHECK(responses[2].status == LFSEFrameWriter::STATUS_OK);
+	CHECK(responses[3].status == LFSEFrameWriter::STATUS_OK && responses[3].out == "/\r\n");
+	CHECK(responses[4].status == LFSEFrameWriter::STATUS_NOT_FOUND);
+	std::string patched;
+	CHECK(readFile("/pty/f", patched) && patched == newData);
+}
+
+// A record is never split between segments, so one longer than a segment is rejected rather than growing the ring
+static void testRlogRecordLength() {
+	run("rlog create /r 400");
+	run(("rlog append -n /r \"" + std::string(100, 'a') + "\"").c_str());
+	CHECK(!hasError());
+	run(("rlog append -n /r \"" + std::string(101, 'b') + "\"").c_str());
+	CHECK(hasError());
+	CHECK(run("rlog cat /r") == std::string(100, 'a'));
+}
+
+// The hint of ls names everything needed for the next page, so that it can be sent back as is from any directory
+static void testLsPaging() {
+	run("mkdir /d");
+	CHECK(writeFile("/d/a", std::string(300, 'a')));
+	CHECK(writeFile("/d/b", std::string(200, 'b')));
+	CHECK(writeFile("/d/c", std::string(100, 'c')));
+	run("mkdir /other");
+	run("cd /other");
+	std::string listing = run("ls -S /d --limit 1");
+	CHECK(!hasError());
+	CHECK(listing.find(" a\r\n") != std::string::npos);
+	size_t hint = listing.find("-- more: ");
+	CHECK(hint != std::string::npos);
+	std::string next = listing.substr(hint + 9, listing.find('\r', hint) - hint - 9);
+	CHECK(next == "ls -S --after a --limit 1 /d");
+	listing = run(next.c_str());
+	CHECK(!hasError());
+	CHECK(listing.find(" b\r\n") != std::string::npos && listing.find(" a\r\n") == std::string::npos);
+	CHECK(listing.find("-- more: ls -S --after b --limit 1 /d") != std::string::npos);
+	listing = run("ls --limit 2 /d");
+	CHECK(listing.find("-- more: ls --after b --limit 2 /d") != std::string::npos);
+	// --top K lists K entries and that's all that was asked for
+	listing = run("ls -S --top 1 /d");
+	CHECK(!hasError());
+	CHECK(listing.find(" a\r\n") != std::string::npos && listing.find("-- more") == std::string::npos);
+}
+
+struct Test {
+	const char* name;
+	std::function<void()> run;
+};
+static const Test _tests[] = {
+	{ "tar-roundtrip", testTarRoundTrip },
+	{ "tar-missing-parents", testTarMissingParents },
+	{ "tar-bad-magic", testTarBadMagic },
+	{ "tar-record-padding", testTarRecordPadding },
+	{ "tar-drain-on-failure", testTarDrainOnFailure },
+	{ "patch-roundtrip", testPatchRoundTrip },
+	{ "patch-drain-on-failure", testPatchDrainOnFailure },
+	{ "tee-z-drain-on-failure", testTeeCompressedDrainOnFailure },
+	{ "zappend-refill", testZappendRefill },
+	{ "zappend-torn", testZappendTorn },
+	{ "kv-open-log", testKvOpenLog },
+	{ "flash-rules", testFlashRules },
+	{ "wear-estimate", testWearEstimate },
+	{ "client-pty", testClientPty },
+	{ "rlog-record-length", testRlogRecordLength },
+	{ "ls-paging", testLsPaging },
+};
+
+int main(int argc, char** argv) {
+	char root[] = "/tmp/lfsetest.XXXXXX";
+	if (!mkdtemp(root)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	LittleFS.setRoot(root);
+	LittleFS.begin();
+	int nFailed = 0;
+	for (const Test& test : _tests) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc; ++i)
+			selected |= !strcmp(argv[i], test.name);
+		if (!selected)
+			continue;
+		// every test starts with an empty filesystem and fresh state of the explorer
+		run("wipe -f");
+		run("cd /");
+		_failed = false;
+		test.run();
+		printf("%s %s\n", _failed ? "FAIL" : "ok  ", test.name);
+		nFailed += _failed;
+	}
+	LittleFS.format();
+	rmdir(root);
+	return nFailed;
+}
@@ -0,0 +1,105 @@
+// Host-side counterpart of the explorer's compressed transfer (cat -z, tee -z, tar -z).
+// Build: g++ -std=c++11 -O2 -I../../src lfsez.cpp ../../src/lfsecodec.cpp -o lfsez
+//
+//   lfsez -c <in> <out>       compress
+//   lfsez -d <in> <out>       decompress
+//   lfsez -b <files...>       print ratio and throughput of both directions for each file
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "lfsecodec.h"
+
+static bool readFile(const char* path, std::string& data) {
+	FILE* f = fopen(path, "rb");
+	if (!f)
+		return false;
+	char buffer[4096];
+	size_t nBytes;
+	while ((nBytes = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		data.append(buffer, nBytes);
+	fclose(f);
+	return true;
+}
+static bool writeFile(const char* path, const std::string& data) {
+	FILE* f = fopen(path, "wb");
+	if (!f)
+		return false;
+	fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+	return true;
+}
+
+static void appendSink(void* ctx, const uint8_t* data, size_t size) {
+	static_cast<std::string*>(ctx)->append(reinterpret_cast<const char*>(data), size);
+}
+struct Cursor {
+	const std::string* data;
+	size_t pos;
+};
+static int cursorSource(void* ctx) {
+	Cursor* cursor = static_cast<Cursor*>(ctx);
+	return cursor->pos < cursor->data->size() ? (uint8_t)(*cursor->data)[cursor->pos++] : -1;
+}
+
+static std::string compress(const std::string& data) {
+	std::string res;
+	LFSELzEncoder encoder;
+	encoder.begin(appendSink, &res);
+	encoder.write(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	encoder.finish();
+	return res;
+}
+static bool decompress(const std::string& data, std::string& res) {
+	Cursor cursor = { &data, 0 };
+	LFSELzDecoder decoder;
+	decoder.begin(cursorSource, &cursor);
+	int c;
+	while ((c = decoder.read()) >= 0)
+		res += (char)c;
+	return decoder.isFinished();
+}
+
+static int benchmark(int nFiles, char** paths) {
+	printf("%-24s %10s %10s %7s %10s %10s\n", "file", "size", "packed", "ratio", "enc MB/s", "dec MB/s");
+	for (int i = 0; i < nFiles; ++i) {
+		std::string data, packed, unpacked;
+		if (!readFile(paths[i], data) || data.empty())
+			continue;
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point t0 = Clock::now();
+		packed = compress(data);
+		Clock::time_point t1 = Clock::now();
+		bool ok = decompress(packed, unpacked) && unpacked == data;
+		Clock::time_point t2 = Clock::now();
+		double encSeconds = std::chrono::duration<double>(t1 - t0).count();
+		double decSeconds = std::chrono::duration<double>(t2 - t1).count();
+		const char* name = strrchr(paths[i], '/') ? strrchr(paths[i], '/') + 1 : paths[i];
+		printf("%-24s %10zu %10zu %6.2fx %10.1f %10.1f%s\n", name, data.size(), packed.size(),
+			(double)data.size() / packed.size(), data.size() / encSeconds / 1e6, data.size() / decSeconds / 1e6,
+			ok ? "" : "  ROUNDTRIP FAILED");
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc >= 3 && !strcmp(argv[1], "-b"))
+		return benchmark(argc - 2, argv + 2);
+	std::string in, out;
+	if (argc != 4 || !readFile(argv[2], in)) {
+		fprintf(stderr, "usage: %s -c|-d <in> <out> | -b <files...>\n", argv[0]);
+		return 2;
+	}
+	if (!strcmp(argv[1], "-c")) {
+		out = compress(in);
+	} else if (!strcmp(argv[1], "-d")) {
+		if (!decompress(in, out)) {
+			fprintf(stderr, "%s: truncated stream\n", argv[2]);
+			return 1;
+		}
+	} else {
+		return 2;
+	}
+	return writeFile(argv[3], out) ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include "lfsecodec.h"
+#include <string.h>
+
+void LFSELzEncoder::begin(Sink sink, void* ctx) {
+	_sink = sink;
+	_ctx = ctx;
+	_nIn = _nOut = 0;
+	_cursor = _end = 0;
+	_groupLength = 1;
+	_nTokens = 0;
+	_group[0] = 0;
+}
+void LFSELzEncoder::write(const uint8_t* data, size_t size) {
+	_nIn += size;
+	while (size--) {
+		if (_end == sizeof(_buffer)) { // keep only the window before the lookahead
+			uint16_t shift = _cursor - LFSE_LZ_WINDOW_LENGTH;
+			memmove(_buffer, _buffer + shift, _end - shift);
+			_cursor -= shift;
+			_end -= shift;
+		}
+		_buffer[_end++] = *data++;
+		if (_end - _cursor == LFSE_LZ_MAX_MATCH)
+			encodeToken();
+	}
+}
+void LFSELzEncoder::finish() {
+	while (_cursor < _end)
+		encodeToken();
+	putToken(true, 0, LFSE_LZ_END_CODE);
+	flushGroup();
+}
+// Emits the longest match at cursor (or a literal) and moves cursor past it
+void LFSELzEncoder::encodeToken() {
+	uint16_t lookLength = _end - _cursor;
+	uint16_t maxDistance = _cursor < LFSE_LZ_WINDOW_LENGTH ? _cursor : LFSE_LZ_WINDOW_LENGTH;
+	uint16_t bestLength = 0, bestDistance = 0;
+	const uint8_t* look = _buffer + _cursor;
+	for (uint16_t distance = 1; distance <= maxDistance; ++distance) {
+		const uint8_t* candidate = look - distance;
+		if (candidate[bestLength] != look[bestLength] || candidate[0] != look[0])
+			continue;
+		uint16_t length = 1;
+		while (length < lookLength && candidate[length] == look[length]) // may overlap lookahead
+			++length;
+		if (length > bestLength) {
+			bestLength = length;
+			bestDistance = distance;
+			if (length == lookLength)
+				break;
+		}
+	}
+	if (bestLength >= LFSE_LZ_MIN_MATCH) {
+		putToken(true, bestDistance - 1, bestLength - LFSE_LZ_MIN_MATCH);
+		_cursor += bestLength;
+	} else {
+		putToken(false, _buffer[_cursor++], 0);
+	}
+}
+void LFSELzEncoder::putToken(bool isMatch, uint8_t b0, uint8_t b1) {
+	if (isMatch)
+		_group[0] |= 1 << _nTokens;
+	_group[_groupLength++] = b0;
+	if (isMatch)
+		_group[_groupLength++] = b1;
+	if (++_nTokens == 8)
+		flushGroup();
+}
+void LFSELzEncoder::flushGroup() {
+	if (!_nTokens)
+		return;
+	_sink(_ctx, _group, _groupLength);
+	_nOut += _groupLength;
+	_group[0] = 0;
+	_groupLength = 1;
+	_nTokens = 0;
+}
+
+void LFSELzDecoder::begin(Source source, void* ctx) {
+	_source = source;
+	_ctx = ctx;
+	memset(_window, 0, sizeof(_window));
+	_windowCursor = 0;
+	restart();
+}
+void LFSELzDecoder::restart() {
+	_matchDistance = _matchLeft = 0;
+	_flags = _nFlags = 0;
+	_finished = false;
+}
+int LFSELzDecoder::read() {
+	if (_matchLeft) {
+		--_matchLeft;
+		return push(_window[(uint16_t)(_windowCursor - _matchDistance) % LFSE_LZ_WINDOW_LENGTH]);
+	}
+	if (_finished)
+		return -1;
+	if (!_nFlags) {
+		int flags = _source(_ctx);
+		if (flags < 0)
+			return -1;
+		_flags = flags;
+		_nFlags = 8;
+	}
+	bool isMatch = _flags & 1;
+	_flags >>= 1;
+	--_nFlags;
+	int b0 = _source(_ctx);
+	if (b0 < 0)
+		return -1;
+	if (!isMatch)
+		return push(b0);
+	int b1 = _source(_ctx);
+	if (b1 < 0)
+		return -1;
+	if (b1 == LFSE_LZ_END_CODE) {
+		_finished = true;
+		return -1;
+	}
+	_matchDistance = b0 + 1;
+	_matchLeft = b1 + LFSE_LZ_MIN_MATCH;
+	return read();
+}
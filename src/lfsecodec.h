@@ -0,0 +1,75 @@
+#ifndef LFSECODEC_H__
+#define LFSECODEC_H__
+
+// Small footprint streaming LZSS codec shared by the explorer and host-side tools (see extras/),
+// so this header must not depend on Arduino.
+//
+// Stream format: groups of a flags byte followed by up to 8 tokens, flag bits go from LSB,
+// 0 stands for a literal byte, 1 for a match of two bytes: distance - 1 and length - LFSE_LZ_MIN_MATCH.
+// A match with length byte LFSE_LZ_END_CODE marks the end of the stream
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LFSE_LZ_WINDOW_LENGTH 256 // distance fits a byte
+#define LFSE_LZ_MIN_MATCH 3
+#define LFSE_LZ_MAX_MATCH 64
+#define LFSE_LZ_END_CODE 0xff
+
+// Fixed RAM (~600 bytes), data is searched for matches in the last LFSE_LZ_WINDOW_LENGTH bytes.
+// Plain struct, so that it can be placed into the arena, call begin() before use
+struct LFSELzEncoder {
+	typedef void (*Sink)(void* ctx, const uint8_t* data, size_t size);
+
+	void begin(Sink sink, void* ctx);
+	void write(const uint8_t* data, size_t size);
+	void finish(); // encodes everything left and marks the end of the stream
+
+	uint32_t _nIn;
+	uint32_t _nOut;
+private:
+	Sink _sink;
+	void* _ctx;
+	// history window followed by lookahead, shifted down when full
+	uint8_t _buffer[2 * LFSE_LZ_WINDOW_LENGTH + LFSE_LZ_MAX_MATCH];
+	uint16_t _cursor; // first byte of lookahead
+	uint16_t _end; // end of lookahead
+	uint8_t _group[1 + 8 * 2];
+	uint8_t _groupLength;
+	uint8_t _nTokens;
+
+	void encodeToken();
+	void putToken(bool isMatch, uint8_t b0, uint8_t b1);
+	void flushGroup();
+};
+
+// Pulls compressed bytes from the source on demand, so it decodes straight into the consumer.
+// Fixed RAM (~270 bytes), call begin() before use
+struct LFSELzDecoder {
+	typedef int (*Source)(void* ctx); // next byte or -1
+
+	void begin(Source source, void* ctx);
+	void restart(); // gets ready for the next stream, keeps the window
+	int read(); // next decoded byte, -1 at the end of the stream or if the source ran dry
+	bool isFinished() const { return _finished; }
+	uint16_t pending() const { return _matchLeft; } // bytes that can be decoded without the source
+	// byte decoded back bytes ago (1 is the last one), up to LFSE_LZ_WINDOW_LENGTH
+	uint8_t history(uint16_t back) const { return _window[(uint16_t)(_windowCursor - back) % LFSE_LZ_WINDOW_LENGTH]; }
+private:
+	Source _source;
+	void* _ctx;
+	uint8_t _window[LFSE_LZ_WINDOW_LENGTH];
+	uint16_t _windowCursor;
+	uint16_t _matchDistance;
+	uint16_t _matchLeft;
+	uint8_t _flags;
+	uint8_t _nFlags;
+	bool _finished;
+
+	uint8_t push(uint8_t c) {
+		_window[_windowCursor++ % LFSE_LZ_WINDOW_LENGTH] = c;
+		return c;
+	}
+};
+
+#endif // LFSECODEC_H__
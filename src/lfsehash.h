@@ -0,0 +1,70 @@
+#ifndef LFSEHASH_H__
+#define LFSEHASH_H__
+
+// Checksums and delta format shared by the explorer and host-side tools (see extras/),
+// so this header must not depend on Arduino
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LFSE_FNV64_OFFSET 0xcbf29ce484222325ULL
+#define LFSE_FNV64_PRIME 0x100000001b3ULL
+
+// Delta stream consumed by patch, all numbers are little endian:
+// magic "LFD1", u16 block size, then ops until the end op
+#define LFSE_DELTA_MAGIC "LFD1"
+#define LFSE_DELTA_OP_COPY 'C' // u32 index of the block of the old file
+#define LFSE_DELTA_OP_LITERAL 'L' // u16 length followed by the bytes
+#define LFSE_DELTA_OP_END 'E' // u64 strong checksum of the whole new file
+
+// Weak rsync-style checksum of a window, which can be moved by one byte in O(1):
+// a is the sum of the bytes, b is the sum of the prefix sums
+struct LFSERollingChecksum {
+	uint16_t a = 0;
+	uint16_t b = 0;
+	uint32_t length = 0;
+
+	void reset() {
+		a = b = 0;
+		length = 0;
+	}
+	// appends data to the window
+	void update(const uint8_t* data, size_t size) {
+		for (size_t i = 0; i < size; ++i) {
+			a += data[i];
+			b += a;
+		}
+		length += size;
+	}
+	// moves the window one byte forward
+	void roll(uint8_t out, uint8_t in) {
+		a += in - out;
+		b += a - length * out;
+	}
+	uint32_t value() const { return (uint32_t)b << 16 | a; }
+};
+
+// Strong (FNV-1a 64) checksum, can be computed over several calls by passing the previous result
+inline uint64_t lfseFnv64(const uint8_t* data, size_t size, uint64_t hash = LFSE_FNV64_OFFSET) {
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= LFSE_FNV64_PRIME;
+	}
+	return hash;
+}
+
+// CRC-32 (IEEE) with a 16 entries table, can be computed over several calls by passing the previous result
+inline uint32_t lfseCrc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+	};
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc = table[(crc ^ data[i]) & 0x0f] ^ (crc >> 4);
+		crc = table[(crc ^ (data[i] >> 4)) & 0x0f] ^ (crc >> 4);
+	}
+	return ~crc;
+}
+
+#endif // LFSEHASH_H__
@@ -1,9 +1,9 @@
 #include "lfsexplorer.h"
 
-std::map<String, cmdInfo> DEBUG::lfseCmdMap = {
+std::map<String, cmdInfo, cmdMapLess> DEBUG::lfseCmdMap = {
 	cmdMapEntry("help", cmdInfo(cmdHelp, "", "show help message")),
 	cmdMapEntry("wipe", cmdInfo(cmdFormat, "-f", "delete all data from the filesystem")),
-	cmdMapEntry("ls", cmdInfo(cmdLs, "[dirpath]", "list children files/directories")),
+	cmdMapEntry("ls", cmdInfo(cmdLs, "[-S|-t|-n] [--top K] [--after name] [--limit N] [dirpath]", "list children files/directories")),
 	cmdMapEntry("cd", cmdInfo(cmdCd, "[dirpath]", "change current working directory")),
 	cmdMapEntry("pwd", cmdInfo(cmdPwd, "", "show current working directory")),
 	cmdMapEntry("mkdir", cmdInfo(cmdMkdir, "[dirname]", "create directory (not recursive)")),
@@ -11,233 +11,641 @@ std::map<String, cmdInfo> DEBUG::lfseCmdMap = {
 	cmdMapEntry("rm", cmdInfo(cmdRm, "[path]", "remove file/directory")),
 	cmdMapEntry("cp", cmdInfo(cmdCp, "[path_src] [path_dst]", "copy file/directory")),
 	cmdMapEntry("touch", cmdInfo(cmdTouch, "[filepath]", "create empty file")),
-	cmdMapEntry("tee", cmdInfo(cmdWrite, "[\"content_args\"] [filepath]", "(over)write arguments' content to file")),
-	cmdMapEntry("cat", cmdInfo(cmdCat, "[filepath]", "print content of the file")),
+	cmdMapEntry("tee", cmdInfo(cmdWrite, "[-c|-z] [\"content_args\"] [filepath]", "(over)write arguments' content to file (-c: only the changed part, -z: compressed content from Serial)")),
+	cmdMapEntry("cat", cmdInfo(cmdCat, "[-z] [filepath]", "print content of the file (-z: raw content compressed)")),
+	cmdMapEntry("dd", cmdInfo(cmdDd, "if=filepath [of=filepath] [bs=N] [skip=N] [seek=N] [count=N]", "copy byte range of file to output or into another file")),
+	cmdMapEntry("cmp", cmdInfo(cmdCmp, "[filepath1] [filepath2]", "print the first byte and line where the files differ")),
+	cmdMapEntry("diff", cmdInfo(cmdDiff, "[filepath1] [filepath2]", "print lines that differ between the files")),
 	cmdMapEntry("man", cmdInfo(cmdMan, "[command]", "show manual for command")),
+	cmdMapEntry("mem", cmdInfo(cmdMem, "", "show heap and command arena usage")),
+	cmdMapEntry("df", cmdInfo(cmdDf, "", "show filesystem block usage")),
+	cmdMapEntry("fsinfo", cmdInfo(cmdFsinfo, "[-v]", "show filesystem parameters (-v: analyze files and fragmentation)")),
+	cmdMapEntry("find", cmdInfo(cmdFind, "[dirpath] [-name pattern] [-size [+|-]N[k|M]] [-newer time|filepath] [-type f|d] [-delete] [-print0]", "list entries of the tree matching all predicates, optionally removing them")),
+	cmdMapEntry("tar", cmdInfo(cmdTar, "-c|-x [-z] [dirpath]", "write directory tree as ustar archive or extract one from Serial (-z: compressed)")),
+	cmdMapEntry("zwrite", cmdInfo(cmdZwrite, "[-n] [--from filepath] [filepath] [\"content_args\"]", "(over)write content to compressed LFZ file")),
+	cmdMapEntry("zappend", cmdInfo(cmdZappend, "[-n] [--from filepath] [filepath] [\"content_args\"]", "append content to compressed LFZ file")),
+	cmdMapEntry("sig", cmdInfo(cmdSig, "[filepath] [blocksize]", "print weak and strong checksums of file blocks")),
+	cmdMapEntry("patch", cmdInfo(cmdPatch, "[filepath]", "rebuild file from the delta stream received from Serial")),
+	cmdMapEntry("kv", cmdInfo(cmdKv, "get|set|del|list|compact|stat|bench [key|n] [\"value\"|size]", "key-value store in an append-only log")),
+	cmdMapEntry("rlog", cmdInfo(cmdRlog, "create|append|cat [-n] [dirpath] [size|\"content_args\"]", "size-bounded log kept in rotated segment files")),
+	cmdMapEntry("sync", cmdInfo(cmdSync, "[-s]", "sync files kept open by tee -a (-s: show handle cache stats)")),
+	cmdMapEntry("changes", cmdInfo(cmdChanges, "[--since seq]", "print changes journaled after seq, or the range of seqs kept")),
+	cmdMapEntry("scrub", cmdInfo(cmdScrub, "[-tN] [-s|-l|-r]", "check file CRCs for N ms, resuming where the last step stopped (-s: status, -l: findings, -r: reset)")),
+	cmdMapEntry("wear", cmdInfo(cmdWear, "[-r]", "show estimated flash wear per command (-r: reset counters)")),
 };
 LFSEPath DEBUG::lfsePath;
 char DEBUG::lfseBuffer[LFSE_SERIAL_BUFFER_LENGTH];
+Print* DEBUG::lfseOut = &_UART_;
+Print* DEBUG::lfseErr = &_UART_;
+LFSEArena DEBUG::lfseArena;
+LFSEFileWriter DEBUG::lfseRedirectWriter;
+LFSEWearStats DEBUG::lfseWear[LFSE_WEAR_MAX_COMMANDS];
+LFSEWearStats* DEBUG::lfseWearCurrent = &DEBUG::lfseWear[LFSE_WEAR_MAX_COMMANDS - 1];
+uint32_t DEBUG::lfseWearBlockSize = 0;
+LFSEKVStore DEBUG::lfseKV;
+LFSEFrameWriter DEBUG::lfseFrame;
+LFSEHandleCache DEBUG::lfseHandles;
+LFSEJournal DEBUG::lfseJournal;
+LFSEScrubState DEBUG::lfseScrub;
+bool DEBUG::lfseScrubDirty = false;
+uint32_t DEBUG::lfseScrubSavedAt = 0;
 
-void DEBUG::cmdHelp(LFSECommand& cmd) {
-	LOGLN(F("The following commands are available for execution:"));
+bool DEBUG::cmdHelp(LFSECommand& cmd) {
+	OUTLN(F("The following commands are available for execution:"));
 	for (const cmdMapEntry& cmdEntry : lfseCmdMap) {
-		LOG(cmdEntry.first);
-		LOG(F(" "));
-		LOG(std::get<1>(cmdEntry.second));
-		LOG(F("\t"));
-		LOGLN(std::get<2>(cmdEntry.second));
+		OUT(cmdEntry.first);
+		OUT(F(" "));
+		OUT(std::get<1>(cmdEntry.second));
+		OUT(F("\t"));
+		OUTLN(std::get<2>(cmdEntry.second));
 	}
+	return true;
 }
-void DEBUG::cmdFormat(LFSECommand& cmd) {
-	if (!LittleFS.format()) {
+bool DEBUG::cmdFormat(LFSECommand& cmd) {
+	if (!fsFormat()) {
 		LOGLN(F("Formatting filesystem failed!"));
+		return false;
 	}
+	return true;
 }
-void DEBUG::cmdPwd(LFSECommand& cmd) {
-	LOGLN(lfsePath.toString());
+bool DEBUG::cmdPwd(LFSECommand& cmd) {
+	OUTLN(lfsePath.c_str());
+	return true;
 }
-void DEBUG::cmdLs(LFSECommand& cmd) {
+bool DEBUG::cmdLs(LFSECommand& cmd) {
 	cmd.parseArgs();
-	String userPath;
-	if (cmd._args.size()) {
-		userPath = cmd.getArgFirstFilenameOrLastArg();
+	const LFSECommand::Arg* topArg = cmd.takeLongFlagValue("top");
+	const LFSECommand::Arg* afterArg = cmd.takeLongFlagValue("after");
+	const LFSECommand::Arg* limitArg = cmd.takeLongFlagValue("limit");
+	if (topArg && (afterArg || limitArg)) {
+		LOGLN(F("ls: --top cannot be combined with --after/--limit"));
+		return false;
+	}
+	LsOrder order = LsOrder::NONE;
+	if (cmd.isSingleLetterFlagPresent('n'))
+		order = LsOrder::NAME;
+	if (cmd.isSingleLetterFlagPresent('t'))
+		order = LsOrder::TIME;
+	if (cmd.isSingleLetterFlagPresent('S'))
+		order = LsOrder::SIZE;
+	uint16_t limit = 0;
+	if (topArg || limitArg) {
+		limit = strtoul((topArg ? topArg : limitArg)->c_str(), nullptr, 10);
+		if (!limit) {
+			LOGLN(F("ls: --top/--limit should be a positive number"));
+			return false;
+		}
+	}
+	if (topArg && order == LsOrder::NONE)
+		order = LsOrder::NAME;
+	const char* cursor = afterArg ? afterArg->c_str() : nullptr;
+
+	const char* userPath = "";
+	if (cmd.countArgs(LFSECommand::Arg::Type::FILENAME)) {
+		userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
 		if (checkInvalidDirPath(userPath))
-			return;
+			return false;
 	}
-	String dirPath(lfsePath.createAdjustedFromUserPath(userPath).toString());
-	if (checkDoesntExist(dirPath))
-		return;
+	LFSEPath dirPath;
+	if (checkPathTooLong(userPath, dirPath) || checkDoesntExist(dirPath))
+		return false;
 	Dir dir = LittleFS.openDir(dirPath);
+	if (order == LsOrder::NONE)
+		return lsUnsorted(dir, dirPath, cursor, limit);
+	// --top K asks for K entries and no more, the other pages are offered to be listed
+	return lsSorted(dir, dirPath, order, cursor, limit ? limit : LFSE_LS_DEFAULT_LIMIT, !topArg);
+}
+// Prints the command that lists the next page, with the absolute directory path so that it works from anywhere
+void DEBUG::lsPrintMore(const LFSEPath& dirPath, LsOrder order, const char* after, uint16_t limit) {
+	OUT(F("-- more: ls "));
+	if (order != LsOrder::NONE) {
+		OUT('-');
+		OUT(order == LsOrder::SIZE ? 'S' : (order == LsOrder::TIME ? 't' : 'n'));
+		OUT(' ');
+	}
+	OUT(F("--after "));
+	OUT(after);
+	OUT(F(" --limit "));
+	OUT(limit);
+	OUT(' ');
+	OUTLN(dirPath.c_str());
+}
+// Streams entries in Dir order, starting right after the cursor entry
+bool DEBUG::lsUnsorted(Dir& dir, const LFSEPath& dirPath, const char* cursor, uint16_t limit) {
+	bool cursorFound = !cursor;
+	uint16_t nPrinted = 0;
+	LsEntry entry;
+	while (dir.next()) {
+		String name = dir.fileName();
+		if (!cursorFound) {
+			cursorFound = name.equals(cursor);
+			continue;
+		}
+		if (limit && nPrinted >= limit) {
+			lsPrintMore(dirPath, LsOrder::NONE, entry.name, limit);
+			return true;
+		}
+		strncpy(entry.name, name.c_str(), LFSE_NAME_MAX_LENGTH);
+		entry.name[LFSE_NAME_MAX_LENGTH] = '\0';
+		entry.size = dir.fileSize();
+		entry.time = dir.fileCreationTime();
+		entry.type = dir.isFile() ? 'f' : (dir.isDirectory() ? 'd' : '-');
+		lsPrintEntry(entry);
+		++nPrinted;
+	}
+	if (!cursorFound) {
+		LOG(cursor);
+		LOGLN(F(" not found"));
+	}
+	return cursorFound;
+}
+// Keeps the first `limit` entries (in the requested order) that go after the cursor
+// in a bounded max-heap, so memory stays O(limit) regardless of directory size
+bool DEBUG::lsSorted(Dir& dir, const LFSEPath& dirPath, LsOrder order, const char* cursor, uint16_t limit, bool paged) {
+	LsEntry cursorEntry;
+	if (cursor) {
+		LFSEPath cursorPath(dirPath);
+		if (!cursorPath.pushToken(cursor, strlen(cursor)) || checkDoesntExist(cursorPath))
+			return false;
+		File f = LittleFS.open(cursorPath, "r");
+		strncpy(cursorEntry.name, cursor, LFSE_NAME_MAX_LENGTH);
+		cursorEntry.name[LFSE_NAME_MAX_LENGTH] = '\0';
+		cursorEntry.size = f.isFile() ? f.size() : 0;
+		cursorEntry.time = f.getCreationTime();
+		f.close();
+	}
+	static_assert(LFSE_LS_DEFAULT_LIMIT * sizeof(LsEntry) <= LFSE_ARENA_LENGTH / 2, "default ls page doesn't fit the arena");
+	auto before = [order](const LsEntry& lhs, const LsEntry& rhs) { return lsBefore(lhs, rhs, order); };
+	std::vector<LsEntry, LFSEArenaAllocator<LsEntry>> heap;
+	heap.reserve(limit);
+	uint32_t nCandidates = 0;
+	LsEntry entry;
 	while (dir.next()) {
-		LOG(dir.isFile() ? F("f ") : (dir.isDirectory() ? F("d ") : F("- ")));
-		const size_t nCharFS = LOG(dir.fileSize());
-		for (uint8_t i = 0; i < max(6 - nCharFS, (unsigned int)0); ++i)
-			LOG(' ');
-		const size_t nCharCT = LOG(dir.fileCreationTime());
-		for (uint8_t i = 0; i < max(10 - nCharCT, (unsigned int)0); ++i)
-			LOG(' ');
-		LOGLN(dir.fileName());
+		String name = dir.fileName();
+		strncpy(entry.name, name.c_str(), LFSE_NAME_MAX_LENGTH);
+		entry.name[LFSE_NAME_MAX_LENGTH] = '\0';
+		entry.size = dir.fileSize();
+		entry.time = dir.fileCreationTime();
+		entry.type = dir.isFile() ? 'f' : (dir.isDirectory() ? 'd' : '-');
+		if (cursor && !before(cursorEntry, entry))
+			continue;
+		++nCandidates;
+		if (heap.size() < limit) {
+			heap.push_back(entry);
+			std::push_heap(heap.begin(), heap.end(), before);
+		} else if (before(entry, heap.front())) {
+			std::pop_heap(heap.begin(), heap.end(), before);
+			heap.back() = entry;
+			std::push_heap(heap.begin(), heap.end(), before);
+		}
 	}
+	std::sort_heap(heap.begin(), heap.end(), before);
+	for (const LsEntry& e : heap)
+		lsPrintEntry(e);
+	if (paged && nCandidates > heap.size())
+		lsPrintMore(dirPath, order, heap.back().name, limit);
+	return true;
+}
+// Biggest/newest first for SIZE/TIME, ties (and NAME order) are resolved by name
+bool DEBUG::lsBefore(const LsEntry& lhs, const LsEntry& rhs, LsOrder order) {
+	if (order == LsOrder::SIZE && lhs.size != rhs.size)
+		return lhs.size > rhs.size;
+	if (order == LsOrder::TIME && lhs.time != rhs.time)
+		return lhs.time > rhs.time;
+	return strcmp(lhs.name, rhs.name) < 0;
 }
-void DEBUG::cmdCd(LFSECommand& cmd) {
+inline static void _lsPrintPadded(Print* out, uint32_t value, uint8_t width) {
+	uint8_t nChars = out->print(value);
+	do {
+		out->print(' ');
+	} while (++nChars < width);
+}
+void DEBUG::lsPrintEntry(const LsEntry& entry) {
+	OUT(entry.type);
+	OUT(' ');
+	_lsPrintPadded(lfseOut, entry.size, 6);
+	_lsPrintPadded(lfseOut, entry.time, 10);
+	OUTLN(entry.name);
+}
+bool DEBUG::cmdCd(LFSECommand& cmd) {
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd))
-		return;
-	String userPath(cmd.getArgFirstFilenameOrLastArg());
-	if (checkInvalidDirPath(userPath) || checkDoesntExist(userPath))
-		return;
-	lfsePath.adjust(userPath);
+		return false;
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
+	LFSEPath dirPath;
+	if (checkInvalidDirPath(userPath) || checkPathTooLong(userPath, dirPath) || checkDoesntExist(dirPath))
+		return false;
+	lfsePath = dirPath;
+	return true;
 }
-void DEBUG::cmdMkdir(LFSECommand& cmd) {
+bool DEBUG::cmdMkdir(LFSECommand& cmd) {
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd))
-		return;
-	String userPath(cmd.getArgFirstFilenameOrLastArg());
+		return false;
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
 	if (checkInvalidDirPath(userPath)) 
-		return;
-	String dirPath(lfsePath.createAdjustedFromUserPath(userPath).toString());
-	if (checkAlreadyExists(dirPath))
-		return;
-	if (!LittleFS.mkdir(dirPath)) {
+		return false;
+	LFSEPath dirPath;
+	if (checkPathTooLong(userPath, dirPath) || checkAlreadyExists(dirPath))
+		return false;
+	if (!fsMkdir(dirPath)) {
 		LOG(F("Failed to create directory "));
 		LOGLN(dirPath);
-		return;
+		return false;
 	}
+	return true;
 }
-void DEBUG::cmdMv(LFSECommand& cmd) {
+bool DEBUG::cmdMv(LFSECommand& cmd) {
 	// TODO: handle dot in path properly to keep the name
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd, 2))
-		return;
-	uint8_t filePath1ArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
-	String userPath1(cmd._args[filePath1ArgIdx]);
-	String userPath2(cmd.getArgFirstFilenameOrLastArg(filePath1ArgIdx + 1));
-	if (checkInvalidFilePath(userPath1) || checkInvalidFilePath(userPath2))
-		return;
-	String path1 = lfsePath.createAdjustedFromUserPath(userPath1).toString();
-	String path2 = lfsePath.createAdjustedFromUserPath(userPath2).toString();
-	if (checkDoesntExist(path1) || checkAlreadyExists(path2))
-		return;
-	if (!LittleFS.rename(path1, path2)) {
+		return false;
+	// the last filename is the destination, all the filenames before are sources
+	uint8_t dstArgIdx = cmd.getArgLastFilenameIdx();
+	uint8_t srcArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
+	const char* userPathFrom = cmd._args[srcArgIdx].c_str();
+	const char* userPathTo = cmd._args[dstArgIdx].c_str();
+	if (cmd.countArgs(LFSECommand::Arg::Type::FILENAME) == 2 && !isGlobPattern(userPathFrom)) {
+		if (checkInvalidFilePath(userPathFrom) || checkInvalidFilePath(userPathTo))
+			return false;
+		LFSEPath pathFrom, pathTo;
+		if (checkPathTooLong(userPathFrom, pathFrom) || checkPathTooLong(userPathTo, pathTo) || checkDoesntExist(pathFrom) || checkAlreadyExists(pathTo))
+			return false;
+		return mvPath(pathFrom, pathTo);
+	}
+	// multiple sources go into the destination directory
+	LFSEPath dirTo;
+	if (checkNotADir(userPathTo, dirTo))
+		return false;
+	bool ok = true;
+	for (uint8_t i = srcArgIdx; i < dstArgIdx; ++i) {
+		if (!cmd._args[i].isTypeFilename())
+			continue;
+		bool matched = forEachPathMatch(cmd._args[i].c_str(), [&](const LFSEPath& pathFrom) {
+			LFSEPath pathTo(dirTo);
+			if (!pathTo.pushToken(pathFrom.name(), strlen(pathFrom.name()))) {
+				LOG(F("Path too long: "));
+				LOGLN(pathFrom.name());
+				ok = false;
+				return;
+			}
+			if (checkAlreadyExists(pathTo) || !mvPath(pathFrom, pathTo))
+				ok = false;
+		});
+		ok = ok && matched;
+	}
+	return ok;
+}
+bool DEBUG::mvPath(const LFSEPath& pathFrom, const LFSEPath& pathTo) {
+	if (!fsRename(pathFrom, pathTo)) {
 		LOG(F("Failed to move from "));
-		LOG(path1);
+		LOG(pathFrom);
 		LOG(F(" to "));
-		LOGLN(path2);
-		return;
+		LOGLN(pathTo);
+		return false;
 	}
+	return true;
 }
-void DEBUG::cmdCp(LFSECommand& cmd) {
+
+bool DEBUG::cmdCp(LFSECommand& cmd) {
 	// TODO: handle dot in path properly to keep the name
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd, 2))
-		return;
-	uint8_t filePath1ArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
-	String userPath1(cmd._args[filePath1ArgIdx]);
-	String userPath2(cmd.getArgFirstFilenameOrLastArg(filePath1ArgIdx + 1));
+		return false;
+	// the last filename is the destination, all the filenames before are sources
+	uint8_t dstArgIdx = cmd.getArgLastFilenameIdx();
+	uint8_t srcArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
+	const char* userPathSrc = cmd._args[srcArgIdx].c_str();
+	const char* userPathDst = cmd._args[dstArgIdx].c_str();
 	
 	bool copyDir = cmd.isSingleLetterFlagPresent('r');
 	bool copyForce = cmd.isSingleLetterFlagPresent('f');
 
-	if (copyDir) {
-		if (checkInvalidFilePath(userPath1) || checkInvalidFilePath(userPath2))
-			return;
-	} else {
-		if (checkInvalidDirPath(userPath1) || checkInvalidDirPath(userPath2))
-			return;
+	if (cmd.countArgs(LFSECommand::Arg::Type::FILENAME) == 2 && !isGlobPattern(userPathSrc)) {
+		if (copyDir) {
+			if (checkInvalidDirPath(userPathSrc) || checkInvalidDirPath(userPathDst))
+				return false;
+		} else {
+			if (checkInvalidFilePath(userPathSrc) || checkInvalidFilePath(userPathDst))
+				return false;
+		}
+		LFSEPath pathSrc, pathDst;
+		if (checkPathTooLong(userPathSrc, pathSrc) || checkPathTooLong(userPathDst, pathDst) || checkDoesntExist(pathSrc) || (!copyForce && checkAlreadyExists(pathDst)))
+			return false;
+		return cpFile(pathSrc, pathDst, copyDir);
 	}
-
-	String path1 = lfsePath.createAdjustedFromUserPath(userPath1).toString();
-	String path2 = lfsePath.createAdjustedFromUserPath(userPath2).toString();
-	if (checkDoesntExist(path1) || (copyForce && checkAlreadyExists(path2)))
-		return;
-
-	File f = LittleFS.open(path1, "r");
+	// multiple sources go into the destination directory
+	LFSEPath dirDst;
+	if (checkNotADir(userPathDst, dirDst))
+		return false;
+	bool ok = true;
+	for (uint8_t i = srcArgIdx; i < dstArgIdx; ++i) {
+		if (!cmd._args[i].isTypeFilename())
+			continue;
+		bool matched = forEachPathMatch(cmd._args[i].c_str(), [&](const LFSEPath& pathSrc) {
+			LFSEPath pathDst(dirDst);
+			if (!pathDst.pushToken(pathSrc.name(), strlen(pathSrc.name()))) {
+				LOG(F("Path too long: "));
+				LOGLN(pathSrc.name());
+				ok = false;
+				return;
+			}
+			if ((!copyForce && checkAlreadyExists(pathDst)) || !cpFile(pathSrc, pathDst, copyDir))
+				ok = false;
+		});
+		ok = ok && matched;
+	}
+	return ok;
+}
+bool DEBUG::cpFile(const LFSEPath& pathSrc, const LFSEPath& pathDst, bool copyDir) {
+	File f = LittleFS.open(pathSrc, "r");
 	bool isDir = f.isDirectory();
 	f.close();
 	
 	// requested to copy dirs
 	if (copyDir) {
 		if (!isDir) {
-			LOG(path1);
+			LOG(pathSrc);
 			LOGLN(F(" is not a directory"));
-			return;
+			return false;
 		}
 		LOGLN(F("Not implemented yet!")); // TODO: implement
-		return;
+		return false;
 	}
 	// requested to copy files
 	if (isDir) {
-		LOG(path1);
+		LOG(pathSrc);
 		LOGLN(F(" is not a file"));
-		return;
+		return false;
 	}
 
-	File fsrc = LittleFS.open(path1, "r");
+	File fsrc = LittleFS.open(pathSrc, "r");
 	if (!fsrc) {
 		LOG(F("Failed to open file "));
-		LOGLN(path1);
-		return;
+		LOGLN(pathSrc);
+		return false;
 	}
-	File fdst = LittleFS.open(path2, "w");
-	if (!fsrc) {
+	LFSEFile fdst = fsOpen(pathDst, "w");
+	if (!fdst) {
 		LOG(F("Failed to open file "));
-		LOGLN(path2);
-		return;
+		LOGLN(pathDst);
+		return false;
 	}
 
 	char buffer[LFSE_FILE_BUFFER_LENGTH];
 	while (fsrc.available()) {
 		size_t nBytes = fsrc.readBytes(buffer, LFSE_FILE_BUFFER_LENGTH);
 		fdst.write(buffer, nBytes);
+		wearAddLogical(nBytes);
 	}
+	return true;
 }
-void DEBUG::cmdTouch(LFSECommand& cmd) {
+bool DEBUG::cmdTouch(LFSECommand& cmd) {
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd))
-		return;
-	String userPath(cmd.getArgFirstFilenameOrLastArg());
+		return false;
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
 	if (checkInvalidFilePath(userPath)) 
-		return;
-	String filePath(lfsePath.createAdjustedFromUserPath(userPath).toString());
-	if (checkAlreadyExists(filePath))
-		return;
-	File f = LittleFS.open(filePath, "w");
+		return false;
+	LFSEPath filePath;
+	if (checkPathTooLong(userPath, filePath) || checkAlreadyExists(filePath))
+		return false;
+	LFSEFile f = fsOpen(filePath, "w");
 	if (!f) {
 		LOG(F("Failed to create file "));
 		LOGLN(filePath);
-		return;
+		return false;
 	}
 	f.close();
+	return true;
+}
+// Reads the input until it goes quiet, so that the rest of failed binary transfer isn't taken for commands
+inline static void _drainInput(Stream& in, uint8_t* buffer, size_t length) {
+	while (in.readBytes(reinterpret_cast<char*>(buffer), length));
 }
-void DEBUG::cmdWrite(LFSECommand& cmd) {
+// Same for failures before there's a buffer to read into
+inline static void _drainInput(Stream& in) {
+	uint8_t buffer[64];
+	_drainInput(in, buffer, sizeof(buffer));
+}
+bool DEBUG::cmdWrite(LFSECommand& cmd) {
 	cmd.parseArgs();
-	if (checkMissingOperand(cmd))
-		return;
+	// compressed content follows the command line, it mustn't be taken for commands if it can't be written
+	bool compressed = cmd.isSingleLetterFlagPresent('z');
+	if (checkMissingOperand(cmd)) {
+		if (compressed)
+			_drainInput(_UART_);
+		return false;
+	}
 	uint8_t filePathArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
-	String userPath(cmd._args[filePathArgIdx]);
-	if (checkInvalidFilePath(userPath)) 
-		return;
-	String filePath(lfsePath.createAdjustedFromUserPath(userPath).toString());
+	const char* userPath = cmd._args[filePathArgIdx].c_str();
+	LFSEPath filePath;
+	if (checkInvalidFilePath(userPath) || checkPathTooLong(userPath, filePath)) {
+		if (compressed)
+			_drainInput(_UART_);
+		return false;
+	}
 
 	// get flags
 	bool append = cmd.isSingleLetterFlagPresent('a');
 	bool newLines = !cmd.isSingleLetterFlagPresent('n');
+	if (cmd.isSingleLetterFlagPresent('c') && !append)
+		return writeChanged(cmd, filePathArgIdx, filePath, newLines);
+	// plain appends keep the file open for the next ones, see LFSEHandleCache
+	if (append && !compressed) {
+		LFSEFile* f = lfseHandles.openAppend(filePath);
+		if (!f) {
+			LOG(F("Failed to open file "));
+			LOGLN(filePath);
+			return false;
+		}
+		if (checkIsADir(*f, filePath)) {
+			lfseHandles.invalidate(filePath);
+			return false;
+		}
+		if (!writeArgs(*f, cmd, filePathArgIdx, newLines)) {
+			LOGLN(F("Missing data to write"));
+			return false;
+		}
+		lfseHandles.markWritten();
+		return true;
+	}
 
-	File f = LittleFS.open(filePath, append ? "a" : "w+");
+	LFSEFile f = fsOpen(filePath, append ? "a" : "w+");
 	if (!f) {
 		LOG(F("Failed to open file "));
 		LOGLN(filePath);
-		return;
+		if (compressed)
+			_drainInput(_UART_);
+		return false;
 	}
 	if (f.isDirectory()) {
 		if (checkIsADir(f, filePath)) {
 			f.close();
-			return;
+			if (compressed)
+				_drainInput(_UART_);
+			return false;
+		}
+	}
+
+	// content comes compressed from Serial right after the command line
+	if (compressed) {
+		LFSELzStream lzIn;
+		if (!lzIn.begin(&_UART_)) {
+			f.close();
+			_drainInput(_UART_);
+			return false;
 		}
+		uint8_t* buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_FILE_PAGE_LENGTH));
+		if (!buffer)
+			_drainInput(_UART_);
+		while (size_t nBytes = buffer ? lzIn.readBytes(reinterpret_cast<char*>(buffer), LFSE_FILE_PAGE_LENGTH) : 0) {
+			f.write(buffer, nBytes);
+			wearAddLogical(nBytes);
+		}
+		f.close();
+		bool finished = buffer && lzIn.isFinished();
+		if (buffer && !finished) {
+			LOGLN(F("tee: compressed stream ended unexpectedly"));
+			_drainInput(_UART_, buffer, LFSE_FILE_PAGE_LENGTH);
+		}
+		lfseArena.deallocate(buffer, LFSE_FILE_PAGE_LENGTH);
+		lzIn.end();
+		return finished;
 	}
 
-	// iterate over all string args that go before the filename arg
+	bool dirty = writeArgs(f, cmd, filePathArgIdx, newLines);
+	f.close();
+	if (!dirty) {
+		LOGLN(F("Missing data to write"));
+		return false;
+	}
+	return true;
+}
+// Writes all string args that go after the filename arg, returns false if there are none
+bool DEBUG::writeArgs(Print& f, LFSECommand& cmd, uint8_t firstArgIdx, bool newLines) {
 	bool dirty = false;
-	for (uint8_t i = filePathArgIdx; i < cmd._args.size(); ++i) {
+	for (uint8_t i = firstArgIdx; i < cmd._args.size(); ++i) {
 		LFSECommand::Arg& arg = cmd._args[i];
 		if (arg.isTypeString()) {
 			dirty = true;
+			f.write(arg.value.c_str(), arg.value.length());
+			wearAddLogical(arg.value.length());
 			if (newLines)
-				f.println(arg.value);
-			else
-				f.print(arg.value);
+				wearAddLogical(f.println());
 		}
 	}
-	f.close();
-	if (!dirty) {
+	return dirty;
+}
+bool DEBUG::cmdSync(LFSECommand& cmd) {
+	cmd.parseArgs();
+	lfseHandles.sync();
+	if (!cmd.isSingleLetterFlagPresent('s'))
+		return true;
+	uint32_t nLookups = lfseHandles._nHits + lfseHandles._nMisses;
+	OUTF("hits: %u / %u", (unsigned int)lfseHandles._nHits, (unsigned int)nLookups);
+	if (nLookups)
+		OUTF(" (%u%%)", (unsigned int)(100ULL * lfseHandles._nHits / nLookups));
+	OUTLN();
+	OUTF("evictions: %u\r\nsyncs: %u\r\n", (unsigned int)lfseHandles._nEvictions, (unsigned int)lfseHandles._nSyncs);
+	for (const LFSEHandleCache::Entry& entry : lfseHandles._entries) {
+		if (entry.file) {
+			OUT(F("open: "));
+			OUTLN(entry.file.fullName());
+		}
+	}
+	return true;
+}
+// Compares the content with the file first and writes only from the first differing byte on,
+// so that re-applying the same content doesn't touch flash
+bool DEBUG::writeChanged(LFSECommand& cmd, uint8_t firstArgIdx, const LFSEPath& filePath, bool newLines) {
+	size_t length = 0;
+	for (uint8_t i = firstArgIdx; i < cmd._args.size(); ++i) {
+		if (cmd._args[i].isTypeString())
+			length += cmd._args[i].value.length() + (newLines ? 2 : 0);
+	}
+	if (!length) {
 		LOGLN(F("Missing data to write"));
+		return false;
+	}
+	lfseHandles.invalidate(filePath);
+	bool exists = LittleFS.exists(filePath);
+	File fOld;
+	if (exists) {
+		fOld = LittleFS.open(filePath, "r");
+		if (checkIsADir(fOld, filePath))
+			return false;
+	}
+	char* content = static_cast<char*>(lfseArena.allocate(length, 1));
+	if (!content)
+		return false;
+	size_t pos = 0;
+	for (uint8_t i = firstArgIdx; i < cmd._args.size(); ++i) {
+		LFSECommand::Arg& arg = cmd._args[i];
+		if (!arg.isTypeString())
+			continue;
+		memcpy(content + pos, arg.value.c_str(), arg.value.length());
+		pos += arg.value.length();
+		if (newLines) {
+			content[pos++] = '\r';
+			content[pos++] = '\n';
+		}
+	}
+
+	uint32_t oldSize = fOld ? fOld.size() : 0;
+	size_t firstDiff = 0;
+	uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+	while (fOld && firstDiff < length) {
+		size_t nBytes = fOld.read(buffer, min(length - firstDiff, (size_t)LFSE_FILE_BUFFER_LENGTH));
+		size_t i = 0;
+		while (i < nBytes && buffer[i] == (uint8_t)content[firstDiff + i])
+			++i;
+		firstDiff += i;
+		if (!nBytes || i < nBytes)
+			break;
+	}
+	fOld.close();
+
+	size_t nWritten = 0;
+	if (firstDiff < length || oldSize != length) {
+		LFSEFile f = fsOpen(filePath, exists ? "r+" : "w");
+		if (!f || !f.seek(firstDiff)) {
+			LOG(F("Failed to open file "));
+			LOGLN(filePath);
+			lfseArena.deallocate(content, length);
+			return false;
+		}
+		nWritten = f.write(reinterpret_cast<const uint8_t*>(content + firstDiff), length - firstDiff);
+		if (oldSize > length)
+			f.truncate(length);
+		f.close();
+		wearAddLogical(nWritten);
 	}
+	lfseArena.deallocate(content, length);
+	OUTF("%u of %u bytes written\r\n", (unsigned int)nWritten, (unsigned int)length);
+	return true;
 }
 
-void DEBUG::cmdRm(LFSECommand& cmd) {
+// Moves file cursor right after the nLines-th '\n' (or to the end of file)
+inline static void skipLines(File& f, uint16_t nLines) {
+	char buffer[LFSE_FILE_BUFFER_LENGTH];
+	while (nLines) {
+		size_t pos = f.position();
+		size_t nBytes = f.readBytes(buffer, LFSE_FILE_BUFFER_LENGTH);
+		if (!nBytes)
+			return;
+		for (size_t i = 0; i < nBytes; ++i) {
+			if (buffer[i] == '\n' && !--nLines) {
+				f.seek(pos + i + 1);
+				return;
+			}
+		}
+	}
+}
+bool DEBUG::cmdRm(LFSECommand& cmd) {
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd))
-		return;
+		return false;
 	
 	bool removeDir = cmd.isSingleLetterFlagPresent('r');
 	// if these flags are present, command removes lines in file
@@ -246,23 +654,28 @@ void DEBUG::cmdRm(LFSECommand& cmd) {
 	if (lastIdx > -1) {
 		if (removeDir) {
 			LOGLN(F("Flags l and r are incompatible"));
-			return;
+			return false;
 		}
 		if (firstIdx > -1 && firstIdx > lastIdx) {
 			LOGLN(F("-l should be >= than -f"));
-			return;
+			return false;
 		}
 	}
 
-	String userPath(cmd.getArgFirstFilenameOrLastArg());
-	if (removeDir ? checkInvalidDirPath(userPath) : checkInvalidFilePath(userPath))
-		return;
-
-	String path = lfsePath.createAdjustedFromUserPath(userPath).toString();
-	if (checkDoesntExist(path))
-		return;
-
-	File file = LittleFS.open(path, "r+");
+	bool ok = true;
+	for (const LFSECommand::Arg& arg : cmd._args) {
+		if (!arg.isTypeFilename())
+			continue;
+		bool matched = forEachPathMatch(arg.c_str(), [&](const LFSEPath& path) {
+			if (!rmPath(path, removeDir, firstIdx, lastIdx))
+				ok = false;
+		});
+		ok = ok && matched;
+	}
+	return ok;
+}
+bool DEBUG::rmPath(const LFSEPath& path, bool removeDir, int16_t firstIdx, int16_t lastIdx) {
+	File file = LittleFS.open(path, "r");
 	bool isDir = file.isDirectory();
 	file.close();
 
@@ -271,648 +684,3943 @@ void DEBUG::cmdRm(LFSECommand& cmd) {
 		if (!removeDir) {
 			LOG(path);
 			LOGLN(F(" is not a file"));
-			return;
+			return false;
 		}
-		if (!LittleFS.rmdir(path)) {
+		if (!fsRmdir(path)) {
 			LOG(F("Failed to remove directory "));
 			LOGLN(path);
+			return false;
 		}
-		return;
+		return true;
 	}
 	if (removeDir) {
 		LOG(path);
 		LOGLN(F(" is not a directory"));
-		return;
+		return false;
 	}
 
 	// Removing lines from file
 	if (lastIdx > -1) {
-		// LOGLN("Not implemented yet!");
 		uint16_t lineFirstIdx = firstIdx > -1 ? firstIdx : lastIdx;
-		uint16_t lineLastIdx = lastIdx;
-
-		DLOG(lineFirstIdx);
-		LOG(" ");
-		LOGLN(lineLastIdx);
-
-		File f = LittleFS.open(path, "r+");		
-		// first determine cursor pos where the second part should be copied to
-		uint16_t lineIdx = 0;
-		while (f.available() && lineIdx < lineFirstIdx) {
-			DLOGLN(lineIdx);
-			// char c = '\0';
-			// while (c != '\n') {
-			// 	c = (char)f.read();
-			// 	DLOGLN(c);
-			// }
-			f.readStringUntil('\n');
-			++lineIdx;
+		LFSEFile f = fsOpen(path, "r+");
+		skipLines(f, lineFirstIdx);
+		size_t writeCursor = f.position();
+		skipLines(f, lastIdx - lineFirstIdx + 1);
+		size_t readCursor = f.position();
+		if (readCursor == writeCursor) {
+			f.close();
+			return true;
 		}
-		size_t insertCursor = f.position();
-		DLOGLN(insertCursor);
-		while (f.available() && lineIdx <= lineLastIdx) {
-			String line = f.readStringUntil('\n');
-			DLOGLN(line);
-
-			size_t curPos = f.position();
-			DLOGLN(curPos);
-
-			f.seek(insertCursor);
-
-			insertCursor += f.println(line);
-			DLOGLN(insertCursor);
-
-			f.seek(curPos);
-			++lineIdx;
+		wearAddLogical(readCursor - writeCursor);
+		// shift the tail of the file over the removed lines
+		char* buffer = static_cast<char*>(lfseArena.allocate(LFSE_FILE_PAGE_LENGTH));
+		while (buffer) {
+			f.seek(readCursor);
+			size_t nBytes = f.readBytes(buffer, LFSE_FILE_PAGE_LENGTH);
+			if (!nBytes)
+				break;
+			f.seek(writeCursor);
+			f.write(buffer, nBytes);
+			readCursor += nBytes;
+			writeCursor += nBytes;
 		}
-		// f.truncate(insertCursor);
+		lfseArena.deallocate(buffer, LFSE_FILE_PAGE_LENGTH);
+		f.truncate(writeCursor);
 		f.close();
-		return;
+		return true;
 	}
 
 	// Removing file
-	if (!LittleFS.remove(path)) {
+	if (!fsRemove(path)) {
 		LOG(F("Failed to remove file "));
 		LOGLN(path);
+		return false;
 	}
-	return;
+	return true;
 }
-void DEBUG::cmdCat(LFSECommand& cmd) {
-	// TODO: too long function, better split into semantic parts!
+
+bool DEBUG::cmdCat(LFSECommand& cmd) {
 	cmd.parseArgs();
 	if (checkMissingOperand(cmd))
-		return;
-	String userPath(cmd.getArgFirstFilenameOrLastArg());
-	if (checkInvalidFilePath(userPath)) 
-		return;
-	String filePath(lfsePath.createAdjustedFromUserPath(userPath).toString());
-	if (checkDoesntExist(filePath))
-		return;
-
-	File f = LittleFS.open(filePath, "r");
-	if (!f) {
-		LOG(F("Failed to open file "));
-		LOGLN(filePath);
-		return;
-	}
-	if (checkIsADir(f, filePath)) {
-		f.close();
-		return;
-	}
+		return false;
 	
 	// get flags
 	// TODO: it'd be nice to have numerical flags and distinguish them positionally
-	bool lineNumbers = cmd.isSingleLetterFlagPresent('n');
-	bool byteView = cmd.isSingleLetterFlagPresent('b');
-	bool plainMode = cmd.isSingleLetterFlagPresent('p');
-	uint16_t limitColumn = cmd.getNumericalFlagValue('c', byteView ? 16 : 128);
+	CatOptions opts;
+	opts.lineNumbers = cmd.isSingleLetterFlagPresent('n');
+	opts.byteView = cmd.isSingleLetterFlagPresent('b');
+	opts.plainMode = cmd.isSingleLetterFlagPresent('p');
+	opts.limitColumn = cmd.getNumericalFlagValue('c', opts.byteView ? 16 : 128);
 	bool flagF = cmd.isSingleLetterFlagPresent('f');
 	bool flagL = cmd.isSingleLetterFlagPresent('l');
-	uint16_t rowIdxFirst = cmd.getNumericalFlagValue('f', 0);
-	uint16_t rowIdxLast = cmd.getNumericalFlagValue('l', 0);
+	opts.rowIdxFirst = cmd.getNumericalFlagValue<uint32_t>('f', 0);
+	opts.rowIdxLast = cmd.getNumericalFlagValue<uint32_t>('l', 0);
 
-	if (!limitColumn) {
+	if (!opts.limitColumn) {
 		LOGLN(F("cat: -c cannot be 0"));
-		return;
+		return false;
 	}
-	if (!byteView && plainMode) {
+	if (!opts.byteView && opts.plainMode) {
 		LOGLN(F("cat: -p ignored because -b is missing"));	
 	}
-	if (byteView && plainMode && lineNumbers) {
+	if (opts.byteView && opts.plainMode && opts.lineNumbers) {
 		LOGLN(F("cat: -n ignored because -bp are present"));	
 	}
 	if (flagF && flagL) {
-		if (rowIdxFirst > rowIdxLast) {
+		if (opts.rowIdxFirst > opts.rowIdxLast) {
 			LOGLN(F("cat: -l cannot be smaller than -f"));
-			return;
+			return false;
 		}
-		if (rowIdxFirst == rowIdxLast) {
-			++rowIdxLast;
+		if (opts.rowIdxFirst == opts.rowIdxLast) {
+			++opts.rowIdxLast;
 		}
 	}
 
+	if (cmd.isSingleLetterFlagPresent('z'))
+		return catCompressed(cmd);
 
-	String bufString;
-	if (byteView && plainMode) { // here we don't care about line breaks
-		uint16_t byteIdxFirst = rowIdxFirst;
-		uint16_t byteIdxLast = rowIdxLast;
+	LFSEString bufString(opts.limitColumn + 2); // readLine may need 2 extra chars for CRLF
+	if (bufString.capacity() < opts.limitColumn + 2u) {
+		LOGLN(F("cat: not enough memory for -c"));
+		return false;
+	}
+	bool ok = true;
+	for (const LFSECommand::Arg& arg : cmd._args) {
+		if (!arg.isTypeFilename())
+			continue;
+		bool matched = forEachPathMatch(arg.c_str(), [&](const LFSEPath& path) {
+			if (!catFile(path, opts, bufString))
+				ok = false;
+		});
+		ok = ok && matched;
+	}
+	return ok;
+}
+// Sends raw content of all the matched files as a single compressed stream
+bool DEBUG::catCompressed(LFSECommand& cmd) {
+	LFSELzPrint lzOut;
+	if (!lzOut.begin(lfseOut))
+		return false;
+	lfseOut = &lzOut;
+	uint8_t* buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_FILE_BUFFER_LENGTH));
+	bool ok = buffer;
+	for (const LFSECommand::Arg& arg : cmd._args) {
+		if (!arg.isTypeFilename() || !buffer)
+			continue;
+		bool matched = forEachPathMatch(arg.c_str(), [&](const LFSEPath& path) {
+			File f = LittleFS.open(path, "r");
+			if (!f || checkIsADir(f, path)) {
+				ok = false;
+				return;
+			}
+			while (size_t nBytes = f.read(buffer, LFSE_FILE_BUFFER_LENGTH))
+				lfseOut->write(buffer, nBytes);
+			f.close();
+		});
+		ok = ok && matched;
+	}
+	lfseArena.deallocate(buffer, LFSE_FILE_BUFFER_LENGTH);
+	lzOut.end();
+	lfseOut = lzOut._out;
+	return ok;
+}
+bool DEBUG::catFile(const LFSEPath& filePath, const CatOptions& opts, LFSEString& bufString) {
+	File f = LittleFS.open(filePath, "r");
+	if (!f) {
+		LOG(F("Failed to open file "));
+		LOGLN(filePath);
+		return false;
+	}
+	if (checkIsADir(f, filePath)) {
+		f.close();
+		return false;
+	}
+	// LFZ files are decompressed on the fly
+	LFSELzFileReader lzFile;
+	if (lzFile.open(f)) {
+		catContent(lzFile, opts, bufString);
+		lzFile.close();
+	} else {
+		f.seek(0);
+		catContent(f, opts, bufString);
+	}
+	f.close();
+	return true;
+}
+bool DEBUG::catSkipLines(File& f, uint32_t nLines) {
+	while (nLines-- && f.available())
+		readLine(f, nullptr, 0);
+	return true;
+}
+template <typename FileLike>
+void DEBUG::catContent(FileLike& f, const CatOptions& opts, LFSEString& bufString) {
+	// TODO: too long function, better split into semantic parts!
+	if (opts.byteView && opts.plainMode) { // here we don't care about line breaks
+		uint32_t byteIdxFirst = opts.rowIdxFirst;
+		uint32_t byteIdxLast = opts.rowIdxLast;
 		if (byteIdxFirst) {
 			f.seek(byteIdxFirst);
-			LOGLN(F("...>>"));
+			OUTLN(F("...>>"));
 		}
-		size_t byteCursor = byteIdxFirst;
+		uint32_t byteCursor = byteIdxFirst;
 		while (f.available() && (!byteIdxLast || (byteCursor < byteIdxLast))) {
-			readChars(f, &bufString, limitColumn);
+			readChars(f, &bufString, opts.limitColumn);
 			for (const char& c : bufString) {
 				if (byteIdxLast && (byteCursor >= byteIdxLast)) { // subtraction is safe as (bool)byteIdxLast == true
-					LOGLN("");
+					OUTLN("");
 					byteCursor = byteIdxLast; // break while loop
 					break;
 				}
-				LOGF("%02x", c);
+				OUTF("%02x", (uint8_t)c);
 				++byteCursor;
-				LOG(byteCursor % limitColumn ? F(" ") : F("\r\n"));
+				OUT(byteCursor % opts.limitColumn ? F(" ") : F("\r\n"));
 			}
 		}
 	} else { // here we count lines
-		uint16_t lineIdx = 0;
-		while (f.available() && (!rowIdxLast || lineIdx < rowIdxLast)) {
-			if (lineIdx < rowIdxFirst) {
-				readLine(f, nullptr, 0); // simply skip the line
-				if (lineIdx == 0)
-					LOGLN(F("...>>"));
-				++lineIdx;
-				continue;
-			}
-			if (lineNumbers) {
-				LOG(lineIdx);
-				LOG(F("\t"));
+		uint32_t lineIdx = 0;
+		if (opts.rowIdxFirst && f.available()) {
+			catSkipLines(f, opts.rowIdxFirst);
+			OUTLN(F("...>>"));
+			lineIdx = opts.rowIdxFirst;
+		}
+		while (f.available() && (!opts.rowIdxLast || lineIdx < opts.rowIdxLast)) {
+			if (opts.lineNumbers) {
+				OUT(lineIdx);
+				OUT(F("\t"));
 			}
-			bool completeLine = readLine(f, &bufString, limitColumn, nullptr, byteView);
-			if (byteView) {
-				for (uint16_t i = 0; i < limitColumn && i < bufString.length(); ++i) {
-					LOGF("%02x", bufString[i]);
-					LOG(F(" "));
+			bool completeLine = readLine(f, &bufString, opts.limitColumn, nullptr, opts.byteView);
+			if (opts.byteView) {
+				for (uint16_t i = 0; i < opts.limitColumn && i < bufString.length(); ++i) {
+					OUTF("%02x", (uint8_t)bufString[i]);
+					OUT(F(" "));
 				}
 			} else {
-				LOG(bufString);
+				OUT(bufString.c_str());
 			}
-			if ((!completeLine && f.available()) || (bufString.length() > limitColumn)) {
-				LOG(F(" ->..."));
+			if ((!completeLine && f.available()) || (bufString.length() > opts.limitColumn)) {
+				OUT(F(" ->..."));
 			}
 			if (!completeLine)
 				readLine(f, nullptr, 0); // skip the line
 			++lineIdx;
-			LOGLN("");
+			OUTLN("");
 		}
 	}
 	if (f.available()) {
-		LOGLN(F("<<..."));
+		OUTLN(F("<<..."));
 	}
-	f.close();
 }
-void DEBUG::cmdMan(LFSECommand& cmd) {
+// Copies count blocks of bs bytes starting skip blocks into the input file, straight to the output,
+// or into the output file seek blocks from its start. The output file is patched in place, never truncated
+bool DEBUG::cmdDd(LFSECommand& cmd) {
 	cmd.parseArgs();
-	if (checkMissingOperand(cmd))
-		return;
-}
-
+	// operands like "if=path" come as two args: the name and the value
+	const char* names[] = { "if", "of", "bs", "skip", "seek", "count" };
+	const char* values[sizeof(names) / sizeof(names[0])] = {};
+	for (size_t i = 0; i + 1 < cmd._args.size(); ++i) {
+		for (uint8_t j = 0; j < sizeof(names) / sizeof(names[0]); ++j) {
+			if (cmd._args[i].isTypeFilename() && !strcmp(cmd._args[i].c_str(), names[j])) {
+				values[j] = cmd._args[++i].c_str();
+				break;
+			}
+		}
+	}
+	const char* inPath = values[0];
+	const char* outPath = values[1];
+	uint32_t numbers[4] = { LFSE_DD_BLOCK_LENGTH, 0, 0, UINT32_MAX }; // bs, skip, seek, count
+	for (uint8_t j = 2; j < sizeof(names) / sizeof(names[0]); ++j) {
+		if (!values[j])
+			continue;
+		char* end;
+		numbers[j - 2] = strtoul(values[j], &end, 10);
+		if (*end || !isDigit(values[j][0])) {
+			LOGF("dd: invalid number %s=%s\r\n", names[j], values[j]);
+			return false;
+		}
+	}
+	uint32_t blockSize = numbers[0];
+	if (!inPath) {
+		LOGLN(F("Missing operand"));
+		return false;
+	}
+	if (!blockSize) {
+		LOGLN(F("dd: bs cannot be 0"));
+		return false;
+	}
+	if ((uint64_t)numbers[1] * blockSize > UINT32_MAX || (uint64_t)numbers[2] * blockSize > UINT32_MAX) {
+		LOGLN(F("dd: offset doesn't fit 32 bits"));
+		return false;
+	}
+	uint32_t inOffset = numbers[1] * blockSize;
+	uint32_t outOffset = numbers[2] * blockSize;
+	uint32_t nLeft = (uint64_t)numbers[3] * blockSize > UINT32_MAX ? UINT32_MAX : numbers[3] * blockSize;
 
-inline static void _checkIsA(const String& path, const String& type) {
-	LOG(path);
-	LOG(F(" is a "));
-	LOGLN(type);
-}
-bool DEBUG::checkIsAFile(const File& f, const String& path) {
-	if (f.isDirectory())
+	LFSEPath inFilePath, outFilePath;
+	if (checkInvalidFilePath(inPath) || checkPathTooLong(inPath, inFilePath) || checkDoesntExist(inFilePath))
 		return false;
-	_checkIsA(path, F("file"));
-	return true;
+	File fIn = LittleFS.open(inFilePath, "r");
+	if (checkIsADir(fIn, inFilePath))
+		return false;
+	LFSEFile fOut;
+	if (outPath) {
+		if (checkInvalidFilePath(outPath) || checkPathTooLong(outPath, outFilePath))
+			return false;
+		if (!strcmp(inFilePath, outFilePath)) {
+			LOGLN(F("dd: if and of should be different files"));
+			return false;
+		}
+		bool exists = LittleFS.exists(outFilePath);
+		fOut = fsOpen(outFilePath, exists ? "r+" : "w");
+		if (!fOut || checkIsADir(fOut, outFilePath))
+			return false;
+		if (!fOut.seek(outOffset)) {
+			LOGF("dd: cannot seek to %u in %s\r\n", (unsigned int)outOffset, outFilePath.c_str());
+			return false;
+		}
+	}
+	uint8_t* buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_FILE_PAGE_LENGTH));
+	if (!buffer)
+		return false;
+	uint32_t nCopied = 0;
+	bool ok = true;
+	if (inOffset < fIn.size() && fIn.seek(inOffset)) {
+		while (nLeft) {
+			size_t nBytes = fIn.read(buffer, min(nLeft, (uint32_t)LFSE_FILE_PAGE_LENGTH));
+			if (!nBytes)
+				break;
+			size_t nWritten = outPath ? fOut.write(buffer, nBytes) : lfseOut->write(buffer, nBytes);
+			nCopied += nWritten;
+			nLeft -= nBytes;
+			if (nWritten != nBytes) {
+				LOGLN(F("dd: write failed"));
+				ok = false;
+				break;
+			}
+		}
+	}
+	lfseArena.deallocate(buffer, LFSE_FILE_PAGE_LENGTH);
+	fIn.close();
+	if (outPath) {
+		fOut.close();
+		wearAddLogical(nCopied);
+		// the output is free for the summary only when the data went into a file
+		OUTF("%u bytes copied\r\n", (unsigned int)nCopied);
+	}
+	return ok;
 }
-bool DEBUG::checkIsADir(const File& f, const String& path) {
-	if (f.isFile())
+
+bool DEBUG::openFilePair(LFSECommand& cmd, LFSEPath paths[2], File files[2]) {
+	if (checkMissingOperand(cmd, 2))
 		return false;
-	_checkIsA(path, F("directory"));
+	uint8_t argIdx = 0;
+	for (uint8_t i = 0; i < 2; ++i) {
+		argIdx = cmd.getArgFirstFilenameOrLastArgIdx(i ? argIdx + 1 : 0);
+		const char* userPath = cmd._args[argIdx].c_str();
+		if (checkInvalidFilePath(userPath) || checkPathTooLong(userPath, paths[i]) || checkDoesntExist(paths[i]))
+			return false;
+		files[i] = LittleFS.open(paths[i], "r");
+		if (checkIsADir(files[i], paths[i]))
+			return false;
+	}
 	return true;
 }
-bool DEBUG::checkMissingOperand(LFSECommand& cmd, uint8_t nRequiredArgs, LFSECommand::Arg::Type requiredType) {
-	if (cmd._args.size() >= nRequiredArgs) {
-		uint8_t correctArgs = 0;
-		for (const LFSECommand::Arg& arg : cmd._args) {
-			if (arg.type == requiredType)
-				++correctArgs;
+// Compares the files page by page, only the first difference is reported, nothing if they're equal
+bool DEBUG::cmdCmp(LFSECommand& cmd) {
+	cmd.parseArgs();
+	LFSEPath paths[2];
+	File files[2];
+	if (!openFilePair(cmd, paths, files))
+		return false;
+	uint8_t* buffers = static_cast<uint8_t*>(lfseArena.allocate(2 * LFSE_FILE_PAGE_LENGTH));
+	if (!buffers)
+		return false;
+	uint8_t* bufferA = buffers;
+	uint8_t* bufferB = buffers + LFSE_FILE_PAGE_LENGTH;
+	uint32_t offset = 0, line = 1;
+	while (true) {
+		size_t nBytesA = files[0].read(bufferA, LFSE_FILE_PAGE_LENGTH);
+		size_t nBytesB = files[1].read(bufferB, LFSE_FILE_PAGE_LENGTH);
+		size_t nBytes = min(nBytesA, nBytesB);
+		size_t nSame = 0;
+		if (memcmp(bufferA, bufferB, nBytes)) {
+			while (bufferA[nSame] == bufferB[nSame])
+				++nSame;
+		} else {
+			nSame = nBytes;
 		}
-		if (correctArgs >= nRequiredArgs)
-			return false;
+		for (size_t i = 0; i < nSame; ++i)
+			line += bufferA[i] == '\n';
+		offset += nSame;
+		if (nSame < nBytes) {
+			OUTF("%s %s differ: byte %u, line %u\r\n", paths[0].c_str(), paths[1].c_str(), (unsigned int)offset + 1, (unsigned int)line);
+			break;
+		}
+		if (nBytesA != nBytesB) {
+			OUTF("cmp: EOF on %s after byte %u\r\n", paths[nBytesA < nBytesB ? 0 : 1].c_str(), (unsigned int)offset);
+			break;
+		}
+		if (!nBytes)
+			break;
 	}
-	LOGLN(F("Missing operand"));
+	lfseArena.deallocate(buffers, 2 * LFSE_FILE_PAGE_LENGTH);
+	files[0].close();
+	files[1].close();
 	return true;
 }
-inline static void _checkInvalidPathLog(const String& path, const String& type) {
-	LOG(F("Invalid "));
-	LOG(type);
-	LOG(F(" path: "));
-	LOGLN(path);
-}
-bool DEBUG::checkInvalidDirPath(const String& path) {
-	if (isValidFSPath(path))
+// Line diff in bounded memory: both files are walked with windows of LFSE_DIFF_WINDOW_LINES lines,
+// lines are aligned by the longest common subsequence within the windows, the first half
+// of the alignment is printed and the windows move on. Changes longer than a window come out
+// as whole removed and added blocks rather than a minimal diff.
+// Output is like unified diff without context and line counts: "@@ -<line> +<line> @@" starts a hunk
+bool DEBUG::cmdDiff(LFSECommand& cmd) {
+	cmd.parseArgs();
+	LFSEPath paths[2];
+	File files[2];
+	if (!openFilePair(cmd, paths, files))
 		return false;
-	_checkInvalidPathLog(path, F("directory"));
+	const uint8_t tableWidth = LFSE_DIFF_WINDOW_LINES + 1;
+	// lcs[i * tableWidth + j] is the LCS length of lines i.. of a and lines j.. of b
+	uint8_t* lcs = static_cast<uint8_t*>(lfseArena.allocate(tableWidth * tableWidth, 1));
+	if (!lcs)
+		return false;
+	LFSEDiffWindow a, b;
+	a._file = files[0];
+	b._file = files[1];
+	bool inHunk = false, anyHunk = false;
+	while (true) {
+		a.fill();
+		b.fill();
+		uint8_t n = a._nLines, m = b._nLines;
+		if (!n && !m)
+			break;
+		for (int16_t i = n; i >= 0; --i) {
+			for (int16_t j = m; j >= 0; --j) {
+				uint8_t& cell = lcs[i * tableWidth + j];
+				if (i == n || j == m)
+					cell = 0;
+				else if (a.isLineEqual(i, b, j))
+					cell = lcs[(i + 1) * tableWidth + j + 1] + 1;
+				else
+					cell = max(lcs[(i + 1) * tableWidth + j], lcs[i * tableWidth + j + 1]);
+			}
+		}
+		// the end of the alignment may change once more lines come in, unless both files are over
+		bool isLast = a.isAtEnd() && b.isAtEnd();
+		uint8_t i = 0, j = 0;
+		while ((i < n || j < m) && (isLast || i + j < (n + m + 1) / 2)) {
+			if (i < n && j < m && a.isLineEqual(i, b, j)) {
+				inHunk = false;
+				++i;
+				++j;
+				continue;
+			}
+			if (!anyHunk)
+				OUTF("--- %s\r\n+++ %s\r\n", paths[0].c_str(), paths[1].c_str());
+			if (!inHunk)
+				OUTF("@@ -%u +%u @@\r\n", (unsigned int)(a._firstLine + i), (unsigned int)(b._firstLine + j));
+			inHunk = anyHunk = true;
+			// removed lines go first
+			if (i < n && (j == m || lcs[(i + 1) * tableWidth + j] >= lcs[i * tableWidth + j + 1]))
+				a.printLine(i++, '-', *lfseOut);
+			else
+				b.printLine(j++, '+', *lfseOut);
+		}
+		a.drop(i);
+		b.drop(j);
+	}
+	lfseArena.deallocate(lcs, tableWidth * tableWidth);
+	files[0].close();
+	files[1].close();
 	return true;
 }
-bool DEBUG::checkInvalidFilePath(const String& path) {
-	if (isValidFSPath(path))
+
+bool DEBUG::cmdMan(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (checkMissingOperand(cmd))
 		return false;
-	_checkInvalidPathLog(path, F("file"));
 	return true;
 }
-bool DEBUG::checkAlreadyExists(const String& path) {
-	if (!LittleFS.exists(path))
-		return false;
-	LOG(path);
-	LOGLN(F(" already exists"));
+bool DEBUG::cmdMem(LFSECommand& cmd) {
+	OUT(F("heap free: "));
+	OUTLN(ESP.getFreeHeap());
+	OUT(F("heap max block: "));
+	OUTLN(ESP.getMaxFreeBlockSize());
+	OUT(F("heap fragmentation %: "));
+	OUTLN(ESP.getHeapFragmentation());
+	OUT(F("arena peak: "));
+	OUT(lfseArena._peak);
+	OUT(F(" / "));
+	OUTLN(LFSE_ARENA_LENGTH);
+	OUT(F("arena heap fallbacks: "));
+	OUTLN(lfseArena._nFallbacks);
 	return true;
 }
-bool DEBUG::checkDoesntExist(const String& path) {
-	if (LittleFS.exists(path))
+
+bool DEBUG::cmdDf(LFSECommand& cmd) {
+	FSInfo info;
+	if (!LittleFS.info(info)) {
+		LOGLN(F("Failed to get filesystem info"));
 		return false;
-	LOG(path);
-	LOGLN(F(" doesn't exist"));
+	}
+	OUT(F("block size: "));
+	OUTLN(info.blockSize);
+	OUT(F("page size: "));
+	OUTLN(info.pageSize);
+	OUT(F("blocks total: "));
+	OUTLN(info.totalBytes / info.blockSize);
+	OUT(F("blocks used: "));
+	OUT(info.usedBytes / info.blockSize);
+	OUTF(" (%u%%)\r\n", (unsigned int)(info.totalBytes ? (uint64_t)info.usedBytes * 100 / info.totalBytes : 0));
+	OUT(F("bytes free: "));
+	OUTLN(info.totalBytes - info.usedBytes);
 	return true;
 }
 
-
-void DEBUG::logExecutedCommand(const LFSECommand& cmd) {
-	LOG(lfsePath.toString());
-	LOG(F("$ "));
-	LOGLN(cmd.toString());
-}
-void DEBUG::handleCommand(uint16_t length) {
-	if (!length || length >= LFSE_SERIAL_BUFFER_LENGTH)
+inline static void _wearPrintAmplification(const LFSEWearStats& wear) {
+	if (!wear.logicalBytes) {
+		OUTLN(F("     -"));
 		return;
-
-	LFSECommand cmd(lfseBuffer, length);
-	auto search = lfseCmdMap.find(cmd._cmd);
-	logExecutedCommand(cmd);
-	if (search == lfseCmdMap.end()) {
-		LOG(F("Error: command "));
-		LOG(cmd._cmd);
-		LOGLN(F(" not found!"));
+	}
+	uint64_t physical = wear.programBytes + (uint64_t)wear.metaCommits * LFSE_WEAR_COMMIT_BYTES;
+	uint32_t amp100 = physical * 100 / wear.logicalBytes;
+	OUTF("%3u.%02u\r\n", amp100 / 100, amp100 % 100);
+}
+static bool _scrubIsOwnFile(const char* path) {
+	return !strcmp(path, LFSE_SCRUB_MANIFEST_PATH) || !strcmp(path, LFSE_SCRUB_STATE_PATH) || !strcmp(path, LFSE_SCRUB_LOG_PATH);
+}
+// Starts a new scrub if there is no saved cursor
+static void _scrubLoadState(LFSEScrubState& state) {
+	File f = LittleFS.exists(LFSE_SCRUB_STATE_PATH) ? LittleFS.open(LFSE_SCRUB_STATE_PATH, "r") : File();
+	if (f && f.read(reinterpret_cast<uint8_t*>(&state), sizeof(state)) == sizeof(state) && !memcmp(state.magic, LFSE_SCRUB_MAGIC, sizeof(state.magic)))
 		return;
+	memset(&state, 0, sizeof(state));
+	memcpy(state.magic, LFSE_SCRUB_MAGIC, sizeof(state.magic));
+	state.pass = 1;
+}
+// Finds the slot of the path hash, or the one to put it into (entry.hash is 0 then):
+// the first free one or one of a file that wasn't seen for LFSE_SCRUB_STALE_PASSES passes.
+// -1 if the manifest is full
+static int16_t _scrubLookup(File& manifest, uint32_t hash, uint32_t pass, LFSEScrubEntry& entry) {
+	int16_t reusable = -1;
+	for (uint16_t i = 0; i < LFSE_SCRUB_MANIFEST_SLOTS; ++i) {
+		uint16_t idx = (hash + i) % LFSE_SCRUB_MANIFEST_SLOTS;
+		manifest.seek((uint32_t)idx * sizeof(entry));
+		if (manifest.read(reinterpret_cast<uint8_t*>(&entry), sizeof(entry)) != sizeof(entry))
+			entry.hash = 0;
+		if (entry.hash == hash)
+			return idx;
+		// stale entries don't end the probe, the path may still come after them
+		if (!entry.hash || pass - entry.pass > LFSE_SCRUB_STALE_PASSES) {
+			if (reusable < 0)
+				reusable = idx;
+			if (!entry.hash)
+				break;
+		}
+	}
+	entry.hash = 0;
+	return reusable;
+}
+// Creates the manifest zeroed (all slots free) if needed, buffer is used for the zeros
+LFSEFile DEBUG::scrubOpenManifest(uint8_t* buffer) {
+	if (!LittleFS.exists(LFSE_SCRUB_MANIFEST_PATH)) {
+		LFSEFile f = openCounted(LFSE_SCRUB_MANIFEST_PATH, "w");
+		memset(buffer, 0, LFSE_SCRUB_BLOCK_LENGTH);
+		for (uint32_t left = LFSE_SCRUB_MANIFEST_SLOTS * sizeof(LFSEScrubEntry); f && left;) {
+			uint32_t nBytes = left < LFSE_SCRUB_BLOCK_LENGTH ? left : LFSE_SCRUB_BLOCK_LENGTH;
+			f.write(buffer, nBytes);
+			left -= nBytes;
+		}
 	}
-	std::get<0>(search->second)(cmd);
+	return openCounted(LFSE_SCRUB_MANIFEST_PATH, "r+");
 }
+// Lists the changes a host has to fetch after syncing up to seq, or tells it to sync everything
+bool DEBUG::cmdChanges(LFSECommand& cmd) {
+	cmd.parseArgs();
+	const LFSECommand::Arg* sinceArg = cmd.takeLongFlagValue("since");
+	if (!sinceArg) {
+		uint32_t oldest = lfseJournal.oldest();
+		OUTF("seq: %u\r\noldest: %u\r\n", (unsigned int)lfseJournal.last(), (unsigned int)oldest);
+		return true;
+	}
+	if (lfseJournal.printSince(strtoul(sinceArg->c_str(), nullptr, 10), *lfseOut))
+		return true;
+	LOGLN(F("changes: journal doesn't cover everything since then, full resync needed"));
+	OUTF("resync %u\r\n", (unsigned int)lfseJournal.last());
+	return false;
+}
+bool DEBUG::cmdScrub(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (cmd.isSingleLetterFlagPresent('r')) {
+		const char* paths[] = { LFSE_SCRUB_MANIFEST_PATH, LFSE_SCRUB_STATE_PATH, LFSE_SCRUB_LOG_PATH };
+		for (const char* path : paths) {
+			if (LittleFS.exists(path) && LittleFS.remove(path))
+				++lfseWearCurrent->metaCommits;
+		}
+		lfseScrub.pass = 0;
+		lfseScrubDirty = false;
+		return true;
+	}
+	if (cmd.isSingleLetterFlagPresent('l')) {
+		File f = LittleFS.exists(LFSE_SCRUB_LOG_PATH) ? LittleFS.open(LFSE_SCRUB_LOG_PATH, "r") : File();
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		while (size_t nBytes = f ? f.read(buffer, LFSE_FILE_BUFFER_LENGTH) : 0)
+			lfseOut->write(buffer, nBytes);
+		return true;
+	}
+	if (cmd.isSingleLetterFlagPresent('s')) {
+		const LFSEScrubState& state = scrubState();
+		uint16_t nUsed = 0;
+		File f = LittleFS.exists(LFSE_SCRUB_MANIFEST_PATH) ? LittleFS.open(LFSE_SCRUB_MANIFEST_PATH, "r") : File();
+		LFSEScrubEntry entry;
+		while (f && f.read(reinterpret_cast<uint8_t*>(&entry), sizeof(entry)) == sizeof(entry))
+			nUsed += entry.hash && state.pass - entry.pass <= LFSE_SCRUB_STALE_PASSES;
+		OUTF("pass: %u, entry %u, %u files checked\r\n", (unsigned int)state.pass, (unsigned int)state.index, (unsigned int)state.nFiles);
+		if (state.offset)
+			OUTF("file in progress: %u of %u bytes\r\n", (unsigned int)state.offset, (unsigned int)state.fileSize);
+		OUTF("mismatches: %u\r\nslow reads: %u (average block read %u us)\r\n", (unsigned int)state.nMismatches, (unsigned int)state.nSlowReads, (unsigned int)state.avgReadUs);
+		OUTF("manifest: %u / %u files\r\n", nUsed, LFSE_SCRUB_MANIFEST_SLOTS);
+		return true;
+	}
 
-void DEBUG::LittleFSExplorer(const String& cmd) {
-	while (!cmd.isEmpty() || _UART_.available() > 0) {
-		size_t nBytesGot = cmd.isEmpty() ? _UART_.readBytesUntil('\n', lfseBuffer, LFSE_SERIAL_BUFFER_LENGTH) : 0;
-		if (!cmd.isEmpty()) {
-			for (const char& c : cmd)
-				lfseBuffer[nBytesGot++] = c;
+	scrubStep(cmd.getNumericalFlagValue<uint32_t>('t', LFSE_SCRUB_BUDGET_MS), lfseOut);
+	return true;
+}
+void DEBUG::scrubInBackground(uint32_t budgetMs) {
+	wearBegin(lfseCmdMap.find("scrub")->first.c_str());
+	scrubStep(budgetMs, nullptr);
+	lfseArena.reset();
+}
+// Goes on with the walk where the previous step stopped, until budgetMs is over.
+// At least one block is read per step, so that the scrub always makes progress
+bool DEBUG::scrubStep(uint32_t budgetMs, Print* report) {
+	uint32_t start = millis();
+	LFSEScrubState& state = scrubState();
+	uint8_t* buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_SCRUB_BLOCK_LENGTH));
+	if (!buffer)
+		return false;
+	LFSEFile manifest; // opened once the first file is read
+	uint32_t journalOldest = 0; // taken with the manifest
+	LFSETreeWalker walker;
+	walker.begin("/");
+	// the walk goes back to the last entry done through the directories above it, without their subtrees.
+	// Files added or removed meanwhile may shift the cursor, so that a few files are skipped or checked twice in this pass
+	bool passDone = !walker.resume(state.cursor);
+	bool progressed = false;
+	while (!passDone && (!progressed || millis() - start < budgetMs)) {
+		if (!walker.next()) {
+			passDone = true;
+			break;
 		}
-		if (nBytesGot == 0) {
-			LOGLN(F("Error: Could not read serial data: no valid data found!"));
-			return;
+		Dir& dir = walker.dir();
+		const LFSEPath& path = walker.path();
+		if (dir.isDirectory() || _scrubIsOwnFile(path)) {
+			++state.index;
+			memcpy(state.cursor, walker.positions(), sizeof(state.cursor));
+			continue;
 		}
-		if (nBytesGot == LFSE_SERIAL_BUFFER_LENGTH) {
-			LOGLN(F("Error: Too big command!"));
-			return;
+		// a file written since the previous step is started over
+		if (state.offset && (dir.fileSize() != state.fileSize || (uint32_t)dir.fileTime() != state.fileTime
+				|| lfseJournal.touchedSince(state.fileSeq, path)))
+			state.offset = 0;
+		if (!state.offset) {
+			state.crc = 0;
+			state.fileSize = dir.fileSize();
+			state.fileTime = dir.fileTime();
+			state.fileSeq = lfseJournal.last();
 		}
-		handleCommand(nBytesGot);
-		if (!cmd.isEmpty()) {
-			break;
+		File f = LittleFS.open(path, "r");
+		progressed = true;
+		if (!f) {
+			++state.nMismatches;
+			scrubFinding(report, state.pass, "unreadable %s", path.c_str());
+		} else if (!scrubFile(f, state, buffer, start + budgetMs, path, report)) {
+			break; // out of time, the file goes on in the next step
+		} else {
+			if (!manifest) {
+				manifest = scrubOpenManifest(buffer);
+				journalOldest = lfseJournal.oldest();
+			}
+			scrubVerify(manifest, path, state, journalOldest, report);
+			++state.nFiles;
 		}
+		state.offset = 0;
+		++state.index;
+		memcpy(state.cursor, walker.positions(), sizeof(state.cursor));
 	}
+	manifest.close();
+	lfseArena.deallocate(buffer, LFSE_SCRUB_BLOCK_LENGTH);
+	if (report) {
+		report->printf("pass %u: %u files checked", (unsigned int)state.pass, (unsigned int)state.nFiles);
+		if (passDone)
+			report->print(F(", complete"));
+		else if (state.offset)
+			report->printf(", %s at %u of %u bytes", walker.path().c_str(), (unsigned int)state.offset, (unsigned int)state.fileSize);
+		report->println();
+	}
+	if (passDone) {
+		++state.pass;
+		state.index = state.nFiles = state.offset = 0;
+		memset(state.cursor, 0, sizeof(state.cursor));
+	}
+	lfseScrubDirty |= progressed || passDone;
+	scrubSaveState(passDone);
+	return passDone;
 }
-
-////////////////////////////////////////
-
-LFSEPath::LFSEPath(const LFSEPath& obj) {
-	for (const String& token : obj._tokens)
-		_tokens.push_back(token);
+LFSEScrubState& DEBUG::scrubState() {
+	if (!lfseScrub.pass) {
+		_scrubLoadState(lfseScrub);
+		lfseScrubSavedAt = millis();
+	}
+	return lfseScrub;
 }
-LFSEPath::LFSEPath(const String& root) {
-	tokenize(root);
+// Writes the cursor if it changed, unless it was written less than LFSE_SCRUB_SAVE_MS ago and force is false
+void DEBUG::scrubSaveState(bool force) {
+	if (!lfseScrubDirty || (!force && millis() - lfseScrubSavedAt < LFSE_SCRUB_SAVE_MS))
+		return;
+	LFSEFile f = openCounted(LFSE_SCRUB_STATE_PATH, "w");
+	if (!f || f.write(reinterpret_cast<const uint8_t*>(&lfseScrub), sizeof(lfseScrub)) != sizeof(lfseScrub)) {
+		LOGLN(F("scrub: failed to save the cursor"));
+		return;
+	}
+	lfseScrubDirty = false;
+	lfseScrubSavedAt = millis();
 }
-
-// replaces if path is absolute, adds if relative
-void LFSEPath::adjust(const String& path) {
-	if (path.isEmpty() || !isValidFSPath(path)) {
+// Reads the file on from state.offset, false if the deadline came before its end
+bool DEBUG::scrubFile(File& f, LFSEScrubState& state, uint8_t* buffer, uint32_t deadline, const LFSEPath& path, Print* report) {
+	f.seek(state.offset);
+	do {
+		uint32_t readStart = micros();
+		size_t nBytes = f.read(buffer, LFSE_SCRUB_BLOCK_LENGTH);
+		uint32_t readUs = micros() - readStart;
+		if (!nBytes)
+			return true;
+		// short reads at the end of files don't tell much about the flash
+		if (nBytes == LFSE_SCRUB_BLOCK_LENGTH) {
+			if (state.avgReadUs && readUs >= LFSE_SCRUB_SLOW_MIN_US && readUs > LFSE_SCRUB_SLOW_FACTOR * state.avgReadUs) {
+				++state.nSlowReads;
+				scrubFinding(report, state.pass, "slow %s at %u: %u us", path.c_str(), (unsigned int)state.offset, (unsigned int)readUs);
+			} else {
+				state.avgReadUs = state.avgReadUs ? (state.avgReadUs * 7 + readUs) / 8 : readUs;
+			}
+		}
+		state.crc = lfseCrc32(buffer, nBytes, state.crc);
+		state.offset += nBytes;
+	} while ((int32_t)(millis() - deadline) < 0);
+	return false;
+}
+// Compares the CRC of the file that was just read with the manifest and records it there.
+// A different CRC is only reported if nothing says the file was written since the manifest got it:
+// neither its size and last write time nor the journal (which is only searched then).
+// Entries older than the oldest journal record can't be checked that way, so they're renewed
+// while their CRC still matches
+void DEBUG::scrubVerify(LFSEFile& manifest, const LFSEPath& path, LFSEScrubState& state, uint32_t journalOldest, Print* report) {
+	if (state.offset != state.fileSize) {
+		++state.nMismatches;
+		scrubFinding(report, state.pass, "short %s: %u of %u bytes", path.c_str(), (unsigned int)state.offset, (unsigned int)state.fileSize);
+		return;
+	}
+	uint32_t hash = (uint32_t)lfseFnv64(reinterpret_cast<const uint8_t*>(path.c_str()), strlen(path)) | 1; // 0 marks free slots
+	LFSEScrubEntry entry;
+	int16_t idx = _scrubLookup(manifest, hash, state.pass, entry);
+	if (idx < 0) // manifest is full
+		return;
+	bool sameMeta = entry.hash && entry.size == state.fileSize && entry.time == state.fileTime;
+	if (sameMeta && entry.crc != state.crc && !lfseJournal.touchedSince(entry.seq, path)) {
+		++state.nMismatches;
+		scrubFinding(report, state.pass, "crc %s: %08x, expected %08x", path.c_str(), (unsigned int)state.crc, (unsigned int)entry.crc);
+		return; // expected CRC stays, so that the file is reported on every pass
+	}
+	// entries of unchanged files are only refreshed every few passes, to keep them from going stale
+	if (sameMeta && entry.crc == state.crc && state.pass - entry.pass < LFSE_SCRUB_STALE_PASSES / 2 && entry.seq + 1 >= journalOldest)
+		return;
+	entry = { hash, state.fileSize, state.fileTime, state.crc, state.fileSeq, state.pass };
+	manifest.seek((uint32_t)idx * sizeof(entry));
+	manifest.write(reinterpret_cast<const uint8_t*>(&entry), sizeof(entry));
+}
+// Prints the finding and keeps it in LFSE_SCRUB_LOG_PATH, unless the log is full
+void DEBUG::scrubFinding(Print* report, uint32_t pass, const char* format, ...) {
+	char line[LFSE_PATH_MAX_LENGTH + 48];
+	int length = snprintf(line, sizeof(line), "%u ", (unsigned int)pass);
+	va_list args;
+	va_start(args, format);
+	vsnprintf(line + length, sizeof(line) - length, format, args);
+	va_end(args);
+	if (report) {
+		report->print(line + length);
+		report->println();
+	}
+	length = strlen(line);
+	File fLog = LittleFS.exists(LFSE_SCRUB_LOG_PATH) ? LittleFS.open(LFSE_SCRUB_LOG_PATH, "r") : File();
+	uint32_t logSize = fLog ? fLog.size() : 0;
+	fLog.close();
+	if (logSize + length + 1 > LFSE_SCRUB_LOG_MAX_LENGTH)
 		return;
+	LFSEFile f = openCounted(LFSE_SCRUB_LOG_PATH, "a");
+	f.write(reinterpret_cast<const uint8_t*>(line), length);
+	f.write('\n');
+}
+bool DEBUG::cmdWear(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (cmd.isSingleLetterFlagPresent('r')) {
+		for (LFSEWearStats& wear : lfseWear)
+			wear = LFSEWearStats();
+		lfseWearCurrent = &lfseWear[LFSE_WEAR_MAX_COMMANDS - 1];
+		return true;
+	}
+	// amplification: (programmed + committed metadata) / logical bytes
+	OUTLN(F("cmd      calls   logical   program  erases commits    amp"));
+	LFSEWearStats total;
+	for (const LFSEWearStats& wear : lfseWear) {
+		if (!wear.calls && !wear.logicalBytes && !wear.programBytes && !wear.metaCommits)
+			continue;
+		OUTF("%-8s %5u %9u %9u %7u %7u ", wear.cmd ? wear.cmd : "other", wear.calls, wear.logicalBytes,
+			wear.programBytes, wear.eraseOps, wear.metaCommits);
+		_wearPrintAmplification(wear);
+		total.calls += wear.calls;
+		total.logicalBytes += wear.logicalBytes;
+		total.programBytes += wear.programBytes;
+		total.eraseOps += wear.eraseOps;
+		total.metaCommits += wear.metaCommits;
 	}
-	tokenize(path, path[0] != '/');
+	OUTF("%-8s %5u %9u %9u %7u %7u ", "total", total.calls, total.logicalBytes,
+		total.programBytes, total.eraseOps, total.metaCommits);
+	_wearPrintAmplification(total);
+	return true;
 }
 
-String LFSEPath::toString(bool trailingSlash) const {
-	String res;
-	for (const String& token : _tokens) {
-		res += "/";
-		res += token;
+// Number of blocks a littlefs CTZ skip-list takes to store size bytes:
+// block i > 0 starts with ctz(i) + 1 pointers to the previous blocks
+inline static uint32_t _ctzBlocksCount(uint32_t size, uint32_t blockSize) {
+	uint32_t nBlocks = 0;
+	uint32_t capacity = 0;
+	while (capacity < size) {
+		uint32_t nPointers = nBlocks ? __builtin_ctz(nBlocks) + 1 : 0;
+		capacity += blockSize - 4 * nPointers;
+		++nBlocks;
 	}
-	if (trailingSlash || res.isEmpty())
-		res += "/";
-	return res;
+	return nBlocks;
 }
+bool DEBUG::cmdFsinfo(LFSECommand& cmd) {
+	cmd.parseArgs();
+	FSInfo info;
+	if (!LittleFS.info(info)) {
+		LOGLN(F("Failed to get filesystem info"));
+		return false;
+	}
+	OUT(F("block size: "));
+	OUTLN(info.blockSize);
+	OUT(F("page size: "));
+	OUTLN(info.pageSize);
+	OUT(F("max open files: "));
+	OUTLN(info.maxOpenFiles);
+	OUT(F("max path length: "));
+	OUTLN(info.maxPathLength);
+	if (!cmd.isSingleLetterFlagPresent('v'))
+		return true;
 
-void LFSEPath::tokenize(const String& s, bool appendToExisting) {
-	if (!appendToExisting)
-		_tokens.clear();
-	String token;
-	for (uint16_t i = 0; i < s.length(); ++i) {
-		char c = s[i];
-		if (isValidFSNameChar(c)) {
-			token += c;
+	// histogram buckets: 0, <=64, <=256, <=1K, ..., <=256K, >256K
+	const uint8_t nBuckets = 9;
+	uint32_t histogram[nBuckets] = { 0 };
+	uint32_t nFiles = 0, nDirs = 0, nInline = 0;
+	uint64_t dataBytes = 0, inlineBytes = 0, fileSlack = 0, dataBlocks = 0;
+	// files of each directory on the way down, printed when the walk leaves it
+	struct DirStats {
+		uint32_t nFiles;
+		uint32_t inlineBytes;
+		uint64_t slack;
+	} dirStats[LFSE_WALK_MAX_DEPTH + 1] = {};
+	OUTLN(F("per directory: files, slack in their blocks, inline bytes in its metadata"));
+	LFSETreeWalker walker;
+	walker.begin("/", true);
+	while (walker.next()) {
+		Dir& dir = walker.dir();
+		if (dir.isDirectory()) {
+			DirStats& stats = dirStats[walker.depth()];
+			OUTF("  %s: %u, %u, %u\r\n", walker.path().c_str(), (unsigned int)stats.nFiles, (unsigned int)stats.slack, (unsigned int)stats.inlineBytes);
+			stats = {};
+			++nDirs;
 			continue;
 		}
-		if (c == '/') {
-			if (token.length()) {
-				_tokens.push_back(token);
-				token.clear();
-			}
+		DirStats& stats = dirStats[walker.depth() - 1];
+		uint32_t size = dir.fileSize();
+		++stats.nFiles;
+		++nFiles;
+		dataBytes += size;
+		uint8_t bucket = 0;
+		for (uint32_t limit = 64; bucket < nBuckets - 1 && size; limit <<= 2) {
+			++bucket;
+			if (size <= limit)
+				break;
 		}
-	}
-	if (token.length()) {
-		_tokens.push_back(std::move(token));
-	}
-	
-	// get rid of '.'s and empties
-	_tokens.erase(std::remove_if(_tokens.begin(), _tokens.end(), [](const String& token) {
-		return token.isEmpty() || token.equals(F("."));
-	}), _tokens.end());
-
-	// resolve '..'s
-	{
-		auto it = _tokens.rbegin();
-		while(it != _tokens.rend()) {
-			auto token = *it;
-			if (token.equals(F(".."))) {
-				it = decltype(it)(_tokens.erase(std::next(it).base()));
-				if (it != _tokens.rend())
-					it = decltype(it)(_tokens.erase(std::next(it).base()));
-				continue;
-			}
-			++it;
+		++histogram[bucket];
+		if (size <= LFSE_INLINE_FILE_MAX_SIZE) {
+			++nInline;
+			inlineBytes += size;
+			stats.inlineBytes += size;
+			continue;
 		}
+		// exact for a file written sequentially: its last block is the only one not filled up
+		uint32_t nBlocks = _ctzBlocksCount(size, info.blockSize);
+		dataBlocks += nBlocks;
+		uint32_t slack = nBlocks * info.blockSize - size;
+		fileSlack += slack;
+		stats.slack += slack;
 	}
-}
+	OUTF("  /: %u, %u, %u\r\n", (unsigned int)dirStats[0].nFiles, (unsigned int)dirStats[0].slack, (unsigned int)dirStats[0].inlineBytes);
+	// metadata blocks also hold the superblock, inline files and the unused rest of each metadata pair,
+	// none of which littlefs reports, so only the inline files are taken out
+	uint64_t metaBlockBytes = info.usedBytes > dataBlocks * info.blockSize ? info.usedBytes - dataBlocks * info.blockSize : 0;
+	uint64_t metaBytes = metaBlockBytes > inlineBytes ? metaBlockBytes - inlineBytes : 0;
 
-LFSEPath LFSEPath::createAdjustedFromUserPath(String userPath) {
-	LFSEPath path(*this);
-	path.adjust(userPath);
-	return path;
-}
-
-////////////
-
-void LFSECommand::parseCmd() {
-	String token;
-	uint16_t i = 0;
-	for (; i < _bufferLength; ++i) {
-		char c = _buffer[i];
-		if (!isValidFSNameChar(c))
-			break;
-		token += c;
+	OUT(F("directories: "));
+	OUTLN(nDirs);
+	OUT(F("files: "));
+	OUTLN(nFiles);
+	OUT(F("  inline (<= "));
+	OUT(LFSE_INLINE_FILE_MAX_SIZE);
+	OUT(F(" bytes): "));
+	OUT(nInline);
+	OUT(F(" files, "));
+	OUT((uint32_t)inlineBytes);
+	OUTLN(F(" bytes"));
+	OUT(F("  in blocks: "));
+	OUT(nFiles - nInline);
+	OUT(F(" files, "));
+	OUT((uint32_t)dataBlocks);
+	OUTLN(F(" blocks"));
+	OUT(F("file size histogram:"));
+	for (uint8_t i = 0; i < nBuckets; ++i) {
+		if (!i)
+			OUT(F("\r\n  0: "));
+		else if (i == nBuckets - 1)
+			OUT(F("\r\n  >256K: "));
+		else if (i < 3)
+			OUTF("\r\n  <=%lu: ", 64ul << (2 * (i - 1)));
+		else
+			OUTF("\r\n  <=%luK: ", (64ul << (2 * (i - 1))) / 1024);
+		OUT(histogram[i]);
 	}
-	_cmdBufferCursor = i;
-	_cmd = std::move(token);
-	_cmd.toLowerCase();
+	OUTLN("");
+	OUT(F("data bytes: "));
+	OUTLN((uint32_t)dataBytes);
+	OUT(F("slack in file blocks: "));
+	OUT((uint32_t)fileSlack);
+	OUT(F(" (mean per block file "));
+	OUT((uint32_t)(nFiles - nInline ? fileSlack / (nFiles - nInline) : 0));
+	OUTLN(F(")"));
+	OUT(F("metadata blocks: "));
+	OUT((uint32_t)metaBlockBytes);
+	OUT(F(" bytes, "));
+	OUT((uint32_t)inlineBytes);
+	OUTLN(F(" of them inline file data"));
+	OUT(F("metadata bytes (estimate): "));
+	OUT((uint32_t)metaBytes);
+	OUT(F(" (mean per directory "));
+	OUT((uint32_t)(metaBytes / (nDirs + 1))); // +1 for root
+	OUTLN(F(")"));
+	OUT(F("metadata/data ratio (estimate): "));
+	OUTLN(dataBytes ? (float)metaBytes / dataBytes : 0.f);
+	if (walker.isTruncated()) {
+		LOG(F("fsinfo: some entries were skipped, deeper than "));
+		LOGLN(LFSE_WALK_MAX_DEPTH);
+		return false;
+	}
+	return true;
 }
 
+// Walks the tree once and streams out the entries matching all predicates as they're found
+bool DEBUG::cmdFind(LFSECommand& cmd) {
+	cmd.parseArgs();
+	LFSEFindProgram program;
+	bool remove = false, print0 = false;
+	if (!findCompile(cmd, program, remove, print0))
+		return false;
+	const char* userPath = ".";
+	if (cmd.countArgs(LFSECommand::Arg::Type::FILENAME))
+		userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
+	LFSEPath dirPath;
+	if (checkNotADir(userPath, dirPath))
+		return false;
 
-bool LFSECommand::isSingleLetterFlagPresent(char f) const {
-	for (const Arg& arg : _args) {
-		if (!arg.isTypeFlag() || arg.value.isEmpty())
+	// -delete visits children first, so that directories are already emptied when they're checked
+	LFSETreeWalker walker;
+	walker.begin(dirPath, remove);
+	bool ok = true;
+	while (walker.next()) {
+		Dir& dir = walker.dir();
+		const LFSEPath& path = walker.path();
+		if (!program.matches(dir, path.name()))
 			continue;
-		if (arg.value.indexOf(f) != -1)
-			return true;
+		if (remove && !(dir.isDirectory() ? fsRmdir(path) : fsRemove(path))) {
+			LOG(F("Failed to remove "));
+			LOGLN(path);
+			ok = false;
+			continue;
+		}
+		if (print0) {
+			OUT(path);
+			lfseOut->write((uint8_t)'\0');
+		} else if (!remove) {
+			OUTLN(path);
+		}
 	}
-	return false;
+	if (walker.isTruncated()) {
+		LOG(F("find: some entries were skipped, deeper than "));
+		LOGLN(LFSE_WALK_MAX_DEPTH);
+		return false;
+	}
+	return ok;
 }
-
-template <typename T> static T CastStringToNum(const String& s) { return static_cast<T>(s); }
-template <> int CastStringToNum<int>(const String& s) { return s.toInt(); }
-template <> float CastStringToNum<float>(const String& s) { return s.toFloat(); }
-template <typename T>
-T LFSECommand::getNumericalFlagValue(char f, const T& fallback) const {
-	for (const Arg& arg : _args) {
-		if (arg.isFlagAndStartsWith(f) && arg.value.length() > 1 && (isDigit(arg.value[1]) || arg.value[1] == '-')) {
-			return CastStringToNum<T>(arg.value.substring(1));
+// Turns predicates into the program and their operands into flag values, so that only the
+// starting directory is left as a filename. Both -name and --name forms are accepted
+bool DEBUG::findCompile(LFSECommand& cmd, LFSEFindProgram& program, bool& remove, bool& print0) {
+	for (size_t i = 0; i < cmd._args.size(); ++i) {
+		LFSECommand::Arg& arg = cmd._args[i];
+		if (!arg.isTypeFlag())
+			continue;
+		const char* name = arg.c_str() + arg.isFlagAndStartsWith('-');
+		if (!strcmp(name, "delete")) {
+			remove = true;
+			continue;
+		}
+		if (!strcmp(name, "print0")) {
+			print0 = true;
+			continue;
+		}
+		bool isName = !strcmp(name, "name"), isSize = !strcmp(name, "size");
+		bool isType = !strcmp(name, "type"), isNewer = !strcmp(name, "newer");
+		if (!isName && !isSize && !isType && !isNewer) {
+			LOGF("find: unknown predicate -%s\r\n", name);
+			return false;
+		}
+		if (i + 1 == cmd._args.size()) {
+			LOGF("find: -%s needs an operand\r\n", name);
+			return false;
+		}
+		LFSECommand::Arg& operand = cmd._args[++i];
+		bool isNegative = operand.isTypeFlag(); // -N is parsed as a flag
+		operand.type = LFSECommand::Arg::Type::FLAG_VALUE;
+		const char* value = operand.c_str();
+		bool added = true;
+		if (isName) {
+			added = program.add(LFSEFindProgram::Op::NAME, 0, value);
+		} else if (isType) {
+			if (strcmp(value, "f") && strcmp(value, "d")) {
+				LOGLN(F("find: -type should be f or d"));
+				return false;
+			}
+			added = program.add(LFSEFindProgram::Op::TYPE, value[0] == 'd');
+		} else if (isSize) {
+			// [+|-]N[k|M]: more than, less than or exactly N bytes
+			LFSEFindProgram::Op op = isNegative ? LFSEFindProgram::Op::SIZE_LESS : LFSEFindProgram::Op::SIZE_EQUAL;
+			if (*value == '+') {
+				op = LFSEFindProgram::Op::SIZE_GREATER;
+				++value;
+			}
+			char* end;
+			uint32_t size = strtoul(value, &end, 10);
+			uint8_t shift = *end == 'k' ? 10 : *end == 'M' ? 20 : 0;
+			if (end == value || (shift ? end[1] : *end)) {
+				LOGF("find: invalid size %s\r\n", operand.c_str());
+				return false;
+			}
+			added = program.add(op, size << shift);
+		} else {
+			// timestamp in seconds or the file whose last write time to compare with
+			char* end;
+			uint32_t time = strtoul(value, &end, 10);
+			if (end == value || *end) {
+				LFSEPath refPath;
+				if (checkInvalidFilePath(value) || checkPathTooLong(value, refPath) || checkDoesntExist(refPath))
+					return false;
+				File f = LittleFS.open(refPath, "r");
+				time = f.getLastWrite();
+				f.close();
+			}
+			added = program.add(LFSEFindProgram::Op::NEWER, time);
+		}
+		if (!added) {
+			LOGF("find: too many predicates, up to %u are supported\r\n", LFSE_FIND_MAX_PREDICATES);
+			return false;
 		}
 	}
-	return fallback;
+	program.optimize();
+	return true;
 }
 
-uint8_t LFSECommand::getArgFirstFilenameOrLastArgIdx(uint8_t startIdx) const {
-	for (uint8_t i = startIdx; i < _args.size(); ++i) {
-		if (_args[i].isTypeFilename()) {
-			return i;
+// tar pads archives to records of 20 blocks, so more zero blocks may follow the end marker.
+// They are skipped up to anything else (e.g. the next command) or until the input goes quiet
+inline static void _tarSkipPadding(Stream& in) {
+	uint32_t start = millis();
+	while (millis() - start < in.getTimeout()) {
+		int c = in.peek();
+		if (c > 0)
+			return;
+		if (c < 0) {
+			yield();
+			continue;
 		}
+		in.read();
+		start = millis();
 	}
-	return 0xFF;
 }
-
-LFSECommand::Arg LFSECommand::getArgFirstFilenameOrLastArg(uint8_t startIdx) const {
-	return _args[getArgFirstFilenameOrLastArgIdx(startIdx)];
-}
-
-// String str contains all chars before CRLF, but at most maxLen chars
+bool DEBUG::cmdTar(LFSECommand& cmd) {
+	cmd.parseArgs();
+	bool create = cmd.isSingleLetterFlagPresent('c');
+	bool extract = cmd.isSingleLetterFlagPresent('x');
+	// an archive to extract follows the command line and has to be consumed whatever goes wrong
+	if (create == extract) {
+		LOGLN(F("tar: either -c or -x should be specified"));
+		if (extract)
+			_drainInput(_UART_);
+		return false;
+	}
+	const char* userPath = "";
+	if (cmd.countArgs(LFSECommand::Arg::Type::FILENAME))
+		userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
+	LFSEPath dirPath;
+	if (checkNotADir(userPath, dirPath)) {
+		if (extract)
+			_drainInput(_UART_);
+		return false;
+	}
+	if (!cmd.isSingleLetterFlagPresent('z')) {
+		if (create)
+			return tarCreate(dirPath);
+		bool ok = tarExtract(_UART_, dirPath);
+		if (ok)
+			_tarSkipPadding(_UART_);
+		return ok;
+	}
+	if (create) {
+		LFSELzPrint lzOut;
+		if (!lzOut.begin(lfseOut))
+			return false;
+		lfseOut = &lzOut;
+		bool ok = tarCreate(dirPath);
+		lzOut.end();
+		lfseOut = lzOut._out;
+		return ok;
+	}
+	LFSELzStream lzIn;
+	if (!lzIn.begin(&_UART_)) {
+		_drainInput(_UART_);
+		return false;
+	}
+	bool ok = tarExtract(lzIn, dirPath);
+	while (lzIn.read() >= 0); // consume the end of compressed stream
+	lzIn.end();
+	return ok;
+}
+// Sum of header bytes with the checksum field counted as spaces
+inline static uint32_t _tarChecksum(const uint8_t* block) {
+	uint32_t checksum = 8 * ' ';
+	for (uint16_t i = 0; i < LFSE_TAR_BLOCK_LENGTH; ++i) {
+		if (i < 148 || i >= 156)
+			checksum += block[i];
+	}
+	return checksum;
+}
+inline static uint32_t _tarParseOctal(const uint8_t* field, uint8_t length) {
+	uint32_t res = 0;
+	for (; length && *field == ' '; --length, ++field);
+	for (; length && *field >= '0' && *field <= '7'; --length, ++field)
+		res = (res << 3) | (*field - '0');
+	return res;
+}
+// Fills ustar header fields of a zeroed block, name is split into prefix/name if longer than 100
+inline static bool _tarFillHeader(uint8_t* block, const char* name, uint32_t size, uint32_t mtime, char type) {
+	char* header = reinterpret_cast<char*>(block);
+	size_t nameLength = strlen(name);
+	size_t split = 0; // length of the prefix part
+	if (nameLength > 100) {
+		// the last '/' leaving no more than 100 symbols for the name
+		for (split = nameLength - 100; split < nameLength && name[split - 1] != '/'; ++split);
+		if (split >= nameLength || split > 155)
+			return false;
+		memcpy(header + 345, name, split - 1);
+	}
+	memcpy(header, name + split, nameLength - split);
+	snprintf(header + 100, 8, "%07o", type == '5' ? 0755 : 0644);
+	snprintf(header + 108, 8, "%07o", 0);
+	snprintf(header + 116, 8, "%07o", 0);
+	snprintf(header + 124, 12, "%011o", (unsigned int)size);
+	snprintf(header + 136, 12, "%011o", (unsigned int)mtime);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	snprintf(header + 148, 7, "%06o", (unsigned int)_tarChecksum(block));
+	header[155] = ' ';
+	return true;
+}
+// Streams the tree as ustar archive straight to the output, member names are relative to dirPath.
+// Only a single block buffer is used, so that the size of the tree doesn't matter
+bool DEBUG::tarCreate(const LFSEPath& dirPath) {
+	uint8_t* block = static_cast<uint8_t*>(lfseArena.allocate(LFSE_TAR_BLOCK_LENGTH));
+	if (!block)
+		return false;
+	size_t rootLength = strlen(dirPath);
+	rootLength += rootLength > 1; // skip separator after the root
+	uint16_t nSkipped = 0;
+	LFSETreeWalker walker;
+	walker.begin(dirPath);
+	while (walker.next()) {
+		Dir& dir = walker.dir();
+		bool isDir = dir.isDirectory();
+		const char* name = walker.path().c_str() + rootLength;
+		uint32_t size = isDir ? 0 : dir.fileSize();
+		memset(block, 0, LFSE_TAR_BLOCK_LENGTH);
+		if (isDir) { // directory names end with '/'
+			char dirName[LFSE_PATH_MAX_LENGTH + 2];
+			snprintf(dirName, sizeof(dirName), "%s/", name);
+			if (!_tarFillHeader(block, dirName, 0, dir.fileTime(), '5')) {
+				++nSkipped;
+				walker.skipChildren();
+				continue;
+			}
+			lfseOut->write(block, LFSE_TAR_BLOCK_LENGTH);
+			continue;
+		}
+		File f = LittleFS.open(walker.path(), "r");
+		if (!f || !_tarFillHeader(block, name, size, dir.fileTime(), '0')) {
+			++nSkipped;
+			continue;
+		}
+		lfseOut->write(block, LFSE_TAR_BLOCK_LENGTH);
+		// the body is always exactly size bytes padded with zeros, even if the file changes meanwhile
+		while (size) {
+			memset(block, 0, LFSE_TAR_BLOCK_LENGTH);
+			uint16_t nBytes = size < LFSE_TAR_BLOCK_LENGTH ? size : LFSE_TAR_BLOCK_LENGTH;
+			f.read(block, nBytes);
+			lfseOut->write(block, LFSE_TAR_BLOCK_LENGTH);
+			size -= nBytes;
+		}
+		f.close();
+	}
+	// end of archive: two zero blocks
+	memset(block, 0, LFSE_TAR_BLOCK_LENGTH);
+	lfseOut->write(block, LFSE_TAR_BLOCK_LENGTH);
+	lfseOut->write(block, LFSE_TAR_BLOCK_LENGTH);
+	lfseArena.deallocate(block, LFSE_TAR_BLOCK_LENGTH);
+	if (nSkipped) {
+		LOG(F("tar: entries skipped (unreadable or name too long): "));
+		LOGLN(nSkipped);
+	}
+	if (walker.isTruncated()) {
+		LOG(F("tar: some entries were skipped, deeper than "));
+		LOGLN(LFSE_WALK_MAX_DEPTH);
+	}
+	return !nSkipped && !walker.isTruncated();
+}
+// Reads ustar archive from the stream and creates its entries under dirPath as the headers arrive.
+// Prints a line per entry: 'd'/'f' for created directories/files, '-' for skipped ones
+bool DEBUG::tarExtract(Stream& in, const LFSEPath& dirPath) {
+	uint8_t* block = static_cast<uint8_t*>(lfseArena.allocate(LFSE_TAR_BLOCK_LENGTH));
+	if (!block) {
+		_drainInput(in);
+		return false;
+	}
+	size_t rootLength = strlen(dirPath);
+	uint16_t nFiles = 0, nDirs = 0, nSkipped = 0;
+	uint32_t nBytes = 0;
+	bool finished = false;
+	while (true) {
+		if (in.readBytes(reinterpret_cast<char*>(block), LFSE_TAR_BLOCK_LENGTH) != LFSE_TAR_BLOCK_LENGTH) {
+			LOGLN(F("tar: unexpected end of archive"));
+			break;
+		}
+		if (_tarChecksum(block) == 8 * ' ') { // zero block marks the end of archive
+			finished = true;
+			break;
+		}
+		if (_tarChecksum(block) != _tarParseOctal(block + 148, 8)) {
+			LOGLN(F("tar: header checksum mismatch"));
+			break;
+		}
+		if (memcmp(block + 257, "ustar", 5)) { // GNU tar's "ustar " passes too, its extensions are skipped by type
+			LOGLN(F("tar: not a ustar archive"));
+			break;
+		}
+		uint32_t size = _tarParseOctal(block + 124, 12);
+		char type = block[156];
+		// prefix + '/' + name, both fields might be not terminated
+		char name[155 + 1 + 100 + 1];
+		uint8_t prefixLength = strnlen(reinterpret_cast<char*>(block + 345), 155);
+		uint8_t nameLength = strnlen(reinterpret_cast<char*>(block), 100);
+		memcpy(name, block + 345, prefixLength);
+		if (prefixLength)
+			name[prefixLength++] = '/';
+		memcpy(name + prefixLength, block, nameLength);
+		name[prefixLength + nameLength] = '\0';
+
+		// member names are relative to dirPath and shouldn't escape it
+		LFSEPath path = dirPath;
+		const char* relName = name;
+		while (*relName == '/')
+			++relName;
+		bool valid = !isGlobPattern(relName) && path.adjust(relName) && path.tokensCount() >= dirPath.tokensCount() + (type != '5')
+			&& !strncmp(path, dirPath, rootLength) && (rootLength == 1 || !path[rootLength] || path[rootLength] == '/');
+		if (valid && type == '5') {
+			if (fsMkdirs(path, dirPath.tokensCount())) {
+				++nDirs;
+				OUTF("d %s\r\n", name);
+				continue;
+			}
+			valid = false;
+		}
+		if (valid && (type == '0' || type == '\0')) {
+			// archives don't have to list the directories of their files
+			LFSEPath parentPath = path;
+			parentPath.popToken();
+			if (fsMkdirs(parentPath, dirPath.tokensCount())) {
+				if (!tarExtractFile(in, path, size, block)) {
+					LOG(F("tar: failed to extract "));
+					LOGLN(name);
+					break; // the rest of the body can't be skipped reliably
+				}
+				++nFiles;
+				nBytes += size;
+				OUTF("f %s %u\r\n", name, (unsigned int)size);
+				continue;
+			}
+			valid = false;
+		}
+		// skip the body of anything that isn't extracted
+		++nSkipped;
+		OUTF("- %s\r\n", name);
+		for (uint32_t nBlocks = (size + LFSE_TAR_BLOCK_LENGTH - 1) / LFSE_TAR_BLOCK_LENGTH; nBlocks; --nBlocks)
+			in.readBytes(reinterpret_cast<char*>(block), LFSE_TAR_BLOCK_LENGTH);
+	}
+	// the second zero block and the record padding are left to the caller
+	if (!finished)
+		_drainInput(in, block, LFSE_TAR_BLOCK_LENGTH);
+	lfseArena.deallocate(block, LFSE_TAR_BLOCK_LENGTH);
+	OUTF("tar: %u files (%u bytes), %u directories, %u skipped\r\n", nFiles, (unsigned int)nBytes, nDirs, nSkipped);
+	return finished;
+}
+
+// Writes the next size bytes of the stream into the file in page-sized chunks
+// and consumes the padding of the last tar block. Half-written file is removed
+bool DEBUG::tarExtractFile(Stream& in, const LFSEPath& path, uint32_t size, uint8_t* buffer) {
+	LFSEFile f = fsOpen(path, "w");
+	uint32_t nLeft = (size + LFSE_TAR_BLOCK_LENGTH - 1) / LFSE_TAR_BLOCK_LENGTH * LFSE_TAR_BLOCK_LENGTH;
+	while (nLeft) {
+		if (in.readBytes(reinterpret_cast<char*>(buffer), LFSE_FILE_PAGE_LENGTH) != LFSE_FILE_PAGE_LENGTH)
+			break;
+		nLeft -= LFSE_FILE_PAGE_LENGTH;
+		if (!size)
+			continue;
+		uint16_t nBytes = size < LFSE_FILE_PAGE_LENGTH ? size : LFSE_FILE_PAGE_LENGTH;
+		if (!f || f.write(buffer, nBytes) != nBytes)
+			break;
+		wearAddLogical(nBytes);
+		size -= nBytes;
+	}
+	bool ok = f && !nLeft;
+	f.close();
+	if (!ok)
+		fsRemove(path);
+	return ok;
+}
+
+inline static void _checkIsA(const char* path, const __FlashStringHelper* type) {
+	LOG(path);
+	LOG(F(" is a "));
+	LOGLN(type);
+}
+bool DEBUG::checkIsAFile(const File& f, const char* path) {
+	if (f.isDirectory())
+		return false;
+	_checkIsA(path, F("file"));
+	return true;
+}
+bool DEBUG::checkIsADir(const File& f, const char* path) {
+	if (f.isFile())
+		return false;
+	_checkIsA(path, F("directory"));
+	return true;
+}
+bool DEBUG::checkMissingOperand(LFSECommand& cmd, uint8_t nRequiredArgs, LFSECommand::Arg::Type requiredType) {
+	if (cmd._args.size() >= nRequiredArgs) {
+		uint8_t correctArgs = 0;
+		for (const LFSECommand::Arg& arg : cmd._args) {
+			if (arg.type == requiredType)
+				++correctArgs;
+		}
+		if (correctArgs >= nRequiredArgs)
+			return false;
+	}
+	LOGLN(F("Missing operand"));
+	return true;
+}
+inline static void _checkInvalidPathLog(const char* path, const __FlashStringHelper* type) {
+	LOG(F("Invalid "));
+	LOG(type);
+	LOG(F(" path: "));
+	LOGLN(path);
+}
+bool DEBUG::checkInvalidDirPath(const char* path) {
+	if (isValidFSPath(path) && !isGlobPattern(path))
+		return false;
+	_checkInvalidPathLog(path, F("directory"));
+	return true;
+}
+bool DEBUG::checkInvalidFilePath(const char* path) {
+	if (isValidFSPath(path) && !isGlobPattern(path))
+		return false;
+	_checkInvalidPathLog(path, F("file"));
+	return true;
+}
+// wildcards are only allowed in the last path token
+bool DEBUG::checkInvalidPattern(const char* path) {
+	bool valid = isValidFSPath(path);
+	const char* lastSlash = strrchr(path, '/');
+	for (const char* c = path; valid && lastSlash && c < lastSlash; ++c)
+		valid = !isGlobChar(*c);
+	if (valid)
+		return false;
+	_checkInvalidPathLog(path, F("pattern"));
+	return true;
+}
+bool DEBUG::checkNotADir(const char* userPath, LFSEPath& dirPath) {
+	if (checkInvalidDirPath(userPath) || checkPathTooLong(userPath, dirPath) || checkDoesntExist(dirPath))
+		return true;
+	File f = LittleFS.open(dirPath, "r");
+	bool isDir = f.isDirectory();
+	f.close();
+	if (isDir)
+		return false;
+	LOG(dirPath);
+	LOGLN(F(" is not a directory"));
+	return true;
+}
+// Resolves userPath against current working directory
+bool DEBUG::checkPathTooLong(const char* userPath, LFSEPath& path) {
+	path = lfsePath;
+	if (path.adjust(userPath))
+		return false;
+	LOG(F("Path too long: "));
+	LOGLN(userPath);
+	return true;
+}
+bool DEBUG::checkAlreadyExists(const char* path) {
+	if (!LittleFS.exists(path))
+		return false;
+	LOG(path);
+	LOGLN(F(" already exists"));
+	return true;
+}
+bool DEBUG::checkDoesntExist(const char* path) {
+	if (LittleFS.exists(path))
+		return false;
+	LOG(path);
+	LOGLN(F(" doesn't exist"));
+	return true;
+}
+
+
+// Calls func for every existing path that matches userPath.
+// Wildcards are expanded in the last path token only, in a single pass over its directory,
+// and each match is handed over as soon as it's found, without collecting them first.
+// Returns false if nothing matched
+bool DEBUG::forEachPathMatch(const char* userPath, const pathFunc& func) {
+	LFSEPath path;
+	if (checkInvalidPattern(userPath) || checkPathTooLong(userPath, path))
+		return false;
+	if (!isGlobPattern(path.name())) {
+		if (checkDoesntExist(path))
+			return false;
+		func(path);
+		return true;
+	}
+	char pattern[LFSE_PATH_MAX_LENGTH + 1];
+	strcpy(pattern, path.name());
+	path.popToken();
+
+	// LittleFS keeps open directories consistent when their entries are removed,
+	// so func is free to modify the directory that's being iterated
+	uint16_t nMatches = 0;
+	Dir dir = LittleFS.openDir(path);
+	while (dir.next()) {
+		String name = dir.fileName();
+		if (!matchesGlob(pattern, name.c_str()))
+			continue;
+		LFSEPath match(path);
+		if (!match.pushToken(name.c_str(), name.length())) {
+			LOG(F("Path too long: "));
+			LOGLN(name);
+			continue;
+		}
+		++nMatches;
+		func(match);
+	}
+	if (nMatches)
+		return true;
+	LOG(userPath);
+	LOGLN(F(" doesn't match anything"));
+	return false;
+}
+
+bool DEBUG::cmdZwrite(LFSECommand& cmd) {
+	return zwrite(cmd, false);
+}
+bool DEBUG::cmdZappend(LFSECommand& cmd) {
+	return zwrite(cmd, true);
+}
+// Same as tee, but stores content in LFZ file, it can also be taken from a plain file
+bool DEBUG::zwrite(LFSECommand& cmd, bool append) {
+	cmd.parseArgs();
+	const LFSECommand::Arg* fromArg = cmd.takeLongFlagValue("from");
+	if (checkMissingOperand(cmd))
+		return false;
+	uint8_t filePathArgIdx = cmd.getArgFirstFilenameOrLastArgIdx();
+	const char* userPath = cmd._args[filePathArgIdx].c_str();
+	LFSEPath filePath, fromPath;
+	if (checkInvalidFilePath(userPath) || checkPathTooLong(userPath, filePath))
+		return false;
+	File fFrom;
+	if (fromArg) {
+		if (checkInvalidFilePath(fromArg->c_str()) || checkPathTooLong(fromArg->c_str(), fromPath) || checkDoesntExist(fromPath))
+			return false;
+		fFrom = LittleFS.open(fromPath, "r");
+		if (checkIsADir(fFrom, fromPath))
+			return false;
+	}
+	bool newLines = !cmd.isSingleLetterFlagPresent('n');
+
+	LFSELzFileWriter writer;
+	if (!writer.open(filePath, append)) {
+		LOG(F("Failed to open LFZ file "));
+		LOGLN(filePath);
+		return false;
+	}
+	bool dirty = false;
+	for (uint8_t i = filePathArgIdx; i < cmd._args.size(); ++i) {
+		LFSECommand::Arg& arg = cmd._args[i];
+		if (arg.isTypeString()) {
+			dirty = true;
+			writer.write(arg.value.c_str(), arg.value.length());
+			wearAddLogical(arg.value.length());
+			if (newLines)
+				wearAddLogical(writer.println());
+		}
+	}
+	if (fFrom) {
+		dirty = true;
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		while (size_t nBytes = fFrom.read(buffer, LFSE_FILE_BUFFER_LENGTH)) {
+			writer.write(buffer, nBytes);
+			wearAddLogical(nBytes);
+		}
+		fFrom.close();
+	}
+	if (!writer.close()) {
+		LOG(F("Failed to write LFZ file "));
+		LOGLN(filePath);
+		return false;
+	}
+	if (!dirty) {
+		LOGLN(F("Missing data to write"));
+		return false;
+	}
+	return true;
+}
+
+bool DEBUG::cmdSig(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (checkMissingOperand(cmd, 2))
+		return false;
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
+	uint32_t blockSize = strtoul(cmd._args[cmd.getArgLastFilenameIdx()].c_str(), nullptr, 10);
+	if (blockSize < LFSE_SIG_MIN_BLOCK_LENGTH || blockSize > LFSE_SIG_MAX_BLOCK_LENGTH) {
+		LOGF("sig: block size should be in range [%u, %u]\r\n", LFSE_SIG_MIN_BLOCK_LENGTH, LFSE_SIG_MAX_BLOCK_LENGTH);
+		return false;
+	}
+	LFSEPath filePath;
+	if (checkInvalidFilePath(userPath) || checkPathTooLong(userPath, filePath) || checkDoesntExist(filePath))
+		return false;
+	File f = LittleFS.open(filePath, "r");
+	if (checkIsADir(f, filePath))
+		return false;
+	uint8_t* buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_FILE_PAGE_LENGTH));
+	if (!buffer)
+		return false;
+	// header line, then a line per block: weak and strong checksum
+	OUTF("sig %u %u\r\n", (unsigned int)blockSize, (unsigned int)f.size());
+	LFSERollingChecksum weak;
+	uint64_t strong = LFSE_FNV64_OFFSET;
+	while (true) {
+		size_t nBytes = f.read(buffer, min((size_t)LFSE_FILE_PAGE_LENGTH, (size_t)(blockSize - weak.length)));
+		weak.update(buffer, nBytes);
+		strong = lfseFnv64(buffer, nBytes, strong);
+		if (weak.length && (weak.length == blockSize || !nBytes)) {
+			OUTF("%08x %08x%08x\r\n", (unsigned int)weak.value(), (unsigned int)(strong >> 32), (unsigned int)strong);
+			weak.reset();
+			strong = LFSE_FNV64_OFFSET;
+		}
+		if (!nBytes)
+			break;
+	}
+	lfseArena.deallocate(buffer, LFSE_FILE_PAGE_LENGTH);
+	f.close();
+	return true;
+}
+bool DEBUG::cmdPatch(LFSECommand& cmd) {
+	cmd.parseArgs();
+	LFSEPath filePath, tmpPath;
+	File fOld;
+	uint8_t* buffer = nullptr;
+	// the delta stream follows the command line, it mustn't be taken for commands if the patch can't start
+	if (!patchPrepare(cmd, filePath, tmpPath, fOld) || !(buffer = static_cast<uint8_t*>(lfseArena.allocate(LFSE_FILE_PAGE_LENGTH)))) {
+		_drainInput(_UART_);
+		return false;
+	}
+	LFSEFile fNew = fsOpen(tmpPath, "w");
+	bool ok = fNew && patchApply(_UART_, fOld, fNew, buffer);
+	uint32_t newSize = fNew.size();
+	fOld.close();
+	fNew.close();
+	// littlefs replaces the old file atomically on rename, so it's never seen half-patched
+	ok = ok && fsRename(tmpPath, filePath);
+	if (ok) {
+		OUTF("patch: %s rebuilt, %u bytes\r\n", filePath.c_str(), (unsigned int)newSize);
+	} else {
+		LOGLN(F("patch: failed, file left untouched"));
+		fsRemove(tmpPath);
+		_drainInput(_UART_, buffer, LFSE_FILE_PAGE_LENGTH);
+	}
+	lfseArena.deallocate(buffer, LFSE_FILE_PAGE_LENGTH);
+	return ok;
+}
+// Resolves the file to patch and the temporary one next to it, and opens the old file if there's one
+bool DEBUG::patchPrepare(LFSECommand& cmd, LFSEPath& filePath, LFSEPath& tmpPath, File& fOld) {
+	if (checkMissingOperand(cmd))
+		return false;
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg().c_str();
+	if (checkInvalidFilePath(userPath) || checkPathTooLong(userPath, filePath))
+		return false;
+	tmpPath = filePath;
+	tmpPath.popToken();
+	if (!tmpPath.pushToken(LFSE_PATCH_TMP_NAME, strlen(LFSE_PATCH_TMP_NAME))) {
+		LOG(F("Path too long: "));
+		LOGLN(filePath);
+		return false;
+	}
+	// the old file is optional, a delta of literals only creates a new one
+	fOld = LittleFS.open(filePath, "r");
+	return !fOld || !checkIsADir(fOld, filePath);
+}
+inline static bool _readLE(Stream& in, uint8_t nBytes, uint32_t& value) {
+	uint8_t bytes[4];
+	if (in.readBytes(reinterpret_cast<char*>(bytes), nBytes) != nBytes)
+		return false;
+	value = 0;
+	while (nBytes--)
+		value = value << 8 | bytes[nBytes];
+	return true;
+}
+// Builds the new file from the delta stream (see lfsehash.h) and verifies its checksum
+bool DEBUG::patchApply(Stream& in, File& fOld, LFSEFile& fNew, uint8_t* buffer) {
+	uint32_t blockSize;
+	if (in.readBytes(reinterpret_cast<char*>(buffer), 4) != 4 || memcmp(buffer, LFSE_DELTA_MAGIC, 4) || !_readLE(in, 2, blockSize)) {
+		LOGLN(F("patch: not a delta stream"));
+		return false;
+	}
+	uint64_t strong = LFSE_FNV64_OFFSET;
+	while (true) {
+		char op;
+		if (!in.readBytes(&op, 1))
+			break;
+		uint32_t value;
+		if (op == LFSE_DELTA_OP_END) {
+			uint32_t high, low;
+			if (!_readLE(in, 4, low) || !_readLE(in, 4, high))
+				break;
+			if (((uint64_t)high << 32 | low) == strong)
+				return true;
+			LOGLN(F("patch: checksum mismatch"));
+			return false;
+		}
+		if (op == LFSE_DELTA_OP_COPY && _readLE(in, 4, value)) {
+			if (!fOld || !fOld.seek(value * blockSize)) {
+				LOGLN(F("patch: copied block is out of the old file"));
+				return false;
+			}
+			for (uint32_t nLeft = blockSize; nLeft; ) {
+				size_t nBytes = fOld.read(buffer, min((size_t)LFSE_FILE_PAGE_LENGTH, (size_t)nLeft));
+				if (!nBytes)
+					break; // the last block might be shorter
+				if (fNew.write(buffer, nBytes) != nBytes)
+					return false;
+				strong = lfseFnv64(buffer, nBytes, strong);
+				nLeft -= nBytes;
+			}
+			continue;
+		}
+		if (op == LFSE_DELTA_OP_LITERAL && _readLE(in, 2, value)) {
+			while (value) {
+				size_t nBytes = in.readBytes(reinterpret_cast<char*>(buffer), min((size_t)LFSE_FILE_PAGE_LENGTH, (size_t)value));
+				if (!nBytes || fNew.write(buffer, nBytes) != nBytes)
+					return false;
+				wearAddLogical(nBytes);
+				strong = lfseFnv64(buffer, nBytes, strong);
+				value -= nBytes;
+			}
+			continue;
+		}
+		break;
+	}
+	LOGLN(F("patch: malformed delta stream"));
+	return false;
+}
+
+bool DEBUG::cmdKv(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (checkMissingOperand(cmd))
+		return false;
+	uint8_t subIdx = cmd.getArgFirstFilenameOrLastArgIdx();
+	const char* sub = cmd._args[subIdx].c_str();
+	if (!strcmp(sub, "bench")) {
+		uint8_t nArgIdx = cmd.getArgFirstFilenameOrLastArgIdx(subIdx + 1);
+		const char* nArg = cmd.getArgFirstFilenameOrLastArg(subIdx + 1).c_str();
+		const char* sizeArg = nArg[0] ? cmd.getArgFirstFilenameOrLastArg(nArgIdx + 1).c_str() : "";
+		return kvBench(nArg[0] ? strtoul(nArg, nullptr, 10) : 16, sizeArg[0] ? strtoul(sizeArg, nullptr, 10) : 16);
+	}
+	if (!lfseKV.refresh(LFSE_KV_PATH)) {
+		LOGLN(F("kv: failed to mount " LFSE_KV_PATH));
+		return false;
+	}
+	if (!strcmp(sub, "list")) {
+		lfseKV.list(*lfseOut);
+		return true;
+	}
+	if (!strcmp(sub, "compact")) {
+		if (!lfseKV.compact()) {
+			LOGLN(F("kv: compaction failed"));
+			return false;
+		}
+		return true;
+	}
+	if (!strcmp(sub, "stat")) {
+		OUTF("keys: %u / %u\r\n", lfseKV._nKeys, LFSE_KV_MAX_KEYS - LFSE_KV_MAX_KEYS / 8);
+		OUTF("log size: %u\r\n", (unsigned int)lfseKV._size);
+		OUTF("live bytes: %u\r\n", (unsigned int)lfseKV._liveBytes);
+		return true;
+	}
+
+	const char* key = cmd.getArgFirstFilenameOrLastArg(subIdx + 1).c_str();
+	if (!*key) {
+		LOGLN(F("Missing operand"));
+		return false;
+	}
+	if (strlen(key) > LFSE_KV_MAX_KEY_LENGTH) {
+		LOGF("kv: key should be no longer than %u\r\n", LFSE_KV_MAX_KEY_LENGTH);
+		return false;
+	}
+	if (!strcmp(sub, "get")) {
+		if (!lfseKV.get(key, lfseOut)) {
+			LOG(F("kv: no such key: "));
+			LOGLN(key);
+			return false;
+		}
+		OUTLN();
+	} else if (!strcmp(sub, "set")) {
+		const LFSECommand::Arg* value = nullptr;
+		for (const LFSECommand::Arg& arg : cmd._args) {
+			if (arg.isTypeString()) {
+				value = &arg;
+				break;
+			}
+		}
+		if (!value) {
+			LOGLN(F("Missing data to write"));
+			return false;
+		}
+		if (!lfseKV.set(key, reinterpret_cast<const uint8_t*>(value->c_str()), value->value.length())) {
+			LOGLN(lfseKV.isFull() ? F("kv: store is full") : F("kv: failed to write log"));
+			return false;
+		}
+	} else if (!strcmp(sub, "del")) {
+		if (!lfseKV.del(key)) {
+			LOG(F("kv: no such key: "));
+			LOGLN(key);
+			return false;
+		}
+	} else {
+		LOG(F("kv: unknown subcommand "));
+		LOGLN(sub);
+		return false;
+	}
+	return true;
+}
+// Discards everything, so that reading can be timed without the output
+struct _LFSENullPrint : Print {
+	size_t write(uint8_t) override { return 1; }
+	size_t write(const uint8_t*, size_t size) override { return size; }
+};
+// Runs the same set/update/get sequence against a file per key and against the log,
+// prints time per operation and estimated flash writes (see wear) of each
+bool DEBUG::kvBench(uint16_t n, uint16_t valueLength) {
+	static const char dirPath[] = "/.kvbench";
+	static const char logPath[] = "/.kvbench.log";
+	static const char* const phases[] = { "set", "update", "get" };
+	uint16_t maxN = LFSE_KV_MAX_KEYS - LFSE_KV_MAX_KEYS / 8;
+	if (!n || n > maxN) {
+		LOGF("kv: number of keys should be in range [1, %u]\r\n", maxN);
+		return false;
+	}
+	if (!valueLength || valueLength > LFSE_KV_BENCH_MAX_VALUE_LENGTH) {
+		LOGF("kv: value size should be in range [1, %u]\r\n", LFSE_KV_BENCH_MAX_VALUE_LENGTH);
+		return false;
+	}
+	if (checkAlreadyExists(dirPath) || checkAlreadyExists(logPath))
+		return false;
+	LFSEKVStore* store = static_cast<LFSEKVStore*>(lfseArena.allocate(sizeof(LFSEKVStore), alignof(LFSEKVStore)));
+	if (!store)
+		return false;
+	bool ok = fsMkdir(dirPath) && store->mount(logPath);
+	if (ok) {
+		_LFSENullPrint nullOut;
+		char path[sizeof(dirPath) + 8], key[8], value[LFSE_KV_BENCH_MAX_VALUE_LENGTH];
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		OUTLN(F("phase  store  us/op  programmed  commits"));
+		for (uint8_t phase = 0; phase < 3; ++phase) {
+			for (uint8_t useLog = 0; useLog < 2; ++useLog) {
+				LFSEWearStats before = *lfseWearCurrent;
+				uint32_t start = micros();
+				for (uint16_t i = 0; i < n; ++i) {
+					snprintf(key, sizeof(key), "k%u", i);
+					snprintf(path, sizeof(path), "%s/%s", dirPath, key);
+					// each phase writes different values
+					memset(value, '0' + phase, valueLength);
+					memcpy(value, key, min((size_t)valueLength, strlen(key)));
+					if (useLog && phase == 2) {
+						store->get(key, &nullOut);
+					} else if (useLog) {
+						store->set(key, reinterpret_cast<const uint8_t*>(value), valueLength);
+					} else if (phase == 2) {
+						File f = LittleFS.open(path, "r");
+						while (f.read(buffer, LFSE_FILE_BUFFER_LENGTH));
+						f.close();
+					} else {
+						LFSEFile f = fsOpen(path, "w");
+						f.write(reinterpret_cast<const uint8_t*>(value), valueLength);
+						f.close();
+					}
+				}
+				if (useLog)
+					lfseHandles.sync(); // what a burst of sets costs, files are committed as they're closed
+				uint32_t elapsed = micros() - start;
+				OUTF("%-6s %-5s %6u %11u %8u\r\n", phases[phase], useLog ? "log" : "files", (unsigned int)(elapsed / n),
+					(unsigned int)(lfseWearCurrent->programBytes - before.programBytes),
+					(unsigned int)(lfseWearCurrent->metaCommits - before.metaCommits));
+			}
+		}
+	} else {
+		LOGLN(F("kv: failed to prepare benchmark"));
+	}
+	store->unmount();
+	lfseArena.deallocate(store, sizeof(LFSEKVStore));
+	char path[sizeof(dirPath) + 8];
+	for (uint16_t i = 0; i < n; ++i) {
+		snprintf(path, sizeof(path), "%s/k%u", dirPath, i);
+		fsRemove(path);
+	}
+	fsRmdir(dirPath);
+	fsRemove(logPath);
+	return ok;
+}
+
+bool DEBUG::cmdRlog(LFSECommand& cmd) {
+	cmd.parseArgs();
+	if (checkMissingOperand(cmd, 2))
+		return false;
+	uint8_t subIdx = cmd.getArgFirstFilenameOrLastArgIdx();
+	const char* sub = cmd._args[subIdx].c_str();
+	uint8_t pathIdx = cmd.getArgFirstFilenameOrLastArgIdx(subIdx + 1);
+	const char* userPath = cmd.getArgFirstFilenameOrLastArg(subIdx + 1).c_str();
+	LFSEPath dirPath;
+	if (checkInvalidDirPath(userPath) || checkPathTooLong(userPath, dirPath))
+		return false;
+
+	if (!strcmp(sub, "create")) {
+		uint32_t size = strtoul(cmd.getArgFirstFilenameOrLastArg(pathIdx + 1).c_str(), nullptr, 10);
+		if (size < LFSE_RLOG_SEGMENTS * LFSE_RLOG_MIN_SEGMENT_LENGTH) {
+			LOGF("rlog: size should be at least %u\r\n", LFSE_RLOG_SEGMENTS * LFSE_RLOG_MIN_SEGMENT_LENGTH);
+			return false;
+		}
+		LFSEPath headerPath = dirPath;
+		if (checkAlreadyExists(dirPath) || !rlogSegmentPath(dirPath, 0, headerPath))
+			return false;
+		headerPath.popToken();
+		headerPath.pushToken(LFSE_RLOG_HEADER_NAME, strlen(LFSE_RLOG_HEADER_NAME));
+		if (!fsMkdir(dirPath)) {
+			LOG(F("Failed to create directory "));
+			LOGLN(dirPath);
+			return false;
+		}
+		LFSERingLogHeader header = { { 0 }, size / LFSE_RLOG_SEGMENTS, LFSE_RLOG_SEGMENTS };
+		memcpy(header.magic, LFSE_RLOG_MAGIC, sizeof(header.magic));
+		LFSEFile f = fsOpen(headerPath, "w");
+		if (!f || f.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) != sizeof(header)) {
+			LOG(F("Failed to write file "));
+			LOGLN(headerPath);
+			return false;
+		}
+		return true;
+	}
+
+	LFSERingLogHeader header;
+	if (checkDoesntExist(dirPath) || !rlogReadHeader(dirPath, header))
+		return false;
+	uint32_t first, last;
+	uint16_t nFound = rlogScan(dirPath, first, last);
+	LFSEPath segmentPath;
+
+	if (!strcmp(sub, "cat")) {
+		// segments are streamed oldest to newest straight to the output
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		for (uint32_t seq = first; nFound && seq <= last; ++seq) {
+			if (!rlogSegmentPath(dirPath, seq, segmentPath) || !LittleFS.exists(segmentPath))
+				continue;
+			File f = LittleFS.open(segmentPath, "r");
+			while (size_t nBytes = f.read(buffer, LFSE_FILE_BUFFER_LENGTH))
+				lfseOut->write(buffer, nBytes);
+			f.close();
+		}
+		return true;
+	}
+	if (strcmp(sub, "append")) {
+		LOG(F("rlog: unknown subcommand "));
+		LOGLN(sub);
+		return false;
+	}
+
+	bool newLines = !cmd.isSingleLetterFlagPresent('n');
+	uint32_t length = 0;
+	for (uint8_t i = pathIdx; i < cmd._args.size(); ++i) {
+		if (cmd._args[i].isTypeString())
+			length += cmd._args[i].value.length() + (newLines ? 2 : 0);
+	}
+	if (!length) {
+		LOGLN(F("Missing data to write"));
+		return false;
+	}
+	// a record is never split, one longer than a segment would make the ring bigger than it was created
+	if (length > header.segmentLength) {
+		LOGF("rlog: record of %u bytes is longer than a segment (%u bytes)\r\n", (unsigned int)length, (unsigned int)header.segmentLength);
+		return false;
+	}
+	if (!nFound)
+		first = last = 0;
+	if (!rlogSegmentPath(dirPath, last, segmentPath))
+		return false;
+	uint32_t segmentSize = 0;
+	if (nFound && LittleFS.exists(segmentPath)) {
+		File f = LittleFS.open(segmentPath, "r");
+		segmentSize = f.size();
+		f.close();
+	}
+	// content isn't split between segments, so that each of them starts with a whole line
+	if (segmentSize && segmentSize + length > header.segmentLength) {
+		++last;
+		// free the space first, the ring never takes more than nSegments segments
+		for (; nFound && first + header.nSegments <= last; ++first) {
+			if (rlogSegmentPath(dirPath, first, segmentPath))
+				fsRemove(segmentPath);
+		}
+		if (!rlogSegmentPath(dirPath, last, segmentPath))
+			return false;
+	}
+	LFSEFile f = fsOpen(segmentPath, "a");
+	if (!f) {
+		LOG(F("Failed to open file "));
+		LOGLN(segmentPath);
+		return false;
+	}
+	for (uint8_t i = pathIdx; i < cmd._args.size(); ++i) {
+		LFSECommand::Arg& arg = cmd._args[i];
+		if (arg.isTypeString()) {
+			f.write(arg.value.c_str(), arg.value.length());
+			if (newLines)
+				f.println();
+		}
+	}
+	f.close();
+	wearAddLogical(length);
+	return true;
+}
+bool DEBUG::rlogReadHeader(const LFSEPath& dirPath, LFSERingLogHeader& header) {
+	LFSEPath headerPath = dirPath;
+	File f;
+	if (headerPath.pushToken(LFSE_RLOG_HEADER_NAME, strlen(LFSE_RLOG_HEADER_NAME)) && LittleFS.exists(headerPath))
+		f = LittleFS.open(headerPath, "r");
+	bool ok = f && f.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) == sizeof(header)
+		&& !memcmp(header.magic, LFSE_RLOG_MAGIC, sizeof(header.magic)) && header.nSegments && header.segmentLength;
+	f.close();
+	if (!ok) {
+		LOG(dirPath);
+		LOGLN(F(" is not a ring log"));
+	}
+	return ok;
+}
+// Finds the oldest and the newest segments, returns the number of segments
+uint16_t DEBUG::rlogScan(const LFSEPath& dirPath, uint32_t& first, uint32_t& last) {
+	uint16_t nFound = 0;
+	first = UINT32_MAX;
+	last = 0;
+	Dir dir = LittleFS.openDir(dirPath);
+	while (dir.next()) {
+		String name = dir.fileName();
+		char* end;
+		uint32_t seq = strtoul(name.c_str(), &end, 16);
+		if (name.length() != 8 || *end || !dir.isFile())
+			continue;
+		first = min(first, seq);
+		last = max(last, seq);
+		++nFound;
+	}
+	return nFound;
+}
+bool DEBUG::rlogSegmentPath(const LFSEPath& dirPath, uint32_t seq, LFSEPath& path) {
+	char name[9];
+	snprintf(name, sizeof(name), "%08x", (unsigned int)seq);
+	path = dirPath;
+	if (path.pushToken(name, 8))
+		return true;
+	LOG(F("Path too long: "));
+	LOGLN(dirPath);
+	return false;
+}
+
+// Makes the command the one the wear is charged to
+void DEBUG::wearBegin(const char* cmd) {
+	lfseWearCurrent = &lfseWear[LFSE_WEAR_MAX_COMMANDS - 1]; // the last one collects the rest
+	for (uint8_t i = 0; i < LFSE_WEAR_MAX_COMMANDS - 1; ++i) {
+		if (!lfseWear[i].cmd)
+			lfseWear[i].cmd = cmd;
+		if (lfseWear[i].cmd == cmd) {
+			lfseWearCurrent = &lfseWear[i];
+			break;
+		}
+	}
+	++lfseWearCurrent->calls;
+}
+uint32_t DEBUG::wearBlockSize() {
+	if (!lfseWearBlockSize) {
+		FSInfo info;
+		lfseWearBlockSize = LittleFS.info(info) && info.blockSize ? info.blockSize : 4096;
+	}
+	return lfseWearBlockSize;
+}
+LFSEFile DEBUG::fsOpen(const char* path, const char* mode) {
+	lfseHandles.invalidate(path);
+	LFSEFile f = openCounted(path, mode);
+	if (!f || (mode[0] == 'r' && mode[1] != '+'))
+		return f;
+	f._journal = true;
+	// creating or truncating is a change even if nothing gets written, an empty file might be new
+	if (mode[0] == 'w' || (mode[0] == 'a' && !f.size()))
+		f.journalWrite();
+	return f;
+}
+LFSEFile DEBUG::openCounted(const char* path, const char* mode) {
+	bool created = mode[0] != 'r' && !LittleFS.exists(path);
+	LFSEFile f(LittleFS.open(path, mode));
+	if (f && created) { // littlefs commits the entry of a new file right away
+		++lfseWearCurrent->metaCommits;
+	} else if (f && mode[0] == 'w') { // file is truncated
+		f._dirty = true;
+		f._firstWriteOffset = 0;
+	}
+	f._append = mode[0] == 'a';
+	return f;
+}
+bool DEBUG::fsRemove(const char* path) {
+	lfseHandles.invalidate(path);
+	if (!LittleFS.remove(path))
+		return false;
+	++lfseWearCurrent->metaCommits;
+	lfseJournal.record(LFSEJournal::REMOVE, path);
+	return true;
+}
+bool DEBUG::fsRename(const char* pathFrom, const char* pathTo) {
+	lfseHandles.invalidate(pathFrom);
+	lfseHandles.invalidate(pathTo);
+	if (!LittleFS.rename(pathFrom, pathTo))
+		return false;
+	// the entry is committed to the new parent, and deleted from the old one by another commit if that's another directory
+	const char* nameFrom = strrchr(pathFrom, '/');
+	const char* nameTo = strrchr(pathTo, '/');
+	bool sameDir = nameFrom - pathFrom == nameTo - pathTo && !strncmp(pathFrom, pathTo, nameFrom - pathFrom);
+	lfseWearCurrent->metaCommits += sameDir ? 1 : 2;
+	lfseJournal.record(LFSEJournal::MOVE, pathFrom, pathTo);
+	return true;
+}
+bool DEBUG::fsMkdir(const char* path) {
+	if (!LittleFS.mkdir(path))
+		return false;
+	// the new metadata pair gets its first commit, which erases a block of it, then the parent gets the entry
+	++lfseWearCurrent->eraseOps;
+	lfseWearCurrent->metaCommits += 2;
+	lfseJournal.record(LFSEJournal::MKDIR, path);
+	return true;
+}
+bool DEBUG::fsMkdirs(const LFSEPath& path, uint8_t nExisting) {
+	char prefix[LFSE_PATH_MAX_LENGTH + 1];
+	strcpy(prefix, path);
+	for (uint8_t i = nExisting; i < path.tokensCount(); ++i) {
+		uint8_t end = i + 1 < path.tokensCount() ? path._tokenOffsets[i + 1] : path._length;
+		char c = prefix[end];
+		prefix[end] = '\0';
+		bool ok = LittleFS.exists(prefix) || fsMkdir(prefix);
+		prefix[end] = c;
+		if (!ok)
+			return false;
+	}
+	return true;
+}
+bool DEBUG::fsRmdir(const char* path) {
+	lfseHandles.invalidate(path);
+	if (!LittleFS.rmdir(path))
+		return false;
+	// the entry goes from the parent, then the pair is dropped from the list of metadata pairs
+	lfseWearCurrent->metaCommits += 2;
+	lfseJournal.record(LFSEJournal::RMDIR, path);
+	return true;
+}
+bool DEBUG::fsFormat() {
+	lfseHandles.clear();
+	if (!lfseJournal._mounted) // the journal goes too, but its numbering has to go on
+		lfseJournal.mount();
+	if (!LittleFS.format())
+		return false;
+	lfseKV.unmount();
+	lfseScrub.pass = 0;
+	lfseScrubDirty = false;
+	// lfs_format erases and commits the root pair only, other blocks are erased when they're allocated
+	lfseWearCurrent->eraseOps += 2;
+	lfseWearCurrent->metaCommits += 2;
+	lfseJournal._size = 0;
+	lfseJournal.record(LFSEJournal::FORMAT, "/");
+	return true;
+}
+
+void DEBUG::logExecutedCommand(const LFSECommand& cmd) {
+	LOG(lfsePath.c_str());
+	LOG(F("$ "));
+	LOGLN(cmd);
+}
+// Returns false if there's no such command, succeeded tells whether the command itself did its job
+bool DEBUG::handleCommand(uint16_t length, bool echo, bool* succeeded) {
+	if (succeeded)
+		*succeeded = false;
+	if (!length || length >= LFSE_SERIAL_BUFFER_LENGTH)
+		return true;
+
+	LFSECommand cmd(lfseBuffer, length);
+	auto search = lfseCmdMap.find(cmd._cmd.c_str());
+	if (echo)
+		logExecutedCommand(cmd);
+	if (search == lfseCmdMap.end()) {
+		LOG(F("Error: command "));
+		LOG(cmd._cmd.c_str());
+		LOGLN(F(" not found!"));
+		return false;
+	}
+	// anything but tee and kv, which reads its log through the cached handle, may read the files written
+	// by the cached appends, the cost goes to the appends
+	if (strcmp(search->first.c_str(), "tee") && strcmp(search->first.c_str(), "kv"))
+		lfseHandles.sync();
+	wearBegin(search->first.c_str());
+	Print* out = lfseOut;
+	if (cmd.isRedirected() && !beginRedirect(cmd))
+		return true;
+	bool ok = std::get<0>(search->second)(cmd);
+	if (cmd.isRedirected())
+		endRedirect(out);
+	if (succeeded)
+		*succeeded = ok;
+	return true;
+}
+// Runs "@<id> <command>" line with the output framed, see LFSEFrameWriter
+void DEBUG::handleMachineCommand(uint16_t length, bool tooLong) {
+	lfseBuffer[length] = '\0';
+	char* end;
+	uint32_t id = strtoul(lfseBuffer + 1, &end, 10);
+	lfseFrame.begin(&_UART_, id);
+	if (tooLong || end == lfseBuffer + 1 || *end != ' ') {
+		lfseFrame.end(LFSEFrameWriter::STATUS_BAD_REQUEST);
+		return;
+	}
+	uint16_t prefixLength = end + 1 - lfseBuffer;
+	memmove(lfseBuffer, end + 1, length - prefixLength);
+	lfseOut = &lfseFrame._out;
+	lfseErr = &lfseFrame._err;
+	bool succeeded;
+	bool found = handleCommand(length - prefixLength, false, &succeeded);
+	lfseOut = lfseErr = &_UART_;
+	lfseFrame.end(!found ? LFSEFrameWriter::STATUS_NOT_FOUND
+		: succeeded ? LFSEFrameWriter::STATUS_OK : LFSEFrameWriter::STATUS_ERROR);
+}
+
+// Resolves redirection target and points lfseOut to it
+bool DEBUG::beginRedirect(const LFSECommand& cmd) {
+	LFSEPath filePath;
+	if (checkInvalidFilePath(cmd._redirectPath.c_str()) || checkPathTooLong(cmd._redirectPath.c_str(), filePath))
+		return false;
+	if (LittleFS.exists(filePath)) {
+		File f = LittleFS.open(filePath, "r");
+		bool isDir = checkIsADir(f, filePath);
+		f.close();
+		if (isDir)
+			return false;
+	}
+	if (!lfseRedirectWriter.open(filePath, cmd._redirectAppend)) {
+		LOG(F("Failed to open file "));
+		LOGLN(filePath);
+		return false;
+	}
+	lfseOut = &lfseRedirectWriter;
+	return true;
+}
+void DEBUG::endRedirect(Print* out) {
+	lfseRedirectWriter.close();
+	lfseOut = out;
+}
+
+// Drops the rest of the line byte by byte, so that nothing of it has to be buffered
+inline static void _skipLine(Stream& in) {
+	char c;
+	while (in.readBytes(&c, 1) && c != '\n');
+}
+void DEBUG::syncIdleFiles() {
+	if (millis() - lfseHandles._lastWrite >= LFSE_HANDLE_CACHE_SYNC_MS)
+		lfseHandles.sync();
+}
+void DEBUG::LittleFSExplorer(const String& cmd) {
+	syncIdleFiles();
+	while (!cmd.isEmpty() || _UART_.available() > 0) {
+		size_t nBytesGot = cmd.isEmpty() ? _UART_.readBytesUntil('\n', lfseBuffer, LFSE_SERIAL_BUFFER_LENGTH) : 0;
+		if (!cmd.isEmpty()) {
+			for (const char& c : cmd)
+				lfseBuffer[nBytesGot++] = c;
+		}
+		if (nBytesGot == 0) {
+			LOGLN(F("Error: Could not read serial data: no valid data found!"));
+			return;
+		}
+		if (lfseBuffer[0] == '@') {
+			// the id is answered even if the line is too long, the rest of the line is dropped
+			bool tooLong = nBytesGot == LFSE_SERIAL_BUFFER_LENGTH;
+			if (tooLong)
+				_skipLine(_UART_);
+			handleMachineCommand(tooLong ? nBytesGot - 1 : nBytesGot, tooLong);
+			lfseArena.reset();
+			if (!cmd.isEmpty())
+				break;
+			continue;
+		}
+		if (nBytesGot == LFSE_SERIAL_BUFFER_LENGTH) {
+			LOGLN(F("Error: Too big command!"));
+			return;
+		}
+		handleCommand(nBytesGot);
+		lfseArena.reset();
+		if (!cmd.isEmpty()) {
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////
+
+// replaces if path is absolute, adds if relative
+bool LFSEPath::adjust(const char* path) {
+	if (!path || !*path)
+		return true;
+	if (!isValidFSPath(path))
+		return false;
+	// normalize into a copy, so that the path stays untouched if it doesn't fit
+	LFSEPath res;
+	if (path[0] != '/')
+		res = *this;
+	const char* token = path;
+	while (true) {
+		while (*token == '/')
+			++token;
+		if (!*token)
+			break;
+		const char* tokenEnd = token;
+		while (*tokenEnd && *tokenEnd != '/')
+			++tokenEnd;
+		size_t len = tokenEnd - token;
+		if (len == 2 && token[0] == '.' && token[1] == '.') {
+			res.popToken();
+		} else if (len != 1 || token[0] != '.') {
+			if (!res.pushToken(token, len))
+				return false;
+		}
+		token = tokenEnd;
+	}
+	*this = res;
+	return true;
+}
+
+String LFSEPath::toString(bool trailingSlash) const {
+	String res(_buffer);
+	if (trailingSlash && _length)
+		res += '/';
+	return res;
+}
+
+void LFSEPath::clear() {
+	_length = 0;
+	_nTokens = 0;
+	terminate();
+}
+bool LFSEPath::pushToken(const char* token, size_t len) {
+	if (_nTokens >= LFSE_PATH_MAX_TOKENS || _length + 1 + len > LFSE_PATH_MAX_LENGTH)
+		return false;
+	_tokenOffsets[_nTokens++] = _length;
+	_buffer[_length++] = '/';
+	memcpy(_buffer + _length, token, len);
+	_length += len;
+	terminate();
+	return true;
+}
+void LFSEPath::popToken() {
+	if (!_nTokens)
+		return;
+	_length = _tokenOffsets[--_nTokens];
+	terminate();
+}
+void LFSEPath::terminate() {
+	if (_length) {
+		_buffer[_length] = '\0';
+		return;
+	}
+	_buffer[0] = '/';
+	_buffer[1] = '\0';
+}
+
+////////////
+
+void LFSECommand::parseCmd() {
+	LFSEString token(_bufferLength);
+	uint16_t i = 0;
+	for (; i < _bufferLength; ++i) {
+		char c = _buffer[i];
+		if (!isValidFSNameChar(c))
+			break;
+		token += c;
+	}
+	_cmdBufferCursor = i;
+	token.shrinkToFit();
+	_cmd = token;
+	_cmd.toLowerCase();
+	parseRedirect();
+}
+// Looks for the first > or >> outside of string args,
+// takes the path after it and cuts it all off the args part of the buffer
+void LFSECommand::parseRedirect() {
+	bool insideString = false;
+	bool prevCharEscape = false;
+	for (uint16_t i = _cmdBufferCursor; i < _bufferLength; ++i) {
+		char c = _buffer[i];
+		if (insideString) {
+			if (prevCharEscape)
+				prevCharEscape = false;
+			else if (c == '\\')
+				prevCharEscape = true;
+			else if (c == '"')
+				insideString = false;
+			continue;
+		}
+		if (c == '"') {
+			insideString = true;
+			continue;
+		}
+		if (c != '>')
+			continue;
+		
+		uint16_t redirectIdx = i++;
+		_redirectAppend = i < _bufferLength && _buffer[i] == '>';
+		if (_redirectAppend)
+			++i;
+		while (i < _bufferLength && _buffer[i] == ' ')
+			++i;
+		LFSEString path(_bufferLength - i);
+		for (; i < _bufferLength && isValidFSPathChar(_buffer[i]); ++i)
+			path += _buffer[i];
+		path.shrinkToFit();
+		_redirectPath = path;
+		while (redirectIdx > _cmdBufferCursor && _buffer[redirectIdx - 1] == ' ')
+			--redirectIdx;
+		_bufferLength = redirectIdx;
+		return;
+	}
+}
+
+
+bool LFSECommand::isSingleLetterFlagPresent(char f) const {
+	for (const Arg& arg : _args) {
+		if (!arg.isTypeFlag() || arg.value.isEmpty() || arg.value[0] == '-') // skip --long flags
+			continue;
+		if (arg.value.indexOf(f) != -1)
+			return true;
+	}
+	return false;
+}
+
+bool LFSECommand::isLongFlagPresent(const char* name) const {
+	for (const Arg& arg : _args) {
+		if (arg.isFlagAndStartsWith('-') && !strcmp(arg.c_str() + 1, name))
+			return true;
+	}
+	return false;
+}
+// Finds --name flag and turns the arg right after it into its value,
+// so that it's not picked up as a filename anymore
+const LFSECommand::Arg* LFSECommand::takeLongFlagValue(const char* name) {
+	for (size_t i = 0; i + 1 < _args.size(); ++i) {
+		if (_args[i].isFlagAndStartsWith('-') && !strcmp(_args[i].c_str() + 1, name)) {
+			_args[i + 1].type = Arg::Type::FLAG_VALUE;
+			return &_args[i + 1];
+		}
+	}
+	return nullptr;
+}
+
+template <typename T> static T CastStringToNum(const char* s) { return static_cast<T>(strtol(s, nullptr, 10)); }
+template <> float CastStringToNum<float>(const char* s) { return atof(s); }
+template <> uint32_t CastStringToNum<uint32_t>(const char* s) { return strtoul(s, nullptr, 10); }
+template <typename T>
+T LFSECommand::getNumericalFlagValue(char f, const T& fallback) const {
+	for (const Arg& arg : _args) {
+		if (arg.isFlagAndStartsWith(f) && arg.value.length() > 1 && (isDigit(arg.value[1]) || arg.value[1] == '-')) {
+			return CastStringToNum<T>(arg.c_str() + 1);
+		}
+	}
+	return fallback;
+}
+
+uint8_t LFSECommand::getArgLastFilenameIdx() const {
+	for (uint8_t i = _args.size(); i > 0; --i) {
+		if (_args[i - 1].isTypeFilename()) {
+			return i - 1;
+		}
+	}
+	return 0xFF;
+}
+uint8_t LFSECommand::countArgs(Arg::Type type) const {
+	uint8_t n = 0;
+	for (const Arg& arg : _args) {
+		if (arg.type == type)
+			++n;
+	}
+	return n;
+}
+
+uint8_t LFSECommand::getArgFirstFilenameOrLastArgIdx(uint8_t startIdx) const {
+	for (uint8_t i = startIdx; i < _args.size(); ++i) {
+		if (_args[i].isTypeFilename()) {
+			return i;
+		}
+	}
+	return 0xFF;
+}
+
+const LFSECommand::Arg& LFSECommand::getArgFirstFilenameOrLastArg(uint8_t startIdx) const {
+	static const Arg noArg;
+	uint8_t idx = getArgFirstFilenameOrLastArgIdx(startIdx);
+	return idx < _args.size() ? _args[idx] : noArg;
+}
+
+// String str contains all chars before CRLF, but at most maxLen chars
 // String str doesn't contain CRLF unless addCRLF == true if returning true
 // String str can be nullptr, then number of bytes that've been read can be accessed via strLenOut
 // f.position() points to the char right after the CRLF sequence (if found), o/w to the (s.length()-1)th
 // maxLen can be 0, then there's no limit
 // ATTENTION! maxLen == 0 recommended only with str == nullptr
 // returns true if CRLF follows the (s.length()-1)th char, false o/w
-bool DEBUG::readLine(File& f, String* str, uint16_t maxLen, size_t* strLenOut, bool addCRLF) {
+template <typename FileLike>
+bool DEBUG::readLine(FileLike& f, LFSEString* str, uint16_t maxLen, size_t* strLenOut, bool addCRLF) {
 	// str can be nullptr, StringLike class handles it properly
 	// this allows cheaply skip lines using readLine(f, nullptr, 0)
 	StringLike s(str);
 	s.clear();
 
-	// problem with file
-	if (!f || !f.available()) {
-		if (strLenOut)
-			*strLenOut = 0;
+	// problem with file
+	if (!f || !f.available()) {
+		if (strLenOut)
+			*strLenOut = 0;
+		return false;
+	}
+
+	char lastChar = '\0';
+	bool brokeByLen = false; // TODO: use byte flags here
+	bool brokenByCRLF = false;
+	size_t originalPosition = f.position();
+	while (f.available()) {
+		if (maxLen && (s.length() >= maxLen + 2)) {
+			brokeByLen = true;
+			break;
+		}
+		char c = (char)f.read();
+		s += c;
+		if (c == '\n' && lastChar == '\r') {
+			brokenByCRLF = true;
+			break;
+		}
+		lastChar = c;
+	}
+
+	// s.length() == maxLen + 2
+	if (brokeByLen) {
+		// str cannot end with crlf
+		// even if str.last == cr, str.length is already too big,
+		// so in any case return false
+		s.cut(0, s.length() - 2);
+		f.seek(originalPosition + s.length());
+		if (strLenOut)
+			*strLenOut = s.length();
+		return false;
+	}
+
+	int16_t d = s.length() - maxLen;
+
+	// crlf are last 2 chars of s
+	if (brokenByCRLF) {
+		if (!addCRLF)
+			s.cut(0, s.length() - 2);
+		if (strLenOut)
+			*strLenOut = s.length();
+		return true;
+	}
+
+	// got to the end of file without seeing crlf
+	if (d > 0) { // exceeded maxLen
+		s.cut(0, maxLen);
+		f.seek(originalPosition + maxLen);
+	}
+	if (strLenOut)
+		*strLenOut = s.length();
+	return false;
+}
+// Same as readLine, but doesn't stop on CRLF
+// returns true if got to the end of file before exceeding maxLen
+template <typename FileLike>
+bool DEBUG::readChars(FileLike& f, LFSEString* str, uint16_t maxLen, size_t* strLenOut) {
+	// str can be nullptr, StringLike class handles it properly
+	StringLike s(str);
+	s.clear();
+	// problem with file
+	if (!f) {
+		return false;
+	}
+	
+	bool brokeByLen = false;
+	size_t originalPosition = f.position();
+	while (f.available()) {
+		if (maxLen && (s.length() >= maxLen)) {
+			brokeByLen = true;
+			break;
+		}
+		char c = (char)f.read();
+		s += c;
+	}
+
+	if (strLenOut)
+		*strLenOut = s.length();
+
+	// s.length() == maxLen
+	if (brokeByLen) {
+		return false;
+	}
+	// went to the end of file
+	return true;
+}
+
+void LFSECommand::parseArgs() {
+	// TODO: double check how the unpaired quotes are handled
+	if (_argsParsed) {
+		return;
+	}
+	_args.clear();
+	if (!_cmdBufferCursor || _cmdBufferCursor >= _bufferLength) {
+		return;
+	}
+	_args.reserve(LFSE_ARGS_RESERVE);
+	Arg token;
+	bool prevCharEscape = false; // helps to detect escaped chars in string args
+	// token value can't get longer than the rest of the buffer
+	auto startToken = [&](Arg::Type type, uint16_t i) {
+		token.type = type;
+		token.value = LFSEString(_bufferLength - i);
+	};
+	auto addToken = [&](bool ignoreEmpty = true){
+		if (!token.value.isEmpty() || !ignoreEmpty) {
+			token.idx = _args.size();
+			token.value.shrinkToFit();
+			_args.push_back(std::move(token));
+			token = Arg();
+			return true;
+		}
+		return false;
+	};
+	auto strArgAddChar = [&](char c) {
+		token.value += c;
+		prevCharEscape = false;
+	};
+	for (uint16_t i = _cmdBufferCursor; i < _bufferLength; ++i) {
+		char c = _buffer[i];
+		if (token.isTypeFilename()) { // already filling filename arg
+			if (isValidFSPathChar(c)) {
+				token.value += c;
+				continue;
+			}
+			addToken(); // if not valid filename char -> save token
+			continue;
+		}
+		if (token.isTypeFlag()) { // already filling flag arg
+			if (isAlphaNumeric(c) || c == '-' || c == '.') { // flag args are alphanumeric or '-' or '.'
+				token.value += c;
+				continue;
+			}
+			addToken(); // if not valid flag char -> save token
+			continue;
+		}
+		if (token.isTypeString()) { // already filling string filename arg
+			if (c == '"') { // potentially end of string arg
+				if (prevCharEscape) { // no, it was escaped
+					strArgAddChar(c);
+					continue;
+				}
+				addToken(false); // was not escaped -> string ended -> save token
+				continue;
+			}
+			if (prevCharEscape) { // the char was escaped -> add correct symbol to token
+				switch(c) {
+					case '"':
+					case '\\':
+						strArgAddChar(c);
+						break;
+					case 'n':
+						strArgAddChar('\n');
+						break;
+					case 'r':
+						strArgAddChar('\r');
+						break;
+					case 't':
+						strArgAddChar('\t');
+						break;
+					default:
+						strArgAddChar('\\');
+						strArgAddChar(c);
+						break;
+				}
+				prevCharEscape = false;
+			} else {
+				if (c == '\\') { // escape symbol
+					prevCharEscape = true;
+					continue;
+				}
+				strArgAddChar(c);
+			}
+			continue;
+		}
+		// if none of above -> just started filling token
+		if (c == '"') { // only string args start with '"'
+			startToken(Arg::Type::STRING, i);
+			continue;
+		}
+		if (c == '-') { // flags start with '-'
+			startToken(Arg::Type::FLAG, i);
+			continue;
+		}
+		if (isValidFSPathChar(c) || c == '+') { // '+' leads numbers only, e.g. find -size +4k
+			startToken(Arg::Type::FILENAME, i);
+			token.value += c;
+		}
+		continue; // if no conditions met -> bullshit symbol
+	}
+	if (prevCharEscape) { // if '\' was the last symbol, add it
+		strArgAddChar('\\');
+	}
+	addToken(!token.isTypeString());
+	_argsParsed = true;
+}
+
+size_t LFSECommand::Arg::printTo(Print& p, bool onlyContent) const {
+	if (onlyContent)
+		return p.print(value.c_str());
+	size_t n = 0;
+	if (isTypeFlag())
+		n += p.print('-');
+	if (isTypeString())
+		n += p.print('"');
+	n += p.print(value.c_str());
+	if (isTypeString())
+		n += p.print('"');
+	return n;
+}
+
+size_t LFSECommand::printTo(Print& p) const {
+	size_t n = p.print(_cmd.c_str());
+	if (_argsParsed) {
+		for (const Arg& arg : _args) {
+			n += p.print(' ');
+			n += arg.printTo(p, false);
+		}
+	} else if (_cmdBufferCursor && _cmdBufferCursor < _bufferLength) {
+		n += p.write(_buffer + _cmdBufferCursor, _bufferLength - _cmdBufferCursor);
+	}
+	if (isRedirected()) {
+		n += p.print(_redirectAppend ? F(" >> ") : F(" > "));
+		n += p.print(_redirectPath.c_str());
+	}
+	return n;
+}
+
+////////////
+
+void* LFSEArena::allocate(size_t size, size_t align) {
+	size_t start = (_cursor + align - 1) & ~(align - 1);
+	if (start + size <= LFSE_ARENA_LENGTH) {
+		_cursor = start + size;
+		_peak = max(_peak, _cursor);
+		return _buffer + start;
+	}
+	// doesn't fit -> heap block prepended with a link to the previous one
+	const size_t headerSize = 8;
+	uint8_t* block = static_cast<uint8_t*>(malloc(headerSize + size));
+	if (!block)
+		return nullptr;
+	*reinterpret_cast<void**>(block) = _fallbacks;
+	_fallbacks = block;
+	++_nFallbacks;
+	return block + headerSize;
+}
+bool LFSEArena::shrink(void* ptr, size_t oldSize, size_t newSize) {
+	uint8_t* p = static_cast<uint8_t*>(ptr);
+	if (!owns(p) || p + oldSize != _buffer + _cursor || newSize > oldSize)
 		return false;
+	_cursor -= oldSize - newSize;
+	return true;
+}
+void LFSEArena::reset() {
+	_cursor = 0;
+	while (_fallbacks) {
+		void* next = *reinterpret_cast<void**>(_fallbacks);
+		free(_fallbacks);
+		_fallbacks = next;
 	}
+}
 
-	char lastChar = '\0';
-	bool brokeByLen = false; // TODO: use byte flags here
-	bool brokenByCRLF = false;
-	size_t originalPosition = f.position();
-	while (f.available()) {
-		if (maxLen && (s.length() >= maxLen + 2)) {
-			brokeByLen = true;
+LFSEString::LFSEString(uint16_t capacity) {
+	_buffer = static_cast<char*>(DEBUG::lfseArena.allocate(capacity + 1, 1));
+	if (!_buffer)
+		return;
+	_capacity = capacity;
+	_buffer[0] = '\0';
+}
+int LFSEString::indexOf(char c, size_t from) const {
+	for (size_t i = from; i < _length; ++i)
+		if (_buffer[i] == c)
+			return i;
+	return -1;
+}
+LFSEString& LFSEString::operator+=(char c) {
+	if (_length < _capacity) {
+		_buffer[_length++] = c;
+		_buffer[_length] = '\0';
+	}
+	return *this;
+}
+void LFSEString::clear() {
+	_length = 0;
+	if (_buffer)
+		_buffer[0] = '\0';
+}
+void LFSEString::cut(size_t left, size_t right) {
+	right = min(right, (size_t)_length);
+	if (left >= right) {
+		clear();
+		return;
+	}
+	memmove(_buffer, _buffer + left, right - left);
+	_length = right - left;
+	_buffer[_length] = '\0';
+}
+void LFSEString::toLowerCase() {
+	for (uint16_t i = 0; i < _length; ++i)
+		_buffer[i] = tolower(_buffer[i]);
+}
+void LFSEString::shrinkToFit() {
+	if (!_buffer)
+		return;
+	size_t newSize = _length ? _length + 1 : 0;
+	if (!DEBUG::lfseArena.shrink(_buffer, _capacity + 1, newSize))
+		return;
+	_capacity = _length;
+	if (!newSize)
+		_buffer = nullptr;
+}
+
+////////////
+
+bool LFSETreeWalker::begin(const char* root, bool childrenFirst) {
+	_path.clear();
+	_truncated = false;
+	_entryPushed = false;
+	_descendPending = false;
+	_childrenFirst = childrenFirst;
+	_leaving = false;
+	memset(_positions, 0, sizeof(_positions));
+	if (!_path.adjust(root))
+		return false;
+	_dirs[0] = LittleFS.openDir(_path);
+	_depth = 1;
+	return true;
+}
+bool LFSETreeWalker::resume(const uint16_t* positions) {
+	for (uint8_t level = 0; level < LFSE_WALK_MAX_DEPTH && positions[level]; ++level) {
+		// the first next() walks into the directory of the previous level, the others skip over siblings
+		do {
+			if (_entryPushed && _depth == level + 1)
+				skipChildren();
+			if (!next())
+				return false;
+		} while (_depth == level + 1 && _positions[level] < positions[level]);
+		if (_depth != level + 1) // entries were removed, or what was a directory isn't one anymore
+			return true;
+	}
+	return true;
+}
+bool LFSETreeWalker::next() {
+	if (_leaving) {
+		_leaving = false;
+		_path.popToken();
+	} else if (_entryPushed) {
+		if (_descendPending && _depth < LFSE_WALK_MAX_DEPTH) {
+			// current entry becomes the parent of the next ones
+			_positions[_depth] = 0;
+			_dirs[_depth++] = LittleFS.openDir(_path);
+		} else {
+			_truncated |= _descendPending;
+			_path.popToken();
+		}
+		_entryPushed = false;
+		_descendPending = false;
+	}
+	while (_depth) {
+		Dir& dir = _dirs[_depth - 1];
+		if (dir.next()) {
+			++_positions[_depth - 1];
+			String name = dir.fileName();
+			if (!_path.pushToken(name.c_str(), name.length())) {
+				_truncated = true;
+				continue;
+			}
+			_entryPushed = true;
+			_descendPending = dir.isDirectory();
+			if (_childrenFirst && _descendPending && _depth < LFSE_WALK_MAX_DEPTH) {
+				// the directory itself is reported once its Dir is done
+				_positions[_depth] = 0;
+				_dirs[_depth++] = LittleFS.openDir(_path);
+				_entryPushed = false;
+				_descendPending = false;
+				continue;
+			}
+			return true;
+		}
+		_dirs[--_depth] = Dir();
+		_positions[_depth] = 0;
+		if (!_depth)
 			break;
+		if (_childrenFirst) { // parent's Dir is still positioned at it
+			_leaving = true;
+			return true;
 		}
-		char c = (char)f.read();
-		s += c;
-		if (c == '\n' && lastChar == '\r') {
-			brokenByCRLF = true;
+		_path.popToken();
+	}
+	return false;
+}
+
+bool LFSEFindProgram::add(Op op, uint32_t value, const char* pattern) {
+	if (_length == LFSE_FIND_MAX_PREDICATES)
+		return false;
+	_insns[_length++] = { op, value, pattern };
+	return true;
+}
+void LFSEFindProgram::optimize() {
+	// stable insertion sort, keeps the order of same kind predicates
+	for (uint8_t i = 1; i < _length; ++i) {
+		Insn insn = _insns[i];
+		uint8_t j = i;
+		for (; j && _insns[j - 1].op > insn.op; --j)
+			_insns[j] = _insns[j - 1];
+		_insns[j] = insn;
+	}
+}
+bool LFSEFindProgram::matches(Dir& dir, const char* name) const {
+	bool isDir = dir.isDirectory();
+	for (uint8_t i = 0; i < _length; ++i) {
+		const Insn& insn = _insns[i];
+		switch (insn.op) {
+			case Op::TYPE:
+				if (isDir != (bool)insn.value)
+					return false;
+				break;
+			case Op::SIZE_LESS:
+				if (isDir || dir.fileSize() >= insn.value)
+					return false;
+				break;
+			case Op::SIZE_EQUAL:
+				if (isDir || dir.fileSize() != insn.value)
+					return false;
+				break;
+			case Op::SIZE_GREATER:
+				if (isDir || dir.fileSize() <= insn.value)
+					return false;
+				break;
+			case Op::NEWER:
+				if ((uint32_t)dir.fileTime() <= insn.value)
+					return false;
+				break;
+			case Op::NAME:
+				if (!matchesGlob(insn.pattern, name))
+					return false;
+				break;
+		}
+	}
+	return true;
+}
+
+LFSEFile::LFSEFile(const File& f) : File(f) {
+	_sizeOnOpen = *this ? size() : 0;
+}
+LFSEFile::LFSEFile(LFSEFile&& other) : File(other) {
+	release(other);
+}
+LFSEFile& LFSEFile::operator=(LFSEFile&& other) {
+	if (this != &other) {
+		close();
+		File::operator=(other);
+		release(other);
+	}
+	return *this;
+}
+// Takes over the accounting state, so that the cost is charged only once
+void LFSEFile::release(LFSEFile& other) {
+	_sizeOnOpen = other._sizeOnOpen;
+	_firstWriteOffset = other._firstWriteOffset;
+	_journalSeq = other._journalSeq;
+	_dirty = other._dirty;
+	_append = other._append;
+	_journal = other._journal;
+	other.File::operator=(File());
+	other._dirty = false;
+}
+void LFSEFile::touch(uint32_t offset) {
+	if (_append) // appending always writes at the end, whatever position says
+		offset = size();
+	if (offset < _firstWriteOffset)
+		_firstWriteOffset = offset;
+	_dirty = true;
+	if (_journal)
+		journalWrite();
+}
+// A record is needed only for the first write after the open or after a reader could see
+// the previous record, so repeated appends through a cached handle or kv sets cost nothing
+void LFSEFile::journalWrite() {
+	LFSEJournal& journal = DEBUG::lfseJournal;
+	if (_journalSeq && _journalSeq > journal._seenSeq)
+		return;
+	journal.record(LFSEJournal::WRITE, fullName());
+	_journalSeq = journal._seq; // the new record, or the one it was coalesced with
+}
+size_t LFSEFile::write(uint8_t c) {
+	touch(position());
+	return File::write(c);
+}
+size_t LFSEFile::write(const uint8_t* buffer, size_t size) {
+	touch(position());
+	return File::write(buffer, size);
+}
+bool LFSEFile::truncate(uint32_t size) {
+	// shrinking only moves the file head, growing writes zeros from the current end
+	touch(size < this->size() ? UINT32_MAX : this->size());
+	return File::truncate(size);
+}
+void LFSEFile::sync() {
+	if (!*this || !_dirty)
+		return;
+	chargeWear();
+	File::flush();
+	// the next write starts a new modification
+	_sizeOnOpen = size();
+	_firstWriteOffset = UINT32_MAX;
+}
+void LFSEFile::close() {
+	if (!*this)
+		return;
+	chargeWear();
+	File::close();
+}
+void LFSEFile::chargeWear() {
+	if (_dirty) {
+		LFSEWearStats& wear = *DEBUG::lfseWearCurrent;
+		uint32_t sizeNow = size();
+		++wear.metaCommits;
+		if (sizeNow <= LFSE_INLINE_FILE_MAX_SIZE) {
+			wear.programBytes += sizeNow; // inlined into the commit
+		} else {
+			// everything from the block holding the first modified byte is rewritten
+			uint32_t blockSize = DEBUG::wearBlockSize();
+			uint32_t first = _sizeOnOpen <= LFSE_INLINE_FILE_MAX_SIZE ? 0 : _firstWriteOffset < _sizeOnOpen ? _firstWriteOffset : _sizeOnOpen;
+			first -= first % blockSize;
+			if (sizeNow > first) {
+				wear.programBytes += sizeNow - first;
+				wear.eraseOps += (sizeNow - first + blockSize - 1) / blockSize;
+			}
+		}
+		_dirty = false;
+	}
+}
+
+static void _lzPrintSink(void* ctx, const uint8_t* data, size_t size) {
+	static_cast<Print*>(ctx)->write(data, size);
+}
+// Compressed bytes of LFSELzFileWriter go to its file and into the CRC of the block
+static void _lzFileSink(void* ctx, const uint8_t* data, size_t size) {
+	LFSELzFileWriter* writer = static_cast<LFSELzFileWriter*>(ctx);
+	writer->_crc = lfseCrc32(data, size, writer->_crc);
+	writer->_ok = writer->_file.write(data, size) == size && writer->_ok;
+}
+bool LFSELzPrint::begin(Print* out) {
+	_out = out;
+	_encoder = static_cast<LFSELzEncoder*>(DEBUG::lfseArena.allocate(sizeof(LFSELzEncoder), alignof(LFSELzEncoder)));
+	if (_encoder)
+		_encoder->begin(_lzPrintSink, out);
+	return _encoder;
+}
+void LFSELzPrint::end() {
+	if (!_encoder)
+		return;
+	_encoder->finish();
+	DEBUG::lfseArena.deallocate(_encoder, sizeof(LFSELzEncoder));
+	_encoder = nullptr;
+}
+size_t LFSELzPrint::write(uint8_t c) {
+	return write(&c, 1);
+}
+size_t LFSELzPrint::write(const uint8_t* buffer, size_t size) {
+	if (!_encoder)
+		return 0;
+	_encoder->write(buffer, size);
+	return size;
+}
+
+static int _lzStreamSource(void* ctx) {
+	uint8_t c;
+	return static_cast<Stream*>(ctx)->readBytes(reinterpret_cast<char*>(&c), 1) ? c : -1;
+}
+bool LFSELzStream::begin(Stream* in) {
+	_in = in;
+	_peeked = -1;
+	setTimeout(0); // waiting is done by the underlying stream
+	_decoder = static_cast<LFSELzDecoder*>(DEBUG::lfseArena.allocate(sizeof(LFSELzDecoder), alignof(LFSELzDecoder)));
+	if (_decoder)
+		_decoder->begin(_lzStreamSource, in);
+	return _decoder;
+}
+void LFSELzStream::end() {
+	DEBUG::lfseArena.deallocate(_decoder, sizeof(LFSELzDecoder));
+	_decoder = nullptr;
+}
+int LFSELzStream::available() {
+	if (!_decoder || isFinished())
+		return 0;
+	return (_peeked >= 0) + _decoder->pending() + _in->available();
+}
+int LFSELzStream::read() {
+	int c = peek();
+	_peeked = -1;
+	return c;
+}
+int LFSELzStream::peek() {
+	if (_peeked < 0 && _decoder)
+		_peeked = _decoder->read();
+	return _peeked;
+}
+
+// LFZ structures are written as they are, the explorer runs on little endian
+bool LFSELzFileWriter::open(const char* path, bool append) {
+	_rawSize = _nLines = 0;
+	_blockRawLength = _blockLines = 0;
+	_endsWithCR = false;
+	_ok = true;
+	LFSELzBlock last = { LFSELzFileReader::MAGIC_LENGTH, LFSELzFileReader::MAGIC_LENGTH, { 0 } };
+	if (append && LittleFS.exists(path)) {
+		_file = DEBUG::fsOpen(path, "r+");
+		if (!_file || !LFSELzFileReader::findLastBlock(_file, last)) {
+			_file.close();
+			return false;
+		}
+		_rawSize = last.footer.rawEnd;
+		_nLines = last.footer.linesEnd;
+		_endsWithCR = last.footer.rawLength & 0x8000;
+	} else {
+		_file = DEBUG::fsOpen(path, "w+");
+		if (!_file)
+			return false;
+		_file.write(reinterpret_cast<const uint8_t*>(LFSE_LFZ_MAGIC), LFSELzFileReader::MAGIC_LENGTH);
+	}
+	_end = last.end;
+	_encoder = static_cast<LFSELzEncoder*>(DEBUG::lfseArena.allocate(sizeof(LFSELzEncoder), alignof(LFSELzEncoder)));
+	if (!_encoder) {
+		_file.close();
+		return false;
+	}
+	// a short last block is compressed again along with what comes next,
+	// otherwise every append would end a block of its own
+	uint8_t* refill = nullptr;
+	uint16_t nRefill = takeBackLastBlock(last, refill);
+	// new blocks go over it and over what a torn append left after the last complete block
+	if (_file.size() > _end && !_file.truncate(_end))
+		_ok = false;
+	_file.seek(_end);
+	_crc = 0;
+	_encoder->begin(_lzFileSink, this);
+	if (nRefill) {
+		write(refill, nRefill);
+		DEBUG::lfseArena.deallocate(refill, nRefill);
+	}
+	return true;
+}
+bool LFSELzFileWriter::close() {
+	if (!_encoder)
+		return false;
+	finishBlock();
+	DEBUG::lfseArena.deallocate(_encoder, sizeof(LFSELzEncoder));
+	_encoder = nullptr;
+	_file.close();
+	return _ok;
+}
+size_t LFSELzFileWriter::write(uint8_t c) {
+	return write(&c, 1);
+}
+size_t LFSELzFileWriter::write(const uint8_t* buffer, size_t size) {
+	if (!_encoder)
+		return 0;
+	size_t nLeft = size;
+	while (nLeft) {
+		size_t nBytes = min(nLeft, (size_t)(LFSE_LFZ_BLOCK_LENGTH - _blockRawLength));
+		// CRLF split between blocks belongs to the second one
+		for (size_t i = 0; i < nBytes; ++i) {
+			_blockLines += buffer[i] == '\n' && _endsWithCR;
+			_endsWithCR = buffer[i] == '\r';
+		}
+		_encoder->write(buffer, nBytes);
+		_blockRawLength += nBytes;
+		buffer += nBytes;
+		nLeft -= nBytes;
+		if (_blockRawLength == LFSE_LFZ_BLOCK_LENGTH)
+			finishBlock();
+	}
+	return size;
+}
+void LFSELzFileWriter::finishBlock() {
+	if (!_blockRawLength)
+		return;
+	_encoder->finish();
+	_rawSize += _blockRawLength;
+	_nLines += _blockLines;
+	LFSELzFooter footer = { (uint16_t)_encoder->_nOut, (uint16_t)(_blockRawLength | (_endsWithCR ? 0x8000 : 0)), _rawSize, _nLines, 0 };
+	footer.crc = lfseCrc32(reinterpret_cast<const uint8_t*>(&footer), offsetof(LFSELzFooter, crc), _crc);
+	_ok = _ok && _file.write(reinterpret_cast<const uint8_t*>(&footer), sizeof(footer)) == sizeof(footer);
+	_end += _encoder->_nOut + sizeof(footer);
+	_blockRawLength = _blockLines = 0;
+	_crc = 0;
+	_encoder->begin(_lzFileSink, this);
+}
+// Decodes the last block into buffer and drops it, unless it's full.
+// Returns its raw length, 0 if nothing was taken back
+uint16_t LFSELzFileWriter::takeBackLastBlock(const LFSELzBlock& last, uint8_t*& buffer) {
+	uint16_t rawLength = last.footer.rawLength & 0x7fff;
+	if (!rawLength || rawLength >= LFSE_LFZ_BLOCK_LENGTH)
+		return 0;
+	// the lines are counted again while the block is written, starting from where the previous block ended
+	LFSELzBlock previous = last;
+	previous.end = last.offset;
+	bool hasPrevious = last.offset > LFSELzFileReader::MAGIC_LENGTH;
+	if (hasPrevious && !LFSELzFileReader::readBlock(_file, previous, false))
+		return 0;
+	buffer = static_cast<uint8_t*>(DEBUG::lfseArena.allocate(rawLength, 1));
+	if (!buffer)
+		return 0;
+	LFSELzFileReader reader;
+	bool ok = reader.open(_file) && reader.seek(_rawSize - rawLength);
+	for (uint16_t i = 0; ok && i < rawLength; ++i) {
+		int c = reader.read();
+		ok = c >= 0;
+		buffer[i] = c;
+	}
+	reader.close();
+	if (!ok) {
+		DEBUG::lfseArena.deallocate(buffer, rawLength);
+		return 0;
+	}
+	_end = last.offset;
+	_rawSize -= rawLength;
+	_nLines = hasPrevious ? previous.footer.linesEnd : 0;
+	_endsWithCR = hasPrevious && (previous.footer.rawLength & 0x8000);
+	return rawLength;
+}
+
+// Finds the last complete block: the one ending the file if its CRC checks out, otherwise, after a torn append,
+// the last one before that does. block.end is where the blocks start if there's none
+bool LFSELzFileReader::findLastBlock(File& f, LFSELzBlock& block) {
+	char magic[MAGIC_LENGTH];
+	if (!f.seek(0) || f.readBytes(magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, LFSE_LFZ_MAGIC, sizeof(magic)))
+		return false;
+	for (block.end = f.size(); block.end >= MAGIC_LENGTH + sizeof(LFSELzFooter); --block.end) {
+		if (readBlock(f, block, true))
+			return true;
+	}
+	block = { MAGIC_LENGTH, MAGIC_LENGTH, { 0 } };
+	return true;
+}
+// Reads the footer ending at block.end and finds where the block starts; verify checks the CRC reading the block
+bool LFSELzFileReader::readBlock(File& f, LFSELzBlock& block, bool verify) {
+	LFSELzFooter& footer = block.footer;
+	if (!f.seek(block.end - sizeof(footer)) || f.readBytes(reinterpret_cast<char*>(&footer), sizeof(footer)) != sizeof(footer))
+		return false;
+	uint16_t rawLength = footer.rawLength & 0x7fff;
+	// a block compresses to at most a flags byte per 8 literals and the end marker more than it takes raw
+	if (!rawLength || rawLength > LFSE_LFZ_BLOCK_LENGTH || footer.rawEnd < rawLength
+			|| footer.length > LFSE_LFZ_BLOCK_LENGTH + LFSE_LFZ_BLOCK_LENGTH / 8 + 3 || MAGIC_LENGTH + footer.length + sizeof(footer) > block.end)
+		return false;
+	block.offset = block.end - sizeof(footer) - footer.length;
+	if (block.offset == MAGIC_LENGTH && footer.rawEnd != rawLength)
+		return false;
+	if (!verify)
+		return true;
+	uint32_t crc = 0;
+	uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+	f.seek(block.offset);
+	for (uint16_t nLeft = footer.length; nLeft;) {
+		size_t nBytes = f.read(buffer, min(nLeft, (uint16_t)LFSE_FILE_BUFFER_LENGTH));
+		if (!nBytes)
+			return false;
+		crc = lfseCrc32(buffer, nBytes, crc);
+		nLeft -= nBytes;
+	}
+	return lfseCrc32(reinterpret_cast<const uint8_t*>(&footer), offsetof(LFSELzFooter, crc), crc) == footer.crc;
+}
+static int _lzFileSource(void* ctx) {
+	return static_cast<File*>(ctx)->read();
+}
+bool LFSELzFileReader::open(File& f) {
+	if (!findLastBlock(f, _last))
+		return false;
+	_file = f;
+	_decoder = static_cast<LFSELzDecoder*>(DEBUG::lfseArena.allocate(sizeof(LFSELzDecoder), alignof(LFSELzDecoder)));
+	if (!_decoder)
+		return false;
+	_decoder->begin(_lzFileSource, &_file);
+	LFSELzBlock first = { MAGIC_LENGTH, 0, { 0 } };
+	return startBlock(first);
+}
+void LFSELzFileReader::close() {
+	DEBUG::lfseArena.deallocate(_decoder, sizeof(LFSELzDecoder));
+	_decoder = nullptr;
+	_file = File();
+}
+// Steps to the block before, false if block is the first one
+bool LFSELzFileReader::previous(LFSELzBlock& block) {
+	if (block.offset <= MAGIC_LENGTH)
+		return false;
+	block.end = block.offset;
+	return readBlock(_file, block, false);
+}
+bool LFSELzFileReader::startBlock(const LFSELzBlock& block) {
+	_decoder->restart();
+	_position = block.rawOffset();
+	_history = _replay = 0;
+	return _file.seek(block.offset);
+}
+int LFSELzFileReader::read() {
+	if (_replay) {
+		++_position;
+		return _decoder->history(_replay--);
+	}
+	if (!_decoder || _position >= size())
+		return -1;
+	int c = _decoder->read();
+	if (c < 0 && _decoder->isFinished()) { // the next block goes right after the footer
+		_file.seek(_file.position() + sizeof(LFSELzFooter));
+		_decoder->restart();
+		c = _decoder->read();
+	}
+	if (c < 0)
+		return -1;
+	++_position;
+	if (_history < LFSE_LZ_WINDOW_LENGTH)
+		++_history;
+	return c;
+}
+int LFSELzFileReader::peek() {
+	int c = read();
+	if (c >= 0) {
+		--_position;
+		++_replay;
+	}
+	return c;
+}
+bool LFSELzFileReader::seek(uint32_t pos) {
+	if (!_decoder || pos > size())
+		return false;
+	// bytes still in the decoder window are read again
+	if (pos <= _position && _position - pos + _replay <= _history) {
+		_replay += _position - pos;
+		_position = pos;
+		return true;
+	}
+	// it's cheaper to decode a bit further than to jump
+	if (pos < _position || pos - _position >= LFSE_LFZ_BLOCK_LENGTH) {
+		// the last block starting at or before pos
+		LFSELzBlock block = _last;
+		while (block.rawOffset() > pos) {
+			if (!previous(block))
+				return false;
+		}
+		if (!startBlock(block))
+			return false;
+	}
+	while (_position < pos) {
+		if (read() < 0)
+			return false;
+	}
+	return true;
+}
+bool LFSELzFileReader::seekLine(uint32_t line) {
+	if (!_decoder || !line)
+		return seek(0);
+	// the last block starting before the line-th CRLF is complete, that is the one whose previous block has fewer
+	LFSELzBlock block = _last, before = _last;
+	while (block.offset > MAGIC_LENGTH) {
+		if (!previous(before))
+			return false;
+		if (before.footer.linesEnd < line)
 			break;
-		}
-		lastChar = c;
+		block = before;
 	}
-
-	// s.length() == maxLen + 2
-	if (brokeByLen) {
-		// str cannot end with crlf
-		// even if str.last == cr, str.length is already too big,
-		// so in any case return false
-		s.cut(0, s.length() - 2);
-		f.seek(originalPosition + s.length());
-		if (strLenOut)
-			*strLenOut = s.length();
+	bool hasBefore = block.offset > MAGIC_LENGTH;
+	bool prevCR = hasBefore && (before.footer.rawLength & 0x8000);
+	if (!startBlock(block))
 		return false;
+	uint32_t nLines = hasBefore ? before.footer.linesEnd : 0;
+	while (nLines < line) {
+		int c = read();
+		if (c < 0)
+			return false;
+		nLines += c == '\n' && prevCR;
+		prevCR = c == '\r';
 	}
+	return true;
+}
 
-	int16_t d = s.length() - maxLen;
+bool LFSEFileWriter::open(const char* path, bool append) {
+	_bufferCursor = 0;
+	_file = DEBUG::fsOpen(path, append ? "a" : "w");
+	return (bool)_file;
+}
+void LFSEFileWriter::close() {
+	flush();
+	_file.close();
+}
+size_t LFSEFileWriter::write(uint8_t c) {
+	if (_bufferCursor >= LFSE_FILE_PAGE_LENGTH)
+		flush();
+	_buffer[_bufferCursor++] = c;
+	return 1;
+}
+size_t LFSEFileWriter::write(const uint8_t* buffer, size_t size) {
+	size_t nLeft = size;
+	while (nLeft) {
+		// whole pages go straight to the file if nothing is buffered
+		if (!_bufferCursor && nLeft >= LFSE_FILE_PAGE_LENGTH) {
+			size_t nPages = nLeft - nLeft % LFSE_FILE_PAGE_LENGTH;
+			_file.write(buffer, nPages);
+			DEBUG::wearAddLogical(nPages);
+			buffer += nPages;
+			nLeft -= nPages;
+			continue;
+		}
+		size_t nBytes = min(nLeft, (size_t)(LFSE_FILE_PAGE_LENGTH - _bufferCursor));
+		memcpy(_buffer + _bufferCursor, buffer, nBytes);
+		_bufferCursor += nBytes;
+		buffer += nBytes;
+		nLeft -= nBytes;
+		if (_bufferCursor >= LFSE_FILE_PAGE_LENGTH)
+			flush();
+	}
+	return size;
+}
+void LFSEFileWriter::flush() {
+	if (_bufferCursor && _file) {
+		_file.write(_buffer, _bufferCursor);
+		DEBUG::wearAddLogical(_bufferCursor);
+	}
+	_bufferCursor = 0;
+}
 
-	// crlf are last 2 chars of s
-	if (brokenByCRLF) {
-		if (!addCRLF)
-			s.cut(0, s.length() - 2);
-		if (strLenOut)
-			*strLenOut = s.length();
+bool LFSEKVStore::mount(const char* path) {
+	DEBUG::lfseHandles.invalidate(path); // the log is replayed from what's synced
+	_path = path;
+	_mounted = false;
+	_size = _liveBytes = 0;
+	_nKeys = 0;
+	for (Slot& slot : _slots)
+		slot.offset = NO_OFFSET;
+	if (!LittleFS.exists(path)) {
+		_mounted = true;
 		return true;
 	}
-
-	// got to the end of file without seeing crlf
-	if (d > 0) { // exceeded maxLen
-		s.cut(0, maxLen);
-		f.seek(originalPosition + maxLen);
+	File f = LittleFS.open(path, "r");
+	if (!f || f.isDirectory())
+		return false;
+	uint32_t fileSize = f.size();
+	Record record, old;
+	char key[LFSE_KV_MAX_KEY_LENGTH];
+	// replay the log, the last record of a key wins
+	while (_size < fileSize && readRecord(f, _size, record, key, true)) {
+		uint32_t hash = hashKey(key, record.keyLength);
+		int16_t idx = find(f, key, record.keyLength, hash, old);
+		if (idx >= 0)
+			_liveBytes -= recordSize(old);
+		if (record.type == SET) {
+			if (idx >= 0) {
+				_slots[idx].offset = _size;
+			} else if (isFull()) {
+				f.close();
+				return false;
+			} else {
+				insert(hash, _size);
+			}
+			_liveBytes += recordSize(record);
+		} else if (idx >= 0) {
+			erase(idx);
+		}
+		_size += recordSize(record);
 	}
-	if (strLenOut)
-		*strLenOut = s.length();
-	return false;
+	f.close();
+	if (_size < fileSize) { // torn or corrupted record, nothing after it can be trusted
+		LFSEFile fLog = DEBUG::fsOpen(path, "r+");
+		if (!fLog || !fLog.truncate(_size))
+			return false;
+	}
+	_mounted = true;
+	return true;
 }
-// Same as readLine, but doesn't stop on CRLF
-// returns true if got to the end of file before exceeding maxLen
-bool DEBUG::readChars(File& f, String* str, uint16_t maxLen, size_t* strLenOut) {
-	// str can be nullptr, StringLike class handles it properly
-	StringLike s(str);
-	s.clear();
-	// problem with file
-	if (!f) {
+// The log is kept open in the handle cache and read through the same handle, which sees what isn't synced yet
+LFSEFile* LFSEKVStore::log() {
+	return DEBUG::lfseHandles.openAppend(_path, true);
+}
+bool LFSEKVStore::refresh(const char* path) {
+	if (_mounted && _path == path) {
+		LFSEFile* f = LittleFS.exists(path) ? log() : nullptr;
+		if ((f ? f->size() : 0) == _size)
+			return true;
+	}
+	return mount(path);
+}
+bool LFSEKVStore::get(const char* key, Print* out) {
+	uint8_t keyLength = strlen(key);
+	LFSEFile* f = _nKeys ? log() : nullptr;
+	if (!f)
 		return false;
+	Record record;
+	int16_t idx = find(*f, key, keyLength, hashKey(key, keyLength), record);
+	if (idx >= 0 && out) {
+		f->seek(_slots[idx].offset + sizeof(Record) + keyLength);
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		for (uint16_t nLeft = record.valueLength; nLeft;) {
+			size_t nBytes = f->read(buffer, min(nLeft, (uint16_t)LFSE_FILE_BUFFER_LENGTH));
+			if (!nBytes)
+				break;
+			out->write(buffer, nBytes);
+			nLeft -= nBytes;
+		}
 	}
-	
-	bool brokeByLen = false;
-	size_t originalPosition = f.position();
-	while (f.available()) {
-		if (maxLen && (s.length() >= maxLen)) {
-			brokeByLen = true;
+	return idx >= 0;
+}
+bool LFSEKVStore::set(const char* key, const uint8_t* value, uint16_t valueLength) {
+	uint8_t keyLength = strlen(key);
+	uint32_t hash = hashKey(key, keyLength);
+	Record old;
+	int16_t idx = -1;
+	if (LFSEFile* f = _nKeys ? log() : nullptr) {
+		idx = find(*f, key, keyLength, hash, old);
+		// setting the same value again doesn't touch flash
+		bool same = idx >= 0 && old.valueLength == valueLength;
+		uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+		for (uint16_t i = 0; same && i < valueLength;) {
+			size_t nBytes = f->read(buffer, min((uint16_t)(valueLength - i), (uint16_t)LFSE_FILE_BUFFER_LENGTH));
+			same = nBytes && !memcmp(buffer, value + i, nBytes);
+			i += nBytes;
+		}
+		if (same)
+			return true;
+	}
+	if (idx < 0 && isFull())
+		return false;
+	uint32_t offset = append(SET, key, keyLength, value, valueLength);
+	if (offset == NO_OFFSET)
+		return false;
+	DEBUG::wearAddLogical(keyLength + valueLength);
+	if (idx >= 0) {
+		_liveBytes -= recordSize(old);
+		_slots[idx].offset = offset;
+	} else {
+		insert(hash, offset);
+	}
+	_liveBytes += _size - offset;
+	compactIfNeeded();
+	return true;
+}
+bool LFSEKVStore::del(const char* key) {
+	uint8_t keyLength = strlen(key);
+	LFSEFile* f = _nKeys ? log() : nullptr;
+	if (!f)
+		return false;
+	Record old;
+	int16_t idx = find(*f, key, keyLength, hashKey(key, keyLength), old);
+	if (idx < 0 || append(DEL, key, keyLength, nullptr, 0) == NO_OFFSET)
+		return false;
+	_liveBytes -= recordSize(old);
+	erase(idx);
+	compactIfNeeded();
+	return true;
+}
+void LFSEKVStore::list(Print& out) {
+	LFSEFile* f = _nKeys ? log() : nullptr;
+	if (!f)
+		return;
+	Record record;
+	char key[LFSE_KV_MAX_KEY_LENGTH];
+	for (const Slot& slot : _slots) {
+		if (slot.offset == NO_OFFSET || !readRecord(*f, slot.offset, record, key, false))
+			continue;
+		out.write(key, record.keyLength);
+		out.printf("\t%u\r\n", record.valueLength);
+	}
+}
+// Copies live records into a new log, which then atomically replaces the old one
+bool LFSEKVStore::compact() {
+	char tmpPath[LFSE_PATH_MAX_LENGTH + 1];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", _path);
+	LFSEFile fOut = DEBUG::fsOpen(tmpPath, "w");
+	if (!fOut)
+		return false;
+	DEBUG::lfseHandles.invalidate(_path); // synced before it's read by another handle
+	File f = _nKeys ? LittleFS.open(_path, "r") : File();
+	uint32_t offset = 0;
+	bool ok = true;
+	Record record;
+	char key[LFSE_KV_MAX_KEY_LENGTH];
+	uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+	for (Slot& slot : _slots) {
+		if (slot.offset == NO_OFFSET)
+			continue;
+		ok = readRecord(f, slot.offset, record, key, false) && f.seek(slot.offset);
+		for (uint32_t nLeft = recordSize(record); ok && nLeft;) {
+			size_t nBytes = f.read(buffer, min(nLeft, (uint32_t)LFSE_FILE_BUFFER_LENGTH));
+			ok = nBytes && fOut.write(buffer, nBytes) == nBytes;
+			nLeft -= nBytes;
+		}
+		if (!ok)
 			break;
+		slot.offset = offset;
+		offset += recordSize(record);
+	}
+	f.close();
+	fOut.close();
+	if (!ok || !DEBUG::fsRename(tmpPath, _path)) {
+		DEBUG::fsRemove(tmpPath);
+		mount(_path); // offsets are half moved
+		return false;
+	}
+	_size = _liveBytes = offset;
+	return true;
+}
+void LFSEKVStore::compactIfNeeded() {
+	if (_size >= LFSE_KV_COMPACT_MIN_SIZE && (_size - _liveBytes) * 100 >= _size * LFSE_KV_COMPACT_DEAD_PERCENT)
+		compact();
+}
+// Linear probing, the table is never full, so it always ends up at a free slot
+int16_t LFSEKVStore::find(File& f, const char* key, uint8_t keyLength, uint32_t hash, Record& record) {
+	char storedKey[LFSE_KV_MAX_KEY_LENGTH];
+	for (uint16_t i = hash % LFSE_KV_MAX_KEYS; _slots[i].offset != NO_OFFSET; i = (i + 1) % LFSE_KV_MAX_KEYS) {
+		if (_slots[i].hash == hash && readRecord(f, _slots[i].offset, record, storedKey, false)
+			&& record.keyLength == keyLength && !memcmp(storedKey, key, keyLength))
+			return i;
+	}
+	return -1;
+}
+// Reads record header and key, f is left at the value; verify checks the CRC reading the value
+bool LFSEKVStore::readRecord(File& f, uint32_t offset, Record& record, char* key, bool verify) {
+	if (!f.seek(offset) || f.read(reinterpret_cast<uint8_t*>(&record), sizeof(Record)) != sizeof(Record))
+		return false;
+	if ((record.type != SET && record.type != DEL) || !record.keyLength || record.keyLength > LFSE_KV_MAX_KEY_LENGTH)
+		return false;
+	if (f.read(reinterpret_cast<uint8_t*>(key), record.keyLength) != record.keyLength)
+		return false;
+	if (!verify)
+		return f.seek(offset + sizeof(Record) + record.keyLength);
+	uint32_t crc = lfseCrc32(reinterpret_cast<const uint8_t*>(&record), offsetof(Record, crc));
+	crc = lfseCrc32(reinterpret_cast<const uint8_t*>(key), record.keyLength, crc);
+	uint8_t buffer[LFSE_FILE_BUFFER_LENGTH];
+	for (uint16_t nLeft = record.valueLength; nLeft;) {
+		size_t nBytes = f.read(buffer, min(nLeft, (uint16_t)LFSE_FILE_BUFFER_LENGTH));
+		if (!nBytes)
+			return false;
+		crc = lfseCrc32(buffer, nBytes, crc);
+		nLeft -= nBytes;
+	}
+	return crc == record.crc;
+}
+// Returns offset of the appended record or NO_OFFSET
+uint32_t LFSEKVStore::append(RecordType type, const char* key, uint8_t keyLength, const uint8_t* value, uint16_t valueLength) {
+	Record record = { type, keyLength, valueLength, 0 };
+	record.crc = lfseCrc32(reinterpret_cast<const uint8_t*>(&record), offsetof(Record, crc));
+	record.crc = lfseCrc32(reinterpret_cast<const uint8_t*>(key), keyLength, record.crc);
+	record.crc = lfseCrc32(value, valueLength, record.crc);
+	LFSEFile* f = log();
+	if (!f)
+		return NO_OFFSET;
+	size_t nBytes = f->write(reinterpret_cast<const uint8_t*>(&record), sizeof(Record));
+	nBytes += f->write(reinterpret_cast<const uint8_t*>(key), keyLength);
+	if (valueLength)
+		nBytes += f->write(value, valueLength);
+	DEBUG::lfseHandles.markWritten();
+	if (nBytes != recordSize(record)) {
+		mount(_path); // cuts the torn record off
+		return NO_OFFSET;
+	}
+	uint32_t offset = _size;
+	_size += nBytes;
+	return offset;
+}
+void LFSEKVStore::insert(uint32_t hash, uint32_t offset) {
+	uint16_t i = hash % LFSE_KV_MAX_KEYS;
+	while (_slots[i].offset != NO_OFFSET)
+		i = (i + 1) % LFSE_KV_MAX_KEYS;
+	_slots[i] = { hash, offset };
+	++_nKeys;
+}
+// Backward shift deletion: moves up the following entries that would become unreachable
+void LFSEKVStore::erase(uint16_t slotIdx) {
+	uint16_t i = slotIdx;
+	for (uint16_t j = (i + 1) % LFSE_KV_MAX_KEYS; _slots[j].offset != NO_OFFSET; j = (j + 1) % LFSE_KV_MAX_KEYS) {
+		uint16_t home = _slots[j].hash % LFSE_KV_MAX_KEYS;
+		// entry can stay if its home lies cyclically within (i, j]
+		bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+		if (!stays) {
+			_slots[i] = _slots[j];
+			i = j;
 		}
-		char c = (char)f.read();
-		s += c;
 	}
+	_slots[i].offset = NO_OFFSET;
+	--_nKeys;
+}
 
-	if (strLenOut)
-		*strLenOut = s.length();
-
-	// s.length() == maxLen
-	if (brokeByLen) {
+void LFSEDiffWindow::fill() {
+	char buffer[LFSE_FILE_BUFFER_LENGTH];
+	while (_nLines < LFSE_DIFF_WINDOW_LINES && !isAtEnd()) {
+		Line& line = _lines[_nLines++];
+		line.offset = _nextOffset;
+		// 32 bits of FNV-1a 64 tell most lines apart, isLineEqual confirms the matches
+		uint64_t hash = LFSE_FNV64_OFFSET;
+		_file.seek(_nextOffset);
+		while (size_t nBytes = _file.read(reinterpret_cast<uint8_t*>(buffer), LFSE_FILE_BUFFER_LENGTH)) {
+			const char* lineEnd = static_cast<const char*>(memchr(buffer, '\n', nBytes));
+			size_t length = lineEnd ? lineEnd - buffer + 1 : nBytes;
+			hash = lfseFnv64(reinterpret_cast<const uint8_t*>(buffer), length, hash);
+			_nextOffset += length;
+			if (lineEnd)
+				break;
+		}
+		line.hash = (uint32_t)hash;
+	}
+}
+void LFSEDiffWindow::drop(uint8_t n) {
+	memmove(_lines, _lines + n, (_nLines - n) * sizeof(Line));
+	_nLines -= n;
+	_firstLine += n;
+}
+void LFSEDiffWindow::printLine(uint8_t idx, char prefix, Print& out) {
+	char buffer[LFSE_FILE_BUFFER_LENGTH];
+	uint32_t end = lineEnd(idx);
+	_file.seek(_lines[idx].offset);
+	out.write(prefix);
+	for (uint32_t nLeft = end - _lines[idx].offset; nLeft;) {
+		size_t nBytes = _file.read(reinterpret_cast<uint8_t*>(buffer), min(nLeft, (uint32_t)LFSE_FILE_BUFFER_LENGTH));
+		if (!nBytes)
+			break;
+		nLeft -= nBytes;
+		// the line end is printed uniformly below
+		size_t length = nBytes;
+		if (!nLeft && length && buffer[length - 1] == '\n')
+			--length;
+		if (!nLeft && length && buffer[length - 1] == '\r')
+			--length;
+		out.write(buffer, length);
+	}
+	out.println();
+}
+// Lines with different hashes differ, the ones with equal hashes are compared byte by byte
+bool LFSEDiffWindow::isLineEqual(uint8_t idx, LFSEDiffWindow& other, uint8_t otherIdx) {
+	if (_lines[idx].hash != other._lines[otherIdx].hash)
 		return false;
+	uint32_t nLeft = lineEnd(idx) - _lines[idx].offset;
+	if (nLeft != other.lineEnd(otherIdx) - other._lines[otherIdx].offset)
+		return false;
+	uint8_t buffer[LFSE_FILE_BUFFER_LENGTH], otherBuffer[LFSE_FILE_BUFFER_LENGTH];
+	_file.seek(_lines[idx].offset);
+	other._file.seek(other._lines[otherIdx].offset);
+	while (nLeft) {
+		size_t nBytes = min(nLeft, (uint32_t)LFSE_FILE_BUFFER_LENGTH);
+		if (_file.read(buffer, nBytes) != (int)nBytes || other._file.read(otherBuffer, nBytes) != (int)nBytes || memcmp(buffer, otherBuffer, nBytes))
+			return false;
+		nLeft -= nBytes;
 	}
-	// went to the end of file
 	return true;
 }
 
-void LFSECommand::parseArgs() {
-	// TODO: double check how the unpaired quotes are handled
-	if (_argsParsed) {
-		return;
+LFSEFile* LFSEHandleCache::openAppend(const char* path, bool readable) {
+	Entry* entry = nullptr;
+	++_useCounter;
+	for (Entry& e : _entries) {
+		if (e.file && !strcmp(e.file.fullName(), path)) {
+			if (e.readable || !readable) {
+				++_nHits;
+				e.lastUse = _useCounter;
+				return &e.file;
+			}
+			e.file.close(); // opened by tee -a, reopened for reading too
+		}
+		if (!entry || (entry->file && (!e.file || e.lastUse < entry->lastUse)))
+			entry = &e; // a free one or the least recently used
 	}
-	_args.clear();
-	if (!_cmdBufferCursor || _cmdBufferCursor >= _bufferLength) {
-		return;
+	++_nMisses;
+	if (entry->file) {
+		++_nEvictions;
+		entry->file.close();
 	}
-	Arg token;
-	bool prevCharEscape = false; // helps to detect escaped chars in string args
-	auto addToken = [&](bool ignoreEmpty = true){
-		if (!token.value.isEmpty() || !ignoreEmpty) {
-			token.idx = _args.size();
-			_args.push_back(std::move(token));
-			token = Arg();
-			return true;
+	entry->file = DEBUG::fsOpen(path, readable ? "a+" : "a");
+	entry->lastUse = _useCounter;
+	entry->readable = readable;
+	return entry->file ? &entry->file : nullptr;
+}
+void LFSEHandleCache::sync() {
+	for (Entry& e : _entries) {
+		if (e.file && e.file._dirty) {
+			e.file.sync();
+			++_nSyncs;
 		}
+	}
+}
+void LFSEHandleCache::invalidate(const char* path) {
+	for (Entry& e : _entries) {
+		if (e.file && isPathUnder(e.file.fullName(), path))
+			e.file.close();
+	}
+}
+void LFSEHandleCache::clear() {
+	for (Entry& e : _entries)
+		e.file.close();
+}
+
+// Reads the seq a journal record starts with and leaves the rest of it; false at the end of the file
+static bool _journalReadSeq(File& f, uint32_t& seq) {
+	if (f.peek() < 0)
 		return false;
-	};
-	auto strArgAddChar = [&](char c) {
-		token.value += c;
-		prevCharEscape = false;
-	};
-	for (uint16_t i = _cmdBufferCursor; i < _bufferLength; ++i) {
-		char c = _buffer[i];
-		if (token.isTypeFilename()) { // already filling filename arg
-			if (isValidFSPathChar(c)) {
-				token.value += c;
-				continue;
-			}
-			addToken(); // if not valid filename char -> save token
+	seq = 0;
+	for (int c = f.peek(); c >= '0' && c <= '9'; c = f.peek()) {
+		seq = seq * 10 + c - '0';
+		f.read();
+	}
+	return true;
+}
+// Skips the rest of the record, copying it to out unless it's nullptr
+static void _journalSkipRecord(File& f, Print* out) {
+	for (int c = f.read(); c >= 0 && c != '\n'; c = f.read()) {
+		if (out)
+			out->write((uint8_t)c);
+	}
+}
+// Reads the rest of the record into buffer, chars that don't fit are skipped
+static void _journalReadRecord(File& f, char* buffer, size_t size) {
+	size_t length = 0;
+	for (int c = f.read(); c >= 0 && c != '\n'; c = f.read()) {
+		if (length + 1 < size)
+			buffer[length++] = c;
+	}
+	buffer[length] = '\0';
+}
+
+void LFSEJournal::mount() {
+	const char* paths[] = { LFSE_JOURNAL_OLD_PATH, LFSE_JOURNAL_PATH };
+	_seq = 0;
+	_lastWriteHash = 0;
+	for (const char* path : paths) {
+		_size = 0;
+		if (!LittleFS.exists(path))
 			continue;
+		File f = LittleFS.open(path, "r");
+		uint32_t seq;
+		while (_journalReadSeq(f, seq)) {
+			_seq = seq;
+			_journalSkipRecord(f, nullptr);
 		}
-		if (token.isTypeFlag()) { // already filling flag arg
-			if (isAlphaNumeric(c) || c == '-' || c == '.') { // flag args are alphanumeric or '-' or '.'
-				token.value += c;
-				continue;
-			}
-			addToken(); // if not valid flag char -> save token
+		_size = f.size();
+		f.close();
+	}
+	_mounted = true;
+}
+void LFSEJournal::record(Op op, const char* path, const char* pathTo) {
+	if (!_mounted)
+		mount();
+	// a write right after an unseen write of the same file is covered by that record
+	uint64_t writeHash = op == WRITE ? lfseFnv64(reinterpret_cast<const uint8_t*>(path), strlen(path), LFSE_FNV64_OFFSET) : 0;
+	if (writeHash && writeHash == _lastWriteHash && _seq > _seenSeq)
+		return;
+	_lastWriteHash = writeHash;
+	char line[2 * (LFSE_PATH_MAX_LENGTH + 1) + 16];
+	int length = snprintf(line, sizeof(line), "%u %c %s%s%s\n", (unsigned int)(_seq + 1), op, path, pathTo ? " " : "", pathTo ? pathTo : "");
+	if (_size && _size + length > LFSE_JOURNAL_MAX_LENGTH / 2) {
+		// the current half becomes the previous one, dropping the records of that one
+		LittleFS.remove(LFSE_JOURNAL_OLD_PATH);
+		LittleFS.rename(LFSE_JOURNAL_PATH, LFSE_JOURNAL_OLD_PATH);
+		DEBUG::lfseWearCurrent->metaCommits += 2;
+		_size = 0;
+	}
+	// seq goes on even if the record can't be written, so that the gap shows up in printSince
+	++_seq;
+	LFSEFile f = DEBUG::openCounted(LFSE_JOURNAL_PATH, "a");
+	if (f && f.write(reinterpret_cast<const uint8_t*>(line), length) == (size_t)length)
+		_size += length;
+}
+uint32_t LFSEJournal::last() {
+	if (!_mounted)
+		mount();
+	_seenSeq = _seq;
+	return _seq;
+}
+uint32_t LFSEJournal::oldest() {
+	if (!_mounted)
+		mount();
+	const char* paths[] = { LFSE_JOURNAL_OLD_PATH, LFSE_JOURNAL_PATH };
+	for (const char* path : paths) {
+		if (!LittleFS.exists(path))
 			continue;
-		}
-		if (token.isTypeString()) { // already filling string filename arg
-			if (c == '"') { // potentially end of string arg
-				if (prevCharEscape) { // no, it was escaped
-					strArgAddChar(c);
-					continue;
-				}
-				addToken(false); // was not escaped -> string ended -> save token
+		File f = LittleFS.open(path, "r");
+		uint32_t seq;
+		if (_journalReadSeq(f, seq))
+			return seq;
+	}
+	return _seq + 1;
+}
+bool LFSEJournal::touchedSince(uint32_t since, const char* path) {
+	last();
+	if (oldest() > since + 1) // records after since were dropped, anything might have happened
+		return true;
+	const char* journalPaths[] = { LFSE_JOURNAL_OLD_PATH, LFSE_JOURNAL_PATH };
+	char record[2 * (LFSE_PATH_MAX_LENGTH + 1) + 4];
+	for (const char* journalPath : journalPaths) {
+		if (!LittleFS.exists(journalPath))
+			continue;
+		File f = LittleFS.open(journalPath, "r");
+		uint32_t seq;
+		while (_journalReadSeq(f, seq)) {
+			if (seq <= since) {
+				_journalSkipRecord(f, nullptr);
 				continue;
 			}
-			if (prevCharEscape) { // the char was escaped -> add correct symbol to token
-				switch(c) {
-					case '"':
-					case '\\':
-						strArgAddChar(c);
-						break;
-					case 'n':
-						strArgAddChar('\n');
-						break;
-					case 'r':
-						strArgAddChar('\r');
-						break;
-					case 't':
-						strArgAddChar('\t');
-						break;
-					default:
-						strArgAddChar('\\');
-						strArgAddChar(c);
-						break;
-				}
-				prevCharEscape = false;
-			} else {
-				if (c == '\\') { // escape symbol
-					prevCharEscape = true;
-					continue;
-				}
-				strArgAddChar(c);
-			}
-			continue;
-		}
-		// if none of above -> just started filling token
-		if (c == '"') { // only string args start with '"'
-			token.type = Arg::Type::STRING;
-			continue;
+			_journalReadRecord(f, record, sizeof(record));
+			if (strlen(record) < 3) // " <op> <path>[ <path_to>]"
+				continue;
+			char* from = record + 3;
+			char* to = strchr(from, ' ');
+			if (to)
+				*to++ = '\0';
+			if (isPathUnder(path, from) || (to && isPathUnder(path, to)))
+				return true;
 		}
-		if (c == '-') { // flags start with '-'
-			token.type = Arg::Type::FLAG;
+	}
+	return false;
+}
+// Records have to follow since without gaps up to the last one,
+// which also catches since being dropped by wraparound or being ahead of a lost journal
+bool LFSEJournal::printSince(uint32_t since, Print& out) {
+	last();
+	const char* paths[] = { LFSE_JOURNAL_OLD_PATH, LFSE_JOURNAL_PATH };
+	uint32_t expected = since + 1;
+	for (const char* path : paths) {
+		if (!LittleFS.exists(path))
 			continue;
+		File f = LittleFS.open(path, "r");
+		uint32_t seq;
+		while (_journalReadSeq(f, seq)) {
+			if (seq <= since) {
+				_journalSkipRecord(f, nullptr);
+				continue;
+			}
+			if (seq != expected)
+				return false;
+			++expected;
+			out.print(seq);
+			_journalSkipRecord(f, &out);
+			out.println();
 		}
-		if (isValidFSPathChar(c)) {
-			token.type = Arg::Type::FILENAME;
-			token.value += c;
-		}
-		continue; // if no conditions met -> bullshit symbol
-	}
-	if (prevCharEscape) { // if '\' was the last symbol, add it
-		strArgAddChar('\\');
 	}
-	addToken(!token.isTypeString());
-	_argsParsed = true;
+	return expected == _seq + 1;
 }
 
-String LFSECommand::toString() const {
-	String res(_cmd);
-	if (_argsParsed) {
-		for (const Arg& arg : _args) {
-			res += " ";
-			res += arg.toString(false);
-		}
-	} else if (_cmdBufferCursor && _cmdBufferCursor < _bufferLength) {
-		for (uint16_t i = _cmdBufferCursor; i < _bufferLength; ++i)
-			res += _buffer[i];
+void LFSEFrameWriter::begin(Print* link, uint32_t id) {
+	_link = link;
+	_id = id;
+	_bufferCursor = 0;
+}
+void LFSEFrameWriter::end(Status status) {
+	flush();
+	_link->printf("@%u S %u\n", (unsigned int)_id, (unsigned int)status);
+}
+size_t LFSEFrameWriter::write(char type, const uint8_t* buffer, size_t size) {
+	if (type != _bufferType)
+		flush();
+	_bufferType = type;
+	for (size_t nLeft = size; nLeft;) {
+		size_t nBytes = min(nLeft, (size_t)(LFSE_FRAME_CHUNK_LENGTH - _bufferCursor));
+		memcpy(_buffer + _bufferCursor, buffer, nBytes);
+		_bufferCursor += nBytes;
+		buffer += nBytes;
+		nLeft -= nBytes;
+		if (_bufferCursor == LFSE_FRAME_CHUNK_LENGTH)
+			flush();
 	}
-	return res;
+	return size;
+}
+void LFSEFrameWriter::flush() {
+	if (!_bufferCursor)
+		return;
+	_link->printf("@%u %c %u\n", (unsigned int)_id, _bufferType, (unsigned int)_bufferCursor);
+	_link->write(_buffer, _bufferCursor);
+	_bufferCursor = 0;
 }
 
 // Some debugging code
@@ -6,9 +6,59 @@
 #include <vector>
 #include <functional>
 #include "LittleFS.h"
+#include "lfsehash.h"
+#include "lfsecodec.h"
 
 #define LFSE_SERIAL_BUFFER_LENGTH 256
 #define LFSE_FILE_BUFFER_LENGTH 64
+#define LFSE_FILE_PAGE_LENGTH 256 // LittleFS page size on ESP8266
+#define LFSE_PATH_MAX_LENGTH 127
+#define LFSE_PATH_MAX_TOKENS 16
+#define LFSE_ARENA_LENGTH 1024
+#define LFSE_ARGS_RESERVE 8
+#define LFSE_NAME_MAX_LENGTH 32 // LFS_NAME_MAX
+#define LFSE_LS_DEFAULT_LIMIT 8 // page size for sorted ls if no --top/--limit given, small enough for the heap to stay in the arena
+#define LFSE_WALK_MAX_DEPTH 8 // directories deeper than this are not walked into
+#define LFSE_FIND_MAX_PREDICATES 8
+#define LFSE_INLINE_FILE_MAX_SIZE 64 // files up to littlefs cache size are inlined into directory metadata
+#define LFSE_TAR_BLOCK_LENGTH 512
+#define LFSE_SIG_MIN_BLOCK_LENGTH 16
+#define LFSE_SIG_MAX_BLOCK_LENGTH 32768
+#define LFSE_PATCH_TMP_NAME ".patch.tmp" // new file is built next to the patched one under this name
+#define LFSE_LFZ_BLOCK_LENGTH 512 // raw bytes of LFZ file compressed independently
+#define LFSE_LFZ_MAGIC "LFZ1"
+#define LFSE_KV_PATH "/kv.log"
+#define LFSE_KV_MAX_KEYS 64 // capacity of the in-RAM index, it's kept no more than 7/8 full
+#define LFSE_KV_MAX_KEY_LENGTH 32
+#define LFSE_KV_COMPACT_MIN_SIZE 1024 // log isn't compacted while it's smaller
+#define LFSE_KV_COMPACT_DEAD_PERCENT 50 // log is compacted when dead records take this share of it
+#define LFSE_KV_BENCH_MAX_VALUE_LENGTH 128
+#define LFSE_RLOG_SEGMENTS 4 // ring log keeps this many segment files, the oldest one is dropped on rotation
+#define LFSE_RLOG_MIN_SEGMENT_LENGTH 64
+#define LFSE_RLOG_HEADER_NAME ".rlog"
+#define LFSE_RLOG_MAGIC "RLG1"
+#define LFSE_HANDLE_CACHE_SIZE 4 // files kept open for appending, each takes a littlefs file cache (~300 bytes of heap)
+#define LFSE_HANDLE_CACHE_SYNC_MS 1000 // cached files are synced this long after the last write
+#define LFSE_JOURNAL_PATH "/.changes"
+#define LFSE_JOURNAL_OLD_PATH "/.changes.old" // the previous half of the journal
+#define LFSE_JOURNAL_MAX_LENGTH 4096 // both halves together, the oldest records are dropped beyond it
+#define LFSE_SCRUB_MANIFEST_PATH "/.scrub"
+#define LFSE_SCRUB_STATE_PATH "/.scrub.state"
+#define LFSE_SCRUB_LOG_PATH "/.scrub.log"
+#define LFSE_SCRUB_MAGIC "SCR2"
+#define LFSE_SCRUB_MANIFEST_SLOTS 256 // files the manifest can keep CRCs of, 24 bytes each
+#define LFSE_SCRUB_BLOCK_LENGTH 512 // bytes read at once, leaves half of the arena to the command when scrub runs as one
+#define LFSE_SCRUB_BUDGET_MS 50 // default duration of a scrub step
+#define LFSE_SCRUB_SLOW_FACTOR 4 // a read this many times slower than the average is recorded as an outlier...
+#define LFSE_SCRUB_SLOW_MIN_US 2000 // ...if it took at least this long
+#define LFSE_SCRUB_STALE_PASSES 4 // manifest entries of files not seen for this many passes are reused
+#define LFSE_SCRUB_LOG_MAX_LENGTH 2048 // findings beyond this are only counted
+#define LFSE_SCRUB_SAVE_MS 60000 // the cursor is saved at most this often, and at the end of a pass
+#define LFSE_DD_BLOCK_LENGTH 512 // default bs of dd
+#define LFSE_DIFF_WINDOW_LINES 16 // diff aligns lines optimally within windows of this many lines of each file
+#define LFSE_FRAME_CHUNK_LENGTH 128 // machine mode output is sent in chunks of up to this many bytes
+#define LFSE_WEAR_MAX_COMMANDS 32 // wear is accounted for this many distinct commands
+#define LFSE_WEAR_COMMIT_BYTES 64 // bytes a single metadata commit is counted as when computing amplification
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -38,69 +88,203 @@
 #ifndef DLOG
 #define DLOG(txt)    	(__PRIVATE_LOG_PREAMBULE+_UART_.print(txt))
 #endif
+// Errors and diagnostics, they go to UART or into the response frame in machine mode
 #ifndef LOG
-#define LOG(txt)    	(_UART_.print(txt))
+#define LOG(txt)    	(DEBUG::lfseErr->print(txt))
 #endif
 #ifndef LOGF
-#define LOGF(fmt, ...)	(_UART_.printf(fmt, __VA_ARGS__))
+#define LOGF(fmt, ...)	(DEBUG::lfseErr->printf(fmt, __VA_ARGS__))
 #endif
 #ifndef LOGFLN
-#define LOGFLN(fmt, ...)	(_UART_.printf(fmt, __VA_ARGS__)+_UART_.println())
+#define LOGFLN(fmt, ...)	(DEBUG::lfseErr->printf(fmt, __VA_ARGS__)+DEBUG::lfseErr->println())
 #endif
 #ifndef LOGLN
-#define LOGLN(txt)		(_UART_.println(txt))
+#define LOGLN(txt)		(DEBUG::lfseErr->println(txt))
+#endif
+// Commands' output that goes to UART or to a file if redirected with > or >>
+#ifndef OUT
+#define OUT(txt)		(DEBUG::lfseOut->print(txt))
+#endif
+#ifndef OUTF
+#define OUTF(fmt, ...)	(DEBUG::lfseOut->printf(fmt, __VA_ARGS__))
+#endif
+#ifndef OUTLN
+#define OUTLN(txt)		(DEBUG::lfseOut->println(txt))
 #endif
 ////////////////////////////////////////////////////////////////////////////////
 
 inline static bool isValidFSNameChar(char c) {
 	return isAlphaNumeric(c) || c == '-' || c == '.';
 }
+inline static bool isGlobChar(char c) {
+	return c == '*' || c == '?';
+}
 inline static bool isValidFSPathChar(char c) {
-	return isValidFSNameChar(c) || c == '/';
+	return isValidFSNameChar(c) || c == '/' || isGlobChar(c);
 }
-static bool isValidFSName(const String& name) {
-	if (name.isEmpty())
+static bool isValidFSName(const char* name) {
+	if (!name || !*name)
 		return false;
-	for (const char& c : name)
-		if (!isValidFSNameChar(c))
+	for (; *name; ++name)
+		if (!isValidFSNameChar(*name))
 			return false;
 	return true;
 }
-static bool isValidFSPath(const String& path) {
-	if (path.isEmpty())
+static bool isValidFSPath(const char* path) {
+	if (!path || !*path)
 		return false;
-	for (const char& c : path)
-		if (!isValidFSNameChar(c) && c != '/')
+	for (; *path; ++path)
+		if (!isValidFSPathChar(*path))
 			return false;
 	return true;
 }
+inline static bool isGlobPattern(const char* path) {
+	for (; *path; ++path)
+		if (isGlobChar(*path))
+			return true;
+	return false;
+}
+// Matches name against pattern with '*' (any sequence) and '?' (any char).
+// Iterative: only the position right after the last '*' is remembered,
+// so there is no recursion and no exponential blow up on patterns like "*a*a*a*b"
+inline static bool matchesGlob(const char* pattern, const char* name) {
+	const char* starPattern = nullptr;
+	const char* starName = nullptr;
+	while (*name) {
+		if (*pattern == '*') {
+			starPattern = ++pattern;
+			starName = name;
+			continue;
+		}
+		if (*pattern == '?' || *pattern == *name) {
+			++pattern;
+			++name;
+			continue;
+		}
+		if (!starPattern)
+			return false;
+		// let the last '*' swallow one more char
+		pattern = starPattern;
+		name = ++starName;
+	}
+	while (*pattern == '*')
+		++pattern;
+	return !*pattern;
+}
+// True if path is root or lies under it (root itself included)
+inline static bool isPathUnder(const char* path, const char* root) {
+	size_t length = strlen(root);
+	// "/" has no trailing separator to match
+	return !strncmp(path, root, length) && (!path[length] || path[length] == '/' || length == 1);
+}
+inline static bool isValidFSName(const String& name) { return isValidFSName(name.c_str()); }
+inline static bool isValidFSPath(const String& path) { return isValidFSPath(path.c_str()); }
 
+// Normalized absolute path, kept as a single "/a/b/c" string in a fixed buffer
+// along with offsets of the '/' preceding each token.
+// Never touches heap, so copying is cheap and c_str() is free
 struct LFSEPath {
-	std::vector<String> _tokens;
+	char _buffer[LFSE_PATH_MAX_LENGTH + 1];
+	uint8_t _tokenOffsets[LFSE_PATH_MAX_TOKENS];
+	uint8_t _length = 0; // 0 for root
+	uint8_t _nTokens = 0;
 
-	LFSEPath() = default;
-	LFSEPath(const LFSEPath& obj);
-	LFSEPath(const String& root);
+	LFSEPath() { clear(); }
+	LFSEPath(const char* root) { clear(); adjust(root); }
 
 	// replaces if path is absolute, adds if relative
-	void adjust(const String& path);
-	bool isEmpty() const { return _tokens.size(); }
+	// returns false and keeps the path untouched if path is invalid or the result doesn't fit
+	bool adjust(const char* path);
+	bool adjust(const String& path) { return adjust(path.c_str()); }
+	bool isEmpty() const { return !_nTokens; }
+	uint8_t tokensCount() const { return _nTokens; }
+	const char* c_str() const { return _buffer; }
+	operator const char*() const { return _buffer; }
+	const char* name() const { return _nTokens ? _buffer + _tokenOffsets[_nTokens - 1] + 1 : _buffer; }
 	String toString(bool trailingSlash = false) const;
 
-	LFSEPath createAdjustedFromUserPath(String userPath);
+	void clear();
+	bool pushToken(const char* token, size_t len);
+	void popToken();
 private:
-	void tokenize(const String& s, bool appendToExisting = false);
+	void terminate();
+};
+
+// Bump allocator for per-command temporaries.
+// Everything allocated from it is dropped at once by reset() after each command,
+// so temporaries never get a chance to fragment the heap.
+// Requests that don't fit go to heap and are freed on reset() as well
+struct LFSEArena {
+	alignas(8) uint8_t _buffer[LFSE_ARENA_LENGTH];
+	size_t _cursor = 0;
+	size_t _peak = 0;
+	void* _fallbacks = nullptr; // singly linked list of heap blocks
+	uint32_t _nFallbacks = 0;
+
+	void* allocate(size_t size, size_t align = sizeof(void*));
+	void deallocate(void* ptr, size_t size) { shrink(ptr, size, 0); }
+	// only the topmost allocation can give memory back
+	bool shrink(void* ptr, size_t oldSize, size_t newSize);
+	bool owns(const void* ptr) const { return ptr >= _buffer && ptr < _buffer + LFSE_ARENA_LENGTH; }
+	void reset();
+};
+
+// std-compatible allocator on top of DEBUG::lfseArena
+template <typename T>
+struct LFSEArenaAllocator {
+	typedef T value_type;
+
+	LFSEArenaAllocator() = default;
+	template <typename U>
+	LFSEArenaAllocator(const LFSEArenaAllocator<U>&) { }
+
+	T* allocate(size_t n);
+	void deallocate(T* ptr, size_t n);
+
+	template <typename U>
+	bool operator==(const LFSEArenaAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator!=(const LFSEArenaAllocator<U>&) const { return false; }
 };
 
-struct LFSECommand {
+// Fixed capacity string living in DEBUG::lfseArena.
+// Covers the bits of String that the explorer needs, chars beyond capacity are dropped
+struct LFSEString {
+	char* _buffer = nullptr;
+	uint16_t _length = 0;
+	uint16_t _capacity = 0; // without terminating '\0'
+
+	LFSEString() = default;
+	explicit LFSEString(uint16_t capacity);
+
+	const char* c_str() const { return _buffer ? _buffer : ""; }
+	size_t length() const { return _length; }
+	size_t capacity() const { return _capacity; }
+	bool isEmpty() const { return !_length; }
+	char operator[](size_t idx) const { return idx < _length ? _buffer[idx] : '\0'; }
+	const char* begin() const { return c_str(); }
+	const char* end() const { return c_str() + _length; }
+	int indexOf(char c, size_t from = 0) const;
+	bool equals(const char* s) const { return !strcmp(c_str(), s); }
+	bool equals(const LFSEString& s) const { return _length == s._length && equals(s.c_str()); }
+
+	LFSEString& operator+=(char c);
+	void clear();
+	void cut(size_t left, size_t right); // .substring without creating new obj
+	void toLowerCase();
+	void shrinkToFit(); // gives unused capacity back to the arena
+};
+
+struct LFSECommand : public Printable {
 	struct Arg {
 		enum class Type {
 			NONE = -1,
 			FILENAME = 0,
 			FLAG,
-			STRING
+			STRING,
+			FLAG_VALUE // operand taken by a long flag, e.g. 5 in --top 5
 		} type = Type::NONE;
-		String value;
+		LFSEString value;
 		uint16_t idx = 0;
 		
 		inline bool isFlagAndStartsWith(char c) const { return isTypeFlag() && !value.isEmpty() && value[0] == c; }
@@ -108,41 +292,47 @@ struct LFSECommand {
 		inline bool isTypeFlag() const { return type == Type::FLAG; }
 		inline bool isTypeString() const { return type == Type::STRING; }
 		inline bool isTypeFilename() const { return type == Type::FILENAME; }
+		inline const char* c_str() const { return value.c_str(); }
 
-		String toString(bool onlyContent = true) const {
-			if (onlyContent)
-				return value;
-			return (isTypeFlag() ? "-" : (type == Type::STRING ? "\"" : "")) + value + (type == Type::STRING ? "\"" : "");
-		}
-		operator String() const { return toString(); }
+		size_t printTo(Print& p, bool onlyContent = true) const;
 
 		bool operator<(const Arg& rhs) const { return idx < rhs.idx; }
 		bool operator==(const Arg& x) const { return idx == x.idx && value.equals(x.value) && type == x.type; }
 	};
+	typedef std::vector<Arg, LFSEArenaAllocator<Arg>> Args;
 
-	String _cmd;
-	std::vector<Arg> _args; // TODO: should be hashset?
+	LFSEString _cmd;
+	Args _args; // TODO: should be hashset?
 	char* _buffer = nullptr;
 	uint16_t _bufferLength = 0;
 	bool _argsParsed = false;
 	uint8_t _cmdBufferCursor = 0;
+	LFSEString _redirectPath; // empty if output is not redirected
+	bool _redirectAppend = false; // true for >>, false for >
 
 	LFSECommand() = default;
 	LFSECommand(char* buffer, uint16_t len) : _buffer(buffer), _bufferLength(len) { parseCmd(); }
 
 	// Flags
 	bool isSingleLetterFlagPresent(char f) const;
+	bool isLongFlagPresent(const char* name) const;
+	const Arg* takeLongFlagValue(const char* name);
 	template <typename T>
 	T getNumericalFlagValue(char f, const T& fallback = T()) const;
 	// Filenames
 	uint8_t getArgFirstFilenameOrLastArgIdx(uint8_t startIdx = 0) const;
-	Arg getArgFirstFilenameOrLastArg(uint8_t startIdx = 0) const;
+	const Arg& getArgFirstFilenameOrLastArg(uint8_t startIdx = 0) const;
+	uint8_t getArgLastFilenameIdx() const;
+	uint8_t countArgs(Arg::Type type) const;
+
+	bool isRedirected() const { return !_redirectPath.isEmpty(); }
 
 	void parseCmd();
 	void parseArgs();
 
-	String toString() const;
-	operator String() const { return toString(); }
+	size_t printTo(Print& p) const override;
+private:
+	void parseRedirect();
 };
 
 namespace std {
@@ -153,57 +343,631 @@ namespace std {
 	};
 }
 
-typedef std::function<void(LFSECommand&)> cmdFunc;
+// Iterative depth-first walk over the tree below the root directory.
+// Keeps one open Dir per level in a fixed stack, so there's no recursion
+// and memory doesn't depend on the size of the tree
+struct LFSETreeWalker {
+	Dir _dirs[LFSE_WALK_MAX_DEPTH];
+	uint16_t _positions[LFSE_WALK_MAX_DEPTH]; // entries read from each Dir, 0 below the current level
+	LFSEPath _path; // path of the current entry
+	uint8_t _depth = 0;
+	bool _entryPushed = false;
+	bool _descendPending = false;
+	bool _truncated = false; // something was skipped for being too deep or too long
+	bool _childrenFirst = false;
+	bool _leaving = false; // current entry is a directory whose children were all visited
+
+	// childrenFirst: directories come after their children instead of before them
+	bool begin(const char* root, bool childrenFirst = false);
+	bool next(); // moves to the next entry, false when the walk is over
+	void skipChildren() { _descendPending = false; } // don't walk into current directory (parents first only)
+	// moves back to the entry saved by positions() after begin(), walking only the directories above it.
+	// False if the walk ended; if the tree changed meanwhile the walk is left at some entry nearby (parents first only)
+	bool resume(const uint16_t* positions);
+
+	const LFSEPath& path() const { return _path; }
+	Dir& dir() { return _dirs[_depth - 1]; } // Dir positioned at the current entry
+	uint8_t depth() const { return _depth; } // 1 for root's children
+	const uint16_t* positions() const { return _positions; } // LFSE_WALK_MAX_DEPTH entries
+	bool isTruncated() const { return _truncated; }
+};
+
+// Predicates of find compiled into a flat program that is evaluated for every entry of the walk.
+// Instructions are ordered by cost and evaluation stops at the first one that fails,
+// so name globs are only matched for entries that passed the metadata checks
+struct LFSEFindProgram {
+	enum class Op : uint8_t { // cheapest first
+		TYPE, // value: 1 for directories, 0 for files
+		SIZE_LESS,
+		SIZE_EQUAL,
+		SIZE_GREATER,
+		NEWER, // value: last write time
+		NAME
+	};
+	struct Insn {
+		Op op;
+		uint32_t value;
+		const char* pattern; // NAME only
+	};
+	Insn _insns[LFSE_FIND_MAX_PREDICATES];
+	uint8_t _length = 0;
+
+	bool add(Op op, uint32_t value, const char* pattern = nullptr); // false if the program is full
+	void optimize(); // orders instructions by cost
+	bool matches(Dir& dir, const char* name) const;
+};
+
+// File that keeps track of what it costs to flash. Physical flash operations
+// can't be observed on ESP8266, so on close the file charges an estimate
+// to the running command: littlefs rewrites everything from the block
+// holding the first modified byte up to the end of file (copy-on-write),
+// inline files are rewritten as a part of the metadata commit
+struct LFSEFile : public File {
+	uint32_t _sizeOnOpen = 0;
+	uint32_t _firstWriteOffset = UINT32_MAX;
+	uint32_t _journalSeq = 0; // record that covers the writes so far, see journalWrite
+	bool _dirty = false;
+	bool _append = false;
+	bool _journal = false; // writes are journaled, set by DEBUG::fsOpen
+
+	LFSEFile() = default;
+	explicit LFSEFile(const File& f);
+	LFSEFile(LFSEFile&& other);
+	LFSEFile& operator=(LFSEFile&& other);
+	LFSEFile(const LFSEFile&) = delete;
+	LFSEFile& operator=(const LFSEFile&) = delete;
+	~LFSEFile() { close(); }
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+	bool truncate(uint32_t size);
+	void sync(); // commits written data, the file stays open
+	void close();
+	void journalWrite();
+private:
+	void chargeWear();
+	void touch(uint32_t offset);
+	void release(LFSEFile& other);
+};
+
+// Files appended to by tee -a and the kv log stay open between commands (LRU), so that each append doesn't
+// walk the metadata and the CTZ skip-list to the end of the file again, and appends between two syncs
+// don't copy the partially filled last block each.
+// Written data is synced before any other command runs, on sync and LFSE_HANDLE_CACHE_SYNC_MS
+// after the last write (see DEBUG::syncIdleFiles). Handles are closed as soon as their path
+// is opened for writing, removed or renamed through DEBUG::fs* calls
+struct LFSEHandleCache {
+	struct Entry {
+		LFSEFile file;
+		uint32_t lastUse = 0;
+		bool readable = false; // opened "a+"
+	};
+	Entry _entries[LFSE_HANDLE_CACHE_SIZE];
+	uint32_t _useCounter = 0;
+	uint32_t _lastWrite = 0; // millis
+	uint32_t _nHits = 0;
+	uint32_t _nMisses = 0;
+	uint32_t _nEvictions = 0;
+	uint32_t _nSyncs = 0;
+
+	LFSEFile* openAppend(const char* path, bool readable = false); // nullptr if the file can't be opened
+	void markWritten() { _lastWrite = millis(); }
+	void sync();
+	void invalidate(const char* path); // closes the handles of the path and of everything under it
+	void clear();
+};
+
+// Write cost accumulated by a single command, see DEBUG::cmdWear
+struct LFSEWearStats {
+	const char* cmd = nullptr; // points into lfseCmdMap key
+	uint32_t calls = 0;
+	uint32_t logicalBytes = 0; // bytes the user asked to change
+	uint32_t programBytes = 0; // estimated bytes programmed to flash
+	uint32_t eraseOps = 0; // estimated blocks erased
+	uint32_t metaCommits = 0; // metadata pair commits
+};
+
+// Collects everything printed into it and passes it to the file
+// in LFSE_FILE_PAGE_LENGTH chunks, so that many tiny prints
+// don't turn into many tiny flash writes
+struct LFSEFileWriter : public Print {
+	LFSEFile _file;
+	uint8_t _buffer[LFSE_FILE_PAGE_LENGTH];
+	uint16_t _bufferCursor = 0;
+
+	bool open(const char* path, bool append);
+	void close();
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+	void flush() override;
+
+	operator bool() const { return (bool)_file; }
+};
+
+// Machine mode: a line "@<id> <command>" runs the command without echo, and everything it prints
+// comes back in frames tagged with the id, so that a host can send several commands at once
+// and match the responses without parsing human output:
+//   "@<id> O <length>\n" followed by length bytes of output
+//   "@<id> E <length>\n" followed by length bytes of errors and diagnostics
+//   "@<id> S <status>\n" ends the response, see Status
+// Output and errors keep their order, each of them is collected into LFSE_FRAME_CHUNK_LENGTH chunks
+struct LFSEFrameWriter {
+	enum Status : uint8_t {
+		STATUS_OK = 0,
+		STATUS_ERROR = 1, // command failed, diagnostics alone don't make it fail
+		STATUS_NOT_FOUND = 2, // no such command
+		STATUS_BAD_REQUEST = 3 // malformed id or too long line
+	};
+	struct Channel : public Print {
+		LFSEFrameWriter* _writer;
+		char _type;
+
+		Channel(LFSEFrameWriter* writer, char type) : _writer(writer), _type(type) {}
+		size_t write(uint8_t c) override { return _writer->write(_type, &c, 1); }
+		size_t write(const uint8_t* buffer, size_t size) override { return _writer->write(_type, buffer, size); }
+		using Print::write;
+	};
+
+	Channel _out { this, 'O' };
+	Channel _err { this, 'E' };
+	Print* _link = nullptr;
+	uint32_t _id = 0;
+	uint8_t _buffer[LFSE_FRAME_CHUNK_LENGTH];
+	uint8_t _bufferCursor = 0;
+	char _bufferType = 'O';
+
+	void begin(Print* link, uint32_t id);
+	void end(Status status);
+	size_t write(char type, const uint8_t* buffer, size_t size);
+	void flush();
+};
+
+// Compresses everything printed into it and passes it on, see lfsecodec.h.
+// The encoder lives in the arena for the duration of the command
+struct LFSELzPrint : public Print {
+	LFSELzEncoder* _encoder = nullptr;
+	Print* _out = nullptr;
+
+	bool begin(Print* out);
+	void end(); // marks the end of the compressed stream
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+};
+// Decompresses what's read from the underlying stream
+struct LFSELzStream : public Stream {
+	LFSELzDecoder* _decoder = nullptr;
+	Stream* _in = nullptr;
+	int _peeked = -1;
+
+	bool begin(Stream* in);
+	void end();
+	bool isFinished() const { return _decoder && _decoder->isFinished() && _peeked < 0; }
+
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t) override { return 0; }
+};
+
+// LFZ is a compressed file format that can be read from any position cheaply and appended to in place:
+//   magic LFSE_LFZ_MAGIC
+//   blocks: up to LFSE_LFZ_BLOCK_LENGTH raw bytes compressed independently (see lfsecodec.h),
+//           each followed by a LFSELzFooter
+// The footer of the last block describes the whole file, the other blocks are found by walking the footers back.
+// A block torn by a power loss fails its CRC: the file is read up to the last complete block and the next
+// append writes over the rest.
+// All numbers are little endian
+struct LFSELzFooter {
+	uint16_t length; // of the compressed block
+	uint16_t rawLength; // top bit: block ends with '\r'
+	uint32_t rawEnd; // raw bytes up to the end of the block
+	uint32_t linesEnd; // CRLFs up to the end of the block
+	uint32_t crc; // of the compressed block followed by the fields above
+};
+// Block of a LFZ file found through the footers
+struct LFSELzBlock {
+	uint32_t offset; // of the block in the file
+	uint32_t end; // of its footer, where the next block starts
+	LFSELzFooter footer;
+
+	uint32_t rawOffset() const { return footer.rawEnd - (footer.rawLength & 0x7fff); }
+};
+
+// Appends data to a LFZ file: compresses it block by block straight into the file,
+// nothing written before the last block is touched
+struct LFSELzFileWriter : public Print {
+	LFSEFile _file;
+	LFSELzEncoder* _encoder = nullptr;
+	uint32_t _end = 0; // of the last complete block
+	uint32_t _rawSize = 0;
+	uint32_t _nLines = 0;
+	uint32_t _crc = 0; // of the block being compressed
+	uint16_t _blockRawLength = 0;
+	uint16_t _blockLines = 0;
+	bool _endsWithCR = false;
+	bool _ok = false; // everything was written
+
+	bool open(const char* path, bool append);
+	bool close();
+
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t* buffer, size_t size) override;
+	using Print::write;
+private:
+	void finishBlock();
+	uint16_t takeBackLastBlock(const LFSELzBlock& last, uint8_t*& buffer);
+};
+
+// Reads LFZ file as if it was plain: decompresses on the fly and jumps
+// through the footers straight to the block holding the requested position/line
+struct LFSELzFileReader : public Stream {
+	static const uint8_t MAGIC_LENGTH = sizeof(LFSE_LFZ_MAGIC) - 1;
+	File _file;
+	LFSELzDecoder* _decoder = nullptr;
+	LFSELzBlock _last;
+	uint32_t _position = 0; // raw
+	uint16_t _history = 0; // bytes in decoder window that can be read again
+	uint16_t _replay = 0; // bytes to read from the window before decoding further
+
+	static bool findLastBlock(File& f, LFSELzBlock& block);
+	static bool readBlock(File& f, LFSELzBlock& block, bool verify);
+	bool open(File& f); // false if it's not a LFZ file
+	void close();
+
+	size_t size() const { return _last.footer.rawEnd; }
+	size_t position() const { return _position; }
+	bool seek(uint32_t pos);
+	bool seekLine(uint32_t line);
+
+	int available() override { return size() - _position; }
+	int read() override;
+	int peek() override;
+	size_t write(uint8_t) override { return 0; }
+	operator bool() const { return _decoder; }
+private:
+	bool previous(LFSELzBlock& block);
+	bool startBlock(const LFSELzBlock& block);
+};
+
+// Lines of one of the files compared by diff, which are currently in the window.
+// Lines are kept as offsets and hashes only, their content is read again when printed
+struct LFSEDiffWindow {
+	struct Line {
+		uint32_t offset;
+		uint32_t hash; // of the whole line including its end
+	};
+	File _file;
+	Line _lines[LFSE_DIFF_WINDOW_LINES];
+	uint32_t _firstLine = 1; // number of _lines[0]
+	uint32_t _nextOffset = 0; // where the line after the window starts
+	uint8_t _nLines = 0;
+
+	void fill(); // reads lines until the window is full or the file ends
+	void drop(uint8_t n); // removes n lines from the front
+	void printLine(uint8_t idx, char prefix, Print& out);
+	bool isLineEqual(uint8_t idx, LFSEDiffWindow& other, uint8_t otherIdx);
+	bool isAtEnd() const { return _nextOffset >= _file.size(); }
+	uint32_t lineEnd(uint8_t idx) const { return idx + 1 < _nLines ? _lines[idx + 1].offset : _nextOffset; }
+};
+
+// Ring log is a directory holding the header file LFSE_RLOG_HEADER_NAME, which is written once,
+// and segment files named by their sequence numbers ("%08x"), oldest to newest.
+// Appends go to the newest segment, once it's full a new one is started and the oldest is removed
+struct LFSERingLogHeader {
+	char magic[4];
+	uint32_t segmentLength;
+	uint16_t nSegments;
+};
+
+// Key-value store kept in a single append-only log file, so that updating a key
+// appends a few bytes instead of rewriting a file. Each set/del appends a record:
+//   u8 type, u8 key length, u16 value length, u32 CRC-32 of type, key and value, key, value
+// In-RAM hash index (linear probing) maps keys to their last record, it's rebuilt by scanning
+// the log on mount, a torn record at the end of the log is cut off.
+// When dead records take too much of the log, the live ones are copied into a new log.
+// Plain struct, so that it can be placed into the arena, call mount() before use
+struct LFSEKVStore {
+	struct Slot {
+		uint32_t hash;
+		uint32_t offset; // of the record in the log, NO_OFFSET if the slot is free
+	};
+	struct Record {
+		uint8_t type;
+		uint8_t keyLength;
+		uint16_t valueLength;
+		uint32_t crc;
+	};
+	enum RecordType : uint8_t { SET = 'S', DEL = 'D' };
+	static const uint32_t NO_OFFSET = 0xffffffff;
+
+	Slot _slots[LFSE_KV_MAX_KEYS];
+	const char* _path;
+	uint32_t _size; // of the log
+	uint32_t _liveBytes; // taken by the last records of the keys
+	uint16_t _nKeys;
+	bool _mounted;
+
+	bool mount(const char* path);
+	void unmount() { _mounted = false; }
+	bool refresh(const char* path); // mounts unless the log is already mounted and wasn't changed behind the store's back
+	// keys are expected to be 1..LFSE_KV_MAX_KEY_LENGTH chars long
+	bool get(const char* key, Print* out); // out can be nullptr to check that the key exists
+	bool set(const char* key, const uint8_t* value, uint16_t valueLength);
+	bool del(const char* key);
+	void list(Print& out); // prints keys along with sizes of their values
+	bool compact();
+	bool isFull() const { return _nKeys >= LFSE_KV_MAX_KEYS - LFSE_KV_MAX_KEYS / 8; }
+private:
+	LFSEFile* log();
+	static uint32_t hashKey(const char* key, uint8_t keyLength) { return (uint32_t)lfseFnv64(reinterpret_cast<const uint8_t*>(key), keyLength); }
+	static uint32_t recordSize(const Record& record) { return sizeof(Record) + record.keyLength + record.valueLength; }
+	int16_t find(File& f, const char* key, uint8_t keyLength, uint32_t hash, Record& record);
+	bool readRecord(File& f, uint32_t offset, Record& record, char* key, bool verify);
+	uint32_t append(RecordType type, const char* key, uint8_t keyLength, const uint8_t* value, uint16_t valueLength);
+	void insert(uint32_t hash, uint32_t offset);
+	void erase(uint16_t slotIdx);
+	void compactIfNeeded();
+};
+
+// Bounded journal of the changes made through DEBUG::fs* calls, one text line per change:
+// "<seq> <op> <path>[ <path_to>]". Once the current file would outgrow half of LFSE_JOURNAL_MAX_LENGTH,
+// it replaces the previous one, so that a host syncing incrementally only has to fetch what changed.
+// Files are journaled when they're written, not when they're opened, and writes to a file whose
+// record nobody has read yet (see last) don't add records
+struct LFSEJournal {
+	enum Op : char {
+		WRITE = 'w', // file created or written
+		REMOVE = 'r',
+		MOVE = 'm', // followed by the new path
+		MKDIR = 'd',
+		RMDIR = 'x',
+		FORMAT = 'F' // everything was removed
+	};
+	uint32_t _seq; // of the last record, 0 if there is none
+	uint32_t _seenSeq; // records up to this one may have been read, later writes need a new record
+	uint64_t _lastWriteHash; // of the path if the last record is a write, 0 otherwise
+	uint32_t _size; // of the current file
+	bool _mounted;
+
+	void mount(); // finds where the journal ended, done lazily
+	void record(Op op, const char* path, const char* pathTo = nullptr);
+	uint32_t last(); // seq of the last record, the caller is taken to have seen it
+	uint32_t oldest(); // seq of the oldest record kept, _seq + 1 if there is none
+	// true if a record after since names the path or a directory above it, or if records after since were dropped
+	bool touchedSince(uint32_t since, const char* path);
+	bool printSince(uint32_t since, Print& out); // false if some of the records were dropped or lost
+};
+
+// Scrub reads every file in steps of bounded duration and compares its CRC with the manifest:
+// a table of LFSE_SCRUB_MANIFEST_SLOTS LFSEScrubEntry (linear probing by path hash).
+// The cursor is kept in LFSEScrubState, small enough to be inlined into directory metadata,
+// so that a step can resume where the previous one stopped, even after a reboot.
+// Steps share it in RAM and save it once in a while: a reboot only repeats the last few steps
+struct LFSEScrubEntry {
+	uint32_t hash; // of the path, 0 if the slot is free
+	uint32_t size;
+	uint32_t time; // last write
+	uint32_t crc;
+	uint32_t seq; // journal seq when crc was taken
+	uint32_t pass; // when the file was last seen
+};
+struct LFSEScrubState {
+	char magic[4];
+	uint32_t pass;
+	uint32_t index; // walk entries done in this pass
+	uint16_t cursor[LFSE_WALK_MAX_DEPTH]; // walker positions of the last entry done
+	uint32_t nFiles; // checked in this pass
+	uint32_t nMismatches; // since reset
+	uint32_t nSlowReads;
+	uint32_t avgReadUs; // moving average of a full block read
+	// file in progress
+	uint32_t offset;
+	uint32_t crc; // of the bytes before offset
+	uint32_t fileSize;
+	uint32_t fileTime;
+	uint32_t fileSeq; // journal seq when the file was started
+};
+static_assert(sizeof(LFSEScrubState) <= LFSE_INLINE_FILE_MAX_SIZE, "scrub state should stay inline");
+
+typedef std::function<bool(LFSECommand&)> cmdFunc;
+// Non-owning reference to a callable taking a path, for callbacks that only live during the call.
+// Unlike std::function it never allocates, whatever the lambda captures
+class pathFunc {
+public:
+	template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, pathFunc>::value>::type>
+	pathFunc(F&& func) : _func(const_cast<void*>(static_cast<const void*>(&func))),
+		_call([](void* func, const LFSEPath& path) { (*static_cast<typename std::remove_reference<F>::type*>(func))(path); }) {}
+	void operator()(const LFSEPath& path) const { _call(_func, path); }
+private:
+	void* _func;
+	void (*_call)(void*, const LFSEPath&);
+};
 typedef std::tuple<cmdFunc, String, String> cmdInfo; // function, arguments description, command description
 typedef std::pair<String, cmdInfo> cmdMapEntry;
+// allows looking commands up by plain char* without constructing String
+struct cmdMapLess {
+	typedef void is_transparent;
+	bool operator()(const String& lhs, const String& rhs) const { return strcmp(lhs.c_str(), rhs.c_str()) < 0; }
+	bool operator()(const String& lhs, const char* rhs) const { return strcmp(lhs.c_str(), rhs) < 0; }
+	bool operator()(const char* lhs, const String& rhs) const { return strcmp(lhs, rhs.c_str()) < 0; }
+};
 
 class DEBUG {
 public:
 	static void LittleFSExplorer(const String& cmd);
+	static void syncIdleFiles(); // call from loop() to sync cached appends even when no commands come
+	static void scrubInBackground(uint32_t budgetMs = LFSE_SCRUB_BUDGET_MS); // call from loop() every few seconds to check files continuously
 	static void _debug();
+
+	static Print* lfseOut; // where commands print their output to
+	static Print* lfseErr; // where commands print errors to
+	static LFSEArena lfseArena; // per-command temporaries, reset after each command
 private:
-	static std::map<String, cmdInfo> lfseCmdMap;
+	friend struct LFSEFile;
+	friend struct LFSEFileWriter;
+	friend struct LFSELzFileWriter;
+	friend struct LFSEKVStore;
+	friend struct LFSEHandleCache;
+	friend struct LFSEJournal;
+	static std::map<String, cmdInfo, cmdMapLess> lfseCmdMap;
 	static char lfseBuffer[];
 	static LFSEPath lfsePath;
+	static LFSEFileWriter lfseRedirectWriter;
+	static LFSEWearStats lfseWear[];
+	static LFSEWearStats* lfseWearCurrent;
+	static uint32_t lfseWearBlockSize;
+	static LFSEKVStore lfseKV;
+	static LFSEFrameWriter lfseFrame;
+	static LFSEHandleCache lfseHandles;
+	static LFSEJournal lfseJournal;
+	static LFSEScrubState lfseScrub; // pass is 0 until it's loaded
+	static bool lfseScrubDirty; // changed since it was saved
+	static uint32_t lfseScrubSavedAt;
 
 	static void logExecutedCommand(const LFSECommand& cmd);
-	static void handleCommand(uint16_t length);
-
-	static void cmdHelp(LFSECommand& cmd);
-	static void cmdFormat(LFSECommand& cmd);
-	static void cmdLs(LFSECommand& cmd);
-	static void cmdCd(LFSECommand& cmd);
-	static void cmdPwd(LFSECommand& cmd);
-	static void cmdMkdir(LFSECommand& cmd);
-	static void cmdMv(LFSECommand& cmd);
-	static void cmdRm(LFSECommand& cmd);
-	static void cmdCp(LFSECommand& cmd);
-	static void cmdTouch(LFSECommand& cmd);
-	static void cmdWrite(LFSECommand& cmd);
-	static void cmdCat(LFSECommand& cmd);
-	static void cmdMan(LFSECommand& cmd);
-
-	static bool checkIsAFile(const File& f, const String& path);
-	static bool checkIsADir(const File& f, const String& path);
+	static bool handleCommand(uint16_t length, bool echo = true, bool* succeeded = nullptr);
+	static void handleMachineCommand(uint16_t length, bool tooLong);
+	static bool beginRedirect(const LFSECommand& cmd);
+	static void endRedirect(Print* out);
+
+	static bool cmdHelp(LFSECommand& cmd);
+	static bool cmdFormat(LFSECommand& cmd);
+	static bool cmdLs(LFSECommand& cmd);
+	static bool cmdCd(LFSECommand& cmd);
+	static bool cmdPwd(LFSECommand& cmd);
+	static bool cmdMkdir(LFSECommand& cmd);
+	static bool cmdMv(LFSECommand& cmd);
+	static bool cmdRm(LFSECommand& cmd);
+	static bool cmdCp(LFSECommand& cmd);
+	static bool cmdTouch(LFSECommand& cmd);
+	static bool cmdWrite(LFSECommand& cmd);
+	static bool writeArgs(Print& f, LFSECommand& cmd, uint8_t firstArgIdx, bool newLines);
+	static bool cmdSync(LFSECommand& cmd);
+	static bool writeChanged(LFSECommand& cmd, uint8_t firstArgIdx, const LFSEPath& filePath, bool newLines);
+	static bool cmdCat(LFSECommand& cmd);
+	static bool cmdDd(LFSECommand& cmd);
+	static bool cmdCmp(LFSECommand& cmd);
+	static bool cmdDiff(LFSECommand& cmd);
+	static bool openFilePair(LFSECommand& cmd, LFSEPath paths[2], File files[2]);
+	static bool cmdMan(LFSECommand& cmd);
+	static bool cmdMem(LFSECommand& cmd);
+	static bool cmdDf(LFSECommand& cmd);
+	static bool cmdFsinfo(LFSECommand& cmd);
+	static bool cmdFind(LFSECommand& cmd);
+	static bool findCompile(LFSECommand& cmd, LFSEFindProgram& program, bool& remove, bool& print0);
+	static bool cmdWear(LFSECommand& cmd);
+	static bool cmdChanges(LFSECommand& cmd);
+	static bool cmdScrub(LFSECommand& cmd);
+	static bool scrubStep(uint32_t budgetMs, Print* report); // true when a pass is complete
+	static LFSEScrubState& scrubState();
+	static void scrubSaveState(bool force);
+	static LFSEFile scrubOpenManifest(uint8_t* buffer);
+	static bool scrubFile(File& f, LFSEScrubState& state, uint8_t* buffer, uint32_t deadline, const LFSEPath& path, Print* report);
+	static void scrubVerify(LFSEFile& manifest, const LFSEPath& path, LFSEScrubState& state, uint32_t journalOldest, Print* report);
+	static void scrubFinding(Print* report, uint32_t pass, const char* format, ...);
+	static bool cmdTar(LFSECommand& cmd);
+	static bool cmdZwrite(LFSECommand& cmd);
+	static bool cmdZappend(LFSECommand& cmd);
+	static bool cmdKv(LFSECommand& cmd);
+	static bool cmdRlog(LFSECommand& cmd);
+	static bool rlogReadHeader(const LFSEPath& dirPath, LFSERingLogHeader& header);
+	static uint16_t rlogScan(const LFSEPath& dirPath, uint32_t& first, uint32_t& last);
+	static bool rlogSegmentPath(const LFSEPath& dirPath, uint32_t seq, LFSEPath& path);
+	static bool kvBench(uint16_t n, uint16_t valueLength);
+	static bool cmdSig(LFSECommand& cmd);
+	static bool cmdPatch(LFSECommand& cmd);
+
+	// all the modifying filesystem calls go through these, so that their cost is accounted
+	static LFSEFile fsOpen(const char* path, const char* mode);
+	static bool fsRemove(const char* path);
+	static bool fsRename(const char* pathFrom, const char* pathTo);
+	static bool fsMkdir(const char* path);
+	static bool fsMkdirs(const LFSEPath& path, uint8_t nExisting); // also the missing directories above path, below its first nExisting tokens
+	static bool fsRmdir(const char* path);
+	static bool fsFormat();
+	static LFSEFile openCounted(const char* path, const char* mode); // same as fsOpen, but not journaled
+	static void wearBegin(const char* cmd);
+	static void wearAddLogical(uint32_t nBytes) { lfseWearCurrent->logicalBytes += nBytes; }
+	static uint32_t wearBlockSize();
+
+	enum class LsOrder : uint8_t { NONE, NAME, SIZE, TIME };
+	struct LsEntry {
+		char name[LFSE_NAME_MAX_LENGTH + 1];
+		uint32_t size;
+		time_t time;
+		char type;
+	};
+	static bool lsBefore(const LsEntry& lhs, const LsEntry& rhs, LsOrder order);
+	static void lsPrintEntry(const LsEntry& entry);
+	static void lsPrintMore(const LFSEPath& dirPath, LsOrder order, const char* after, uint16_t limit);
+	static bool lsSorted(Dir& dir, const LFSEPath& dirPath, LsOrder order, const char* cursor, uint16_t limit, bool paged);
+	static bool lsUnsorted(Dir& dir, const LFSEPath& dirPath, const char* cursor, uint16_t limit);
+
+	struct CatOptions {
+		bool lineNumbers;
+		bool byteView;
+		bool plainMode;
+		uint16_t limitColumn;
+		uint32_t rowIdxFirst;
+		uint32_t rowIdxLast;
+	};
+	static bool catCompressed(LFSECommand& cmd);
+	static bool catFile(const LFSEPath& path, const CatOptions& opts, LFSEString& bufString);
+	template <typename FileLike>
+	static void catContent(FileLike& f, const CatOptions& opts, LFSEString& bufString);
+	static bool catSkipLines(File& f, uint32_t nLines);
+	static bool catSkipLines(LFSELzFileReader& f, uint32_t nLines) { return f.seekLine(nLines); }
+	static bool zwrite(LFSECommand& cmd, bool append);
+	static bool cpFile(const LFSEPath& pathSrc, const LFSEPath& pathDst, bool copyDir);
+	static bool mvPath(const LFSEPath& pathFrom, const LFSEPath& pathTo);
+	static bool rmPath(const LFSEPath& path, bool removeDir, int16_t firstIdx, int16_t lastIdx);
+	static bool tarCreate(const LFSEPath& dirPath);
+	static bool tarExtract(Stream& in, const LFSEPath& dirPath);
+	static bool tarExtractFile(Stream& in, const LFSEPath& path, uint32_t size, uint8_t* buffer);
+	static bool patchPrepare(LFSECommand& cmd, LFSEPath& filePath, LFSEPath& tmpPath, File& fOld);
+	static bool patchApply(Stream& in, File& fOld, LFSEFile& fNew, uint8_t* buffer);
+	static bool forEachPathMatch(const char* userPath, const pathFunc& func);
+
+	static bool checkIsAFile(const File& f, const char* path);
+	static bool checkIsADir(const File& f, const char* path);
 	static bool checkMissingOperand(LFSECommand& cmd, uint8_t nRequiredArgs = 1, LFSECommand::Arg::Type requiredType = LFSECommand::Arg::Type::FILENAME);
-	static bool checkInvalidDirPath(const String& path);
-	static bool checkInvalidFilePath(const String& path);
-	static bool checkAlreadyExists(const String& path);
-	static bool checkDoesntExist(const String& path);
+	static bool checkInvalidDirPath(const char* path);
+	static bool checkInvalidFilePath(const char* path);
+	static bool checkInvalidPattern(const char* path);
+	static bool checkNotADir(const char* userPath, LFSEPath& dirPath);
+	static bool checkPathTooLong(const char* userPath, LFSEPath& path);
+	static bool checkAlreadyExists(const char* path);
+	static bool checkDoesntExist(const char* path);
 
-	static bool readLine(File& f, String* s, uint16_t maxLen, size_t* strLenOut = nullptr, bool addCRLF = false);
-	static bool readChars(File& f, String* s, uint16_t maxLen, size_t* strLenOut = nullptr);
+	template <typename FileLike>
+	static bool readLine(FileLike& f, LFSEString* s, uint16_t maxLen, size_t* strLenOut = nullptr, bool addCRLF = false);
+	template <typename FileLike>
+	static bool readChars(FileLike& f, LFSEString* s, uint16_t maxLen, size_t* strLenOut = nullptr);
 	static uint8_t _debugIdx;
 	static void customDebugCode(const String&);
 };
 
+template <typename T>
+T* LFSEArenaAllocator<T>::allocate(size_t n) {
+	return static_cast<T*>(DEBUG::lfseArena.allocate(n * sizeof(T), alignof(T)));
+}
+template <typename T>
+void LFSEArenaAllocator<T>::deallocate(T* ptr, size_t n) {
+	DEBUG::lfseArena.deallocate(ptr, n * sizeof(T));
+}
+
 // A small helping struct for readLine function
 // Behaves as string if constructed with a valid string pointer
 // o/w very cheaply imitates string behavior
 struct StringLike {
-	String* _s;
+	LFSEString* _s;
 	size_t _sLength = 0;
-	StringLike(String* sPtr) : _s(sPtr) { }
+	StringLike(LFSEString* sPtr) : _s(sPtr) { }
 
 	size_t length() const { return _s ? _s->length() : _sLength; }
 	StringLike& operator+=(const char& rhs) {
@@ -226,7 +990,7 @@ struct StringLike {
 	}
 	void cut(size_t left, size_t right) { // .substring without creating new obj
 		if (_s) {
-			*_s = _s->substring(left, right);
+			_s->cut(left, right);
 			return;
 		}
 		_sLength = right - left;